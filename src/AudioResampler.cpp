@@ -0,0 +1,283 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "AudioResampler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+
+#include "AGAConvException.hpp"
+#include "AmigaTypeDefs.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+namespace AGAConv {
+
+static const double pi=3.14159265358979323846;
+
+AudioResampler::AudioResampler(uint32_t inFrequency, uint32_t outFrequency) {
+  assert(inFrequency>0 && outFrequency>0);
+  uint32_t divisor=std::gcd(inFrequency, outFrequency);
+  _upFactor=outFrequency/divisor;
+  _downFactor=inFrequency/divisor;
+  _numPhases=_upFactor<=maxPhases?(uint32_t)_upFactor:maxPhases;
+  // When downsampling the cutoff frequency is lowered to the Nyquist frequency of the output (with a small margin)
+  double scale=std::min(1.0,(double)outFrequency/inFrequency);
+  double cutoff=0.95*scale;
+  _halfTaps=(int)std::ceil(zeroCrossings/scale);
+  _numTaps=(2*_halfTaps+3)/4*4;
+  _taps.resize((size_t)(_numPhases+1)*_numTaps);
+  for(uint32_t p=0;p<=_numPhases;p++) {
+    float* taps=&_taps[(size_t)p*_numTaps];
+    double phase=(double)p/_numPhases;
+    double sum=0.0;
+    // Tap k is applied to the input sample at distance k-_halfTaps+1-phase of the output position
+    for(int k=0;k<2*_halfTaps;k++) {
+      double x=k-_halfTaps+1-phase;
+      double tap=cutoff*kaiserWindow(x/_halfTaps);
+      if(x!=0.0)
+        tap*=std::sin(pi*cutoff*x)/(pi*cutoff*x);
+      taps[k]=(float)tap;
+      sum+=tap;
+    }
+    // Normalized to a gain of 1 for constant signals
+    for(int k=0;k<2*_halfTaps;k++) {
+      taps[k]=(float)(taps[k]/sum);
+    }
+  }
+  _buffer.assign(_halfTaps,0.0f);
+}
+
+double AudioResampler::kaiserWindow(double x) {
+  if(x<=-1.0 || x>=1.0)
+    return 0.0;
+  // Modified Bessel function of the first kind (order 0)
+  auto besselI0=[](double v) {
+    double sum=1.0, term=1.0;
+    for(int k=1;k<32;k++) {
+      term*=(v/(2*k))*(v/(2*k));
+      sum+=term;
+    }
+    return sum;
+  };
+  const double beta=8.6;
+  return besselI0(beta*std::sqrt(1.0-x*x))/besselI0(beta);
+}
+
+float AudioResampler::dotProduct(const float* taps, const float* samples, int n) {
+  assert(n%4==0);
+#if defined(__SSE2__)
+  __m128 sums=_mm_setzero_ps();
+  for(int i=0;i<n;i+=4) {
+    sums=_mm_add_ps(sums, _mm_mul_ps(_mm_loadu_ps(taps+i), _mm_loadu_ps(samples+i)));
+  }
+  sums=_mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+  return _mm_cvtss_f32(_mm_add_ss(sums, _mm_shuffle_ps(sums, sums, 1)));
+#elif defined(__ARM_NEON)
+  float32x4_t sums=vdupq_n_f32(0.0f);
+  for(int i=0;i<n;i+=4) {
+    sums=vaddq_f32(sums, vmulq_f32(vld1q_f32(taps+i), vld1q_f32(samples+i)));
+  }
+  float32x2_t halfSums=vadd_f32(vget_low_f32(sums), vget_high_f32(sums));
+  return vget_lane_f32(vpadd_f32(halfSums, halfSums), 0);
+#else
+  // Same order of additions as the vectorized versions
+  float sums[4]={0.0f,0.0f,0.0f,0.0f};
+  for(int i=0;i<n;i+=4) {
+    for(int j=0;j<4;j++) {
+      sums[j]+=taps[i+j]*samples[i+j];
+    }
+  }
+  return (sums[0]+sums[2])+(sums[1]+sums[3]);
+#endif
+}
+
+void AudioResampler::produceOutputs(uint64_t numOutputs, vector<float>& out) {
+  for(;_outputCount<numOutputs;_outputCount++) {
+    uint64_t position=_outputCount*_downFactor;
+    // First (padded) input sample of the taps
+    uint64_t first=position/_upFactor+1;
+    if(first+_numTaps>_bufferStart+_buffer.size())
+      break;
+    uint64_t fraction=position%_upFactor;
+    const float* samples=&_buffer[first-_bufferStart];
+    float value;
+    if(_numPhases==_upFactor) {
+      value=dotProduct(&_taps[fraction*_numTaps], samples, _numTaps);
+    } else {
+      double phase=(double)fraction*_numPhases/_upFactor;
+      uint32_t p=(uint32_t)phase;
+      float weight=(float)(phase-p);
+      value=dotProduct(&_taps[(size_t)p*_numTaps], samples, _numTaps);
+      if(weight>0.0f)
+        value+=weight*(dotProduct(&_taps[(size_t)(p+1)*_numTaps], samples, _numTaps)-value);
+    }
+    out.push_back(value);
+  }
+  // Samples before the taps of the next output are not needed anymore
+  uint64_t next=(_outputCount*_downFactor)/_upFactor+1;
+  if(next>_bufferStart) {
+    size_t unused=(size_t)std::min<uint64_t>(next-_bufferStart, _buffer.size());
+    _buffer.erase(_buffer.begin(), _buffer.begin()+unused);
+    _bufferStart+=unused;
+  }
+}
+
+void AudioResampler::process(const float* in, size_t n, vector<float>& out) {
+  _buffer.insert(_buffer.end(), in, in+n);
+  _inputCount+=n;
+  produceOutputs(UINT64_MAX, out);
+}
+
+void AudioResampler::flush(vector<float>& out) {
+  _buffer.insert(_buffer.end(), (size_t)_halfTaps+_numTaps, 0.0f);
+  uint64_t numOutputs=(_inputCount*_upFactor+_downFactor/2)/_downFactor;
+  produceOutputs(numOutputs, out);
+  assert(_outputCount==numOutputs);
+}
+
+void AudioResampler::writeUnsignedPcm(ostream& pcmFile, vector<vector<float>>& channelSamples) {
+  size_t numChannels=channelSamples.size();
+  size_t numSamples=numChannels>0?channelSamples[0].size():0;
+  vector<UBYTE> pcmData(numSamples*numChannels);
+  for(size_t c=0;c<numChannels;c++) {
+    assert(channelSamples[c].size()==numSamples);
+    for(size_t i=0;i<numSamples;i++) {
+      // Same conversion as ffmpeg's float to unsigned 8 bit conversion
+      long value=std::lround(channelSamples[c][i]*128.0f)+128;
+      pcmData[i*numChannels+c]=(UBYTE)std::min(255L,std::max(0L,value));
+    }
+    channelSamples[c].clear();
+  }
+  pcmFile.write((const char*)pcmData.data(), pcmData.size());
+}
+
+static uint32_t readLittleEndian(const unsigned char* bytes, int numBytes) {
+  uint32_t value=0;
+  for(int i=numBytes-1;i>=0;i--) {
+    value=(value<<8)|bytes[i];
+  }
+  return value;
+}
+
+void AudioResampler::convertWavFile(const filesystem::path& wavFileName, const filesystem::path& pcmFileName,
+                                    uint32_t outFrequency, int verbose) {
+  ifstream wavFile(wavFileName, ios::in | ios::binary);
+  if(!wavFile.is_open()) {
+    throw AGAConvException(230, "cannot open audio file "+wavFileName.string());
+  }
+  unsigned char header[12];
+  if(!wavFile.read((char*)header, 12) || string((char*)header,4)!="RIFF" || string((char*)header+8,4)!="WAVE") {
+    throw AGAConvException(231, "audio file "+wavFileName.string()+" is not a WAV file.");
+  }
+  // Find format and data chunk
+  uint32_t format=0, numChannels=0, inFrequency=0, bitsPerSample=0;
+  uint64_t dataSize=0;
+  while(true) {
+    unsigned char chunkHeader[8];
+    if(!wavFile.read((char*)chunkHeader, 8)) {
+      throw AGAConvException(231, "no audio data in WAV file "+wavFileName.string());
+    }
+    string chunkId((char*)chunkHeader,4);
+    uint32_t chunkSize=readLittleEndian(chunkHeader+4, 4);
+    if(chunkId=="fmt ") {
+      vector<unsigned char> fmt(chunkSize);
+      if(chunkSize<16 || !wavFile.read((char*)fmt.data(), chunkSize)) {
+        throw AGAConvException(231, "invalid format chunk in WAV file "+wavFileName.string());
+      }
+      format=readLittleEndian(&fmt[0], 2);
+      numChannels=readLittleEndian(&fmt[2], 2);
+      inFrequency=readLittleEndian(&fmt[4], 4);
+      bitsPerSample=readLittleEndian(&fmt[14], 2);
+      // WAVE_FORMAT_EXTENSIBLE: the format is stored in the sub format
+      if(format==0xFFFE && chunkSize>=26)
+        format=readLittleEndian(&fmt[24], 2);
+      if(chunkSize%2==1)
+        wavFile.ignore(1);
+    } else if(chunkId=="data") {
+      // Size 0 or 0xFFFFFFFF if the writer could not update the header: the data ends at the end of the file
+      dataSize=(chunkSize==0 || chunkSize==0xFFFFFFFF)?UINT64_MAX:chunkSize;
+      break;
+    } else {
+      wavFile.ignore((streamsize)chunkSize+chunkSize%2);
+    }
+  }
+  bool int16Samples=(format==1 && bitsPerSample==16);
+  bool floatSamples=(format==3 && bitsPerSample==32);
+  if((!int16Samples && !floatSamples) || numChannels==0 || inFrequency==0) {
+    throw AGAConvException(231, "unsupported WAV format in "+wavFileName.string()+" (format: "+std::to_string(format)
+                           +", bits per sample: "+std::to_string(bitsPerSample)+"). Supported are 16 bit integer and 32 bit float samples.");
+  }
+
+  ofstream pcmFile(pcmFileName, ios::out | ios::binary);
+  if(!pcmFile.is_open()) {
+    throw AGAConvException(232, "cannot open PCM file "+pcmFileName.string());
+  }
+  vector<AudioResampler> resamplers(numChannels, AudioResampler(inFrequency, outFrequency));
+  const size_t blockFrames=16384;
+  const size_t bytesPerFrame=(size_t)numChannels*bitsPerSample/8;
+  vector<unsigned char> block(blockFrames*bytesPerFrame);
+  vector<float> inSamples(blockFrames);
+  vector<vector<float>> outSamples(numChannels);
+  uint64_t remainingBytes=dataSize;
+  while(remainingBytes>0 && wavFile) {
+    size_t readBytes=(size_t)std::min<uint64_t>(remainingBytes, block.size());
+    wavFile.read((char*)block.data(), readBytes);
+    size_t numFrames=(size_t)wavFile.gcount()/bytesPerFrame;
+    remainingBytes-=std::min<uint64_t>(remainingBytes, (uint64_t)wavFile.gcount());
+    for(uint32_t c=0;c<numChannels;c++) {
+      const unsigned char* sample=&block[(size_t)c*bitsPerSample/8];
+      for(size_t i=0;i<numFrames;i++) {
+        if(int16Samples) {
+          inSamples[i]=(int16_t)readLittleEndian(sample, 2)/32768.0f;
+        } else {
+          uint32_t bits=readLittleEndian(sample, 4);
+          float value;
+          std::memcpy(&value, &bits, sizeof(value));
+          inSamples[i]=value;
+        }
+        sample+=bytesPerFrame;
+      }
+      resamplers[c].process(inSamples.data(), numFrames, outSamples[c]);
+    }
+    writeUnsignedPcm(pcmFile, outSamples);
+  }
+  for(uint32_t c=0;c<numChannels;c++) {
+    resamplers[c].flush(outSamples[c]);
+  }
+  writeUnsignedPcm(pcmFile, outSamples);
+  if(!pcmFile) {
+    throw AGAConvException(232, "cannot write PCM file "+pcmFileName.string());
+  }
+  if(verbose>=1) {
+    cout<<"Resampled audio data from "<<inFrequency<<" Hz to "<<outFrequency<<" Hz ("<<numChannels<<" channel"<<(numChannels>1?"s":"")<<", native resampler)"<<endl;
+  }
+}
+
+} // namespace AGAConv
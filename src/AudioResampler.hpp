@@ -0,0 +1,79 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef AUDIO_RESAMPLER_HPP
+#define AUDIO_RESAMPLER_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <vector>
+
+namespace AGAConv {
+
+/* Converts the frequency of audio data with a polyphase windowed sinc
+   filter (in-process replacement of ffmpeg's audio resampling). The
+   ratio of output and input frequency is reduced to L/M, each of the L
+   phases has its own set of filter taps (Kaiser window). For large L
+   (frequencies without a large common divisor) a table of maxPhases
+   phases is used and the outputs of the two neighboring phases are
+   interpolated. The dot products of taps and samples are vectorized
+   with SSE2 or NEON. The input is processed in blocks (one resampler
+   object per channel), long audio tracks are never loaded at once.
+ */
+class AudioResampler {
+
+ public:
+  AudioResampler(uint32_t inFrequency, uint32_t outFrequency);
+  // Resamples the given input samples of one channel (values in -1..1) and appends the output samples to out.
+  // Output samples are produced as soon as all input samples required by their filter taps are available.
+  void process(const float* in, std::size_t n, std::vector<float>& out);
+  // Ends the input (zero padding) and appends the remaining output samples to out
+  void flush(std::vector<float>& out);
+  // Reads a WAV file with 16 bit integer or 32 bit float samples, resamples it to outFrequency, and
+  // writes the data as unsigned 8 bit PCM file (interleaved channels, same layout as ffmpeg's u8 format).
+  static void convertWavFile(const std::filesystem::path& wavFileName, const std::filesystem::path& pcmFileName,
+                             uint32_t outFrequency, int verbose);
+  // Converts the samples of all channels (same number of samples) to unsigned 8 bit, writes them
+  // interleaved to pcmFile, and removes them from channelSamples
+  static void writeUnsignedPcm(std::ostream& pcmFile, std::vector<std::vector<float>>& channelSamples);
+
+ private:
+  static const uint32_t maxPhases=1024;
+  static const int zeroCrossings=16;
+  // Returns the sum of taps[i]*samples[i] for n values (n is a multiple of 4)
+  static float dotProduct(const float* taps, const float* samples, int n);
+  static double kaiserWindow(double x);
+  void produceOutputs(std::uint64_t numOutputs, std::vector<float>& out);
+  std::uint64_t _upFactor;   // L
+  std::uint64_t _downFactor; // M
+  std::uint32_t _numPhases;
+  int _halfTaps;
+  int _numTaps;              // Taps per phase, multiple of 4
+  // _numPhases+1 rows of _numTaps taps (the last row is used for interpolation only)
+  std::vector<float> _taps;
+  // Input samples with _halfTaps leading zeros, _buffer[0] is the sample with (padded) index _bufferStart
+  std::vector<float> _buffer;
+  std::uint64_t _bufferStart=0;
+  std::uint64_t _inputCount=0;
+  std::uint64_t _outputCount=0;
+};
+
+} // namespace AGAConv
+
+#endif
@@ -32,11 +32,9 @@ ByteSequence::ByteSequence():
 }
 
 ByteSequence::ByteSequence(ULONG size):
-  debug(false)
+  debug(false),
+  data(size, 0)
 {
-  for(ULONG i=0;i<size;i++) {
-    add(0);
-  }
   assert(getDataSize()==size);
 }
 
@@ -108,6 +106,10 @@ void ByteSequence::writeAdjustPadding(uint32_t writeDataSize) {
   }
 }
 
+void ByteSequence::resetData(ULONG size) {
+  data.assign(size, 0);
+}
+
 uint32_t ByteSequence::getDataSize() const {
   return (uint32_t)data.size();
 }
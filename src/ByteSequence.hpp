@@ -39,6 +39,8 @@ class ByteSequence {
   void printData();
   uint32_t getDataSize() const;
   void removeData();
+  // Sets the data to size zero bytes (reuses the allocated memory)
+  void resetData(ULONG size);
   void setInFile(std::fstream* inFile);
   void setOutFile(std::fstream* inFile);
   UBYTE* address(ULONG offset);
@@ -18,10 +18,13 @@
 
 #include "CDXLEncode.hpp"
 
+#include <atomic>
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <memory>
 #include <sstream>
+#include <thread>
 
 #include "AGAConvException.hpp"
 #include "CDXLEncode.hpp"
@@ -29,8 +32,10 @@
 #include "IffBMHDChunk.hpp"
 #include "IffBODYChunk.hpp"
 #include "IffCMAPChunk.hpp"
+#include "NearestColorIndex.hpp"
 #include "Options.hpp"
 #include "PngLoader.hpp"
+#include "RawFrameLoader.hpp"
 #include "Util.hpp"
 
 using namespace std;
@@ -62,6 +67,23 @@ void CDXLEncode::checkFrequencyForStdCdxl(Options& options) {
 }
 
 void CDXLEncode::run(Options& options) {
+  prepareEncoding(options);
+  FileSequenceConversion::run(options);
+}
+
+void CDXLEncode::runFrameSource(Options& options, FrameSource frameSource) {
+  prepareEncoding(options);
+  FileSequenceConversion::runFrameSource(options, frameSource);
+}
+
+void CDXLEncode::prepareEncoding(Options& options) {
+  _jobs=options.jobs>0?options.jobs:std::max(1u,std::thread::hardware_concurrency());
+  _workerPool=std::make_unique<WorkerPool>((unsigned)_jobs);
+  if(options.scenePalettes()) {
+    _sceneCutDetector=std::make_unique<SceneCutDetector>(options.sceneThreshold);
+    _sceneQuantizer=std::make_unique<PaletteQuantizer>(options.maxColorsCorrected(), options.quantizerKMeans, options.colorDepth==Options::COL_12BIT);
+    _sceneQuantizer->clearHistogram();
+  }
   if(options.writeCdxl && options.hasOutFile()) {
     _outFile.open(options.outFileName, ios::out | ios::binary);
     if(_outFile.is_open() == false) {        
@@ -114,7 +136,6 @@ void CDXLEncode::run(Options& options) {
   if(options.verbose>=1) {
     cout<<"Running internal CDXL encoder (fps: "<<options.fps<<", frequency:"<<options.frequency<<", audio mode: "<<(options.stereo?"stereo":"mono")<<")"<<endl;
   }
-  FileSequenceConversion::run(options);
 }
 
 void CDXLEncode::preVisitFirstFrame() {
@@ -180,62 +201,27 @@ ByteSequence* CDXLEncode::readAudioData() {
     cerr<<"Error: no audio file."<<endl;
     return 0;
   }
-  switch (_audioMode) {
-  case 1: {
-    ByteSequence* audioByteSequence=new ByteSequence();
-    int dataLen=getMonoAudioDataLength();
-    for(int j=0;j<dataLen*_audioMode;j++) {
-      /* Convert from signed byte -128 .. 127
-         to unsigned byte 0 .. 255
-      */
-      UBYTE audioByte2;
-      if (!_sndFile.eof()) {
-        int8_t audioByte0=(int8_t)_sndFile.get();
-        int8_t audioByte1=(int8_t)audioByte0+128;
-        audioByte2=(UBYTE)audioByte1;
-        // Make sure the eof bit is set before we try to read again
-        _sndFile.peek();
-      } else {
-        audioByte2 = 0;
-      }
-      audioByteSequence->add(audioByte2);
-    }
-    return audioByteSequence;
+  if(_audioMode!=1 && _audioMode!=2) {
+    throw AGAConvException(96, "unsupported audio mode in CDXL generation (mode: "+std::to_string(_audioMode)+")");
   }
-  case 2: {
-    ByteSequence* audioByteSequence=new ByteSequence();
-    // Reshuffle bytes for Amiga stero format (ABABAB.. => AAA..BBB..)
-    list<UBYTE> tmp;
-    int dataLen=getMonoAudioDataLength();
-    for(int j=0;j<dataLen*_audioMode;j++) {
-      /* Convert from signed byte -128 .. 127
-	 to unsigned byte 0 .. 255
-      */
-      UBYTE audioByte2;
-      if (!_sndFile.eof()) {
-        int8_t audioByte0=(int8_t)_sndFile.get();
-        int8_t audioByte1=(int8_t)audioByte0+128;
-        audioByte2=(UBYTE)audioByte1;
-        // Make sure the eof bit is set before we try to read again
-        _sndFile.peek();
-      } else {
-        audioByte2 = 0;
-      }
-      if(j%2==0) {
-        audioByteSequence->add(audioByte2);
-      } else {
-        tmp.push_back(audioByte2);
-      }
-    }
-    for(UBYTE audioByte : tmp) {
-      audioByteSequence->add(audioByte);
-    }
+  int dataLen=getMonoAudioDataLength();
+  // Audio data of the frame is read at once, missing data at the end of the file is filled with 0
+  vector<UBYTE> pcmData((size_t)dataLen*_audioMode);
+  _sndFile.read((char*)pcmData.data(), pcmData.size());
+  size_t readLen=(size_t)_sndFile.gcount();
+  ByteSequence* audioByteSequence=new ByteSequence((ULONG)pcmData.size());
+  if(pcmData.empty())
     return audioByteSequence;
+  UBYTE* audioData=audioByteSequence->address(0);
+  // Convert from unsigned byte 0 .. 255 to signed byte -128 .. 127 and
+  // reshuffle bytes for Amiga stereo format (ABABAB.. => AAA..BBB..)
+  for(int channel=0;channel<_audioMode;channel++) {
+    for(int j=0;j<dataLen;j++) {
+      size_t i=(size_t)j*_audioMode+channel;
+      audioData[channel*dataLen+j]=i<readLen?(UBYTE)(pcmData[i]^0x80):0;
+    }
   }
-  default:
-    throw AGAConvException(96, "unsupported audio mode in CDXL generation (mode: "+std::to_string(_audioMode)+")");
-  }
-  assert(false);
+  return audioByteSequence;
 }
 
 void CDXLEncode::addColorsForTargetPlanes(int targetPlanes, IffCMAPChunk* cmapChunk) {
@@ -281,7 +267,6 @@ void CDXLEncode::fillPaletteToMaxColorsOfPlanes(int targetPlanes, CDXLFrame& fra
 }
 
 void CDXLEncode::importILBMChunk(CDXLFrame& frame, IffILBMChunk* ilbmChunk) {
-  uint32_t verbosityLevel=2;
   // (i) Convert IFF file into a CDXL block
   IffBMHDChunk* bmhdChunk=ilbmChunk->getBMHDChunk();
   IffCAMGChunk* camgChunk=ilbmChunk->getCAMGChunk();
@@ -303,13 +288,20 @@ void CDXLEncode::importILBMChunk(CDXLFrame& frame, IffILBMChunk* ilbmChunk) {
   }
 
   frame.header.initialize(bmhdChunk,cmapChunk,camgChunk);
+  frame.importVideo(ilbmChunk);
+  importFrameData(frame,cmapChunk,camgChunk);
+}
+
+void CDXLEncode::importFrameData(CDXLFrame& frame, IffCMAPChunk* cmapChunk, IffCAMGChunk* camgChunk) {
+  uint32_t verbosityLevel=2;
+  assert(frame.video);
   if(options.resMode==Options::GFX_UNSPECIFIED) {
     // clear Lores flag in case it has been set
     frame.header.setResolutionModes(static_cast<UBYTE>(Options::GFX_UNSPECIFIED));
   }
   if((options.verbose>=verbosityLevel)||options.debug) {
     cout<<".. encoding CDXL frame "<<frame.header.getCurrentFrameNr();
-    cout<<" ("<<cmapChunk->numberOfColors()<<" colors, "<<+bmhdChunk->getNumPlanes()<<" bitplanes)";
+    cout<<" ("<<cmapChunk->numberOfColors()<<" colors, "<<+frame.header.getNumberOfBitplanes()<<" bitplanes)";
   }
 
   if(options.debug) {
@@ -328,10 +320,6 @@ void CDXLEncode::importILBMChunk(CDXLFrame& frame, IffILBMChunk* ilbmChunk) {
     cout<<"DEBUG: num fixed planes : "<<options.fixedPlanesNum<<endl;
   }
 
-  assert(ilbmChunk);
-  frame.importVideo(ilbmChunk);
-  assert(frame.video);
-
   // Fill color palette and video data with fill data ensure fixed frame size, update header
   // except it is a HAM6, HAM8, or EHB frame, in which case the planes are fixed anyways,
   // but filling up would make it wrong, because these modes have extra planes.
@@ -428,28 +416,189 @@ void CDXLEncode::importAudio(CDXLFrame& frame) {
 }
 
 void CDXLEncode::visitPngFile(string pngFileName) {
-  if(options.verbose>=2) {
-    cout<<"Loading: png file "<<pngFileName;
-    cout<<" ";
+  // Loading and conversion of the frame run in a worker
+  unsigned frameThreads=ditherThreads();
+  auto convertedFrame=_workerPool->submit([this, pngFileName, frameThreads]() {
+    auto pngLoader=std::make_unique<PngLoader>();
+    pngLoader->readFile(pngFileName);
+    return convertFrame(std::move(pngLoader), frameThreads);
+  });
+  addPendingFrame("Loading: png file "+pngFileName, std::move(convertedFrame));
+}
+
+void CDXLEncode::visitRawFrame(std::unique_ptr<RawFrameLoader> frameLoader) {
+  // Frames received before this one are encoded, buffered in the current scene (scene palettes), or pending
+  string info="Receiving: stream frame "+std::to_string(_currentFrameNr+_sceneFrames.size()+_pendingFrames.size());
+  // The frame is read in order, its conversion runs in a worker
+  unsigned frameThreads=ditherThreads();
+  auto convertedFrame=_workerPool->submit([this, loader=std::move(frameLoader), frameThreads]() mutable {
+    return convertFrame(std::unique_ptr<PngLoader>(std::move(loader)), frameThreads);
+  });
+  addPendingFrame(info, std::move(convertedFrame));
+}
+
+CDXLEncode::ConvertedFrame CDXLEncode::convertFrame(std::unique_ptr<PngLoader> frameLoader, unsigned threads) {
+  // Input and converted image of a frame are in memory at the same time
+  size_t frameMemory=(size_t)frameLoader->getWidth()*frameLoader->getHeight()*(frameLoader->isTruecolorImage()?4:1)*2;
+  size_t maxFrameMemory=_frameMemory.load();
+  while(maxFrameMemory<frameMemory && !_frameMemory.compare_exchange_weak(maxFrameMemory, frameMemory)) {
+  }
+  ConvertedFrame convertedFrame;
+  if(frameLoader->isTruecolorImage()) {
+    prepareTruecolorFrame(*frameLoader, threads);
+    if(frameLoader->isTruecolorImage()) {
+      convertedFrame.sceneFrame=std::move(frameLoader);
+      return convertedFrame;
+    }
   }
-  PngLoader pngLoader;
-  pngLoader.readFile(pngFileName);
+  convertedFrame.planarFrame=convertPalettedFrame(*frameLoader);
+  return convertedFrame;
+}
+
+void CDXLEncode::addPendingFrame(string info, std::future<ConvertedFrame> convertedFrame) {
+  _pendingFrames.push_back(PendingFrame{info, std::move(convertedFrame)});
+  encodePendingFrames(maxPendingFrames());
+}
 
-  if(options.optimizePngPalette) {
-    // Uses several other options for optimization
-    pngLoader.optimizePngPalette(options);
+void CDXLEncode::prepareTruecolorFrame(PngLoader& frameLoader, unsigned threads) {
+  if(options.nativeScaler())
+    frameLoader.scaleTruecolorImage(*frameScaler(frameLoader.getWidth(), frameLoader.getHeight()), threads);
+  // With scene palettes truecolor frames are remapped when their scene is complete
+  if(!options.scenePalettes())
+    frameLoader.convertTruecolorImage(options, threads);
+}
+
+std::shared_ptr<const FrameScaler> CDXLEncode::frameScaler(int inWidth, int inHeight) {
+  // The filter taps are computed once for all frames of the same size
+  std::lock_guard<std::mutex> lock(_frameScalerMutex);
+  if(!_frameScaler || !_frameScaler->hasInputSize(inWidth, inHeight)) {
+    FrameScaler::ScaleFilter filter;
+    bool supportedFilter=FrameScaler::parseScaleFilter(options.scaler, filter);
+    assert(supportedFilter); // checked in Options::checkScaler
+    (void)supportedFilter;
+    _frameScaler=std::make_shared<const FrameScaler>(inWidth, inHeight, (int)options.width, (int)options.scaledHeight(inWidth, inHeight), filter);
+  }
+  return _frameScaler;
+}
+
+unsigned CDXLEncode::ditherThreads() {
+  // Threads that are not busy with other pending frames dither the bands of the new frame
+  return (unsigned)std::max<std::size_t>(1,_jobs/(_pendingFrames.size()+1));
+}
+
+std::size_t CDXLEncode::maxPendingFrames() {
+  size_t frameMemory=_frameMemory.load();
+  if(frameMemory==0)
+    return _jobs;
+  return std::max<size_t>(1,std::min(_jobs,lookAheadMemory/frameMemory));
+}
+
+void CDXLEncode::encodePendingFrames(std::size_t maxPendingFrames) {
+  while(_pendingFrames.size()>maxPendingFrames) {
+    PendingFrame& pendingFrame=_pendingFrames.front();
+    ConvertedFrame convertedFrame=pendingFrame.convertedFrame.get();
+    string info=pendingFrame.info;
+    _pendingFrames.pop_front();
+    if(convertedFrame.sceneFrame) {
+      addFrameToScene(info, std::move(convertedFrame.sceneFrame));
+      continue;
+    }
+    if(options.verbose>=2) {
+      cout<<info;
+      cout<<" ";
+    }
+    encodePlanarFrame(convertedFrame.planarFrame);
   }
+}
 
-  IffILBMChunk* ilbmChunk=pngLoader.createILBMChunk(options);
-  if(options.debug)
-    cout<<"DEBUG: next: visitILBMChunk."<<endl;
+void CDXLEncode::addFrameToScene(string info, std::unique_ptr<PngLoader> frameLoader) {
+  assert(options.scenePalettes());
+  bool sceneCut=_sceneCutDetector->isSceneCut(frameLoader->getImageData(), frameLoader->getWidth(), frameLoader->getHeight(), 4);
+  if(sceneCut || _sceneFrames.size()>=options.sceneMaxFrames) {
+    encodeScene();
+  }
+  _sceneQuantizer->addToHistogram(frameLoader->getImageData(), frameLoader->getWidth(), frameLoader->getHeight(), 4);
+  _sceneFrames.push_back(SceneFrame{info, std::move(frameLoader)});
+}
 
-  if(ilbmChunk) {
-    visitILBMChunk(ilbmChunk);
-    if(options.debug)
-      cout<<"DEBUG: visitPngFile done."<<endl;
-    delete ilbmChunk;
+void CDXLEncode::encodeScene() {
+  if(_sceneFrames.empty())
+    return;
+  vector<RGBColor> palette;
+  _sceneQuantizer->computePalette(palette);
+  if(options.verbose>=2) {
+    cout<<"Scene palette: "<<palette.size()<<" colors for "<<_sceneFrames.size()<<" frames"<<endl;
+  }
+  // Frames of the scene are remapped and converted in parallel and encoded in order
+  std::atomic<size_t> nextFrame(0);
+  NearestColorIndex paletteIndex(palette);
+  vector<PlanarFrame> planarFrames(_sceneFrames.size());
+  auto remapFrames=[this, &paletteIndex, &nextFrame, &planarFrames]() {
+    for(size_t i=nextFrame++;i<_sceneFrames.size();i=nextFrame++) {
+      _sceneFrames[i].frameLoader->remapTruecolorImage(options, paletteIndex);
+      planarFrames[i]=convertPalettedFrame(*_sceneFrames[i].frameLoader);
+      _sceneFrames[i].frameLoader.reset();
+    }
+  };
+  // The remap tasks run in the worker pool (after the frames that are already pending)
+  vector<std::future<void>> workers;
+  for(size_t task=0;task<std::min(_jobs,_sceneFrames.size());task++) {
+    workers.push_back(_workerPool->submit(remapFrames));
+  }
+  // All tasks use the local data, they are finished before an error is reported
+  for(auto& worker : workers) {
+    worker.wait();
+  }
+  for(auto& worker : workers) {
+    worker.get();
+  }
+  for(size_t i=0;i<_sceneFrames.size();i++) {
+    if(options.verbose>=2) {
+      cout<<_sceneFrames[i].info;
+      cout<<" ";
+    }
+    encodePlanarFrame(planarFrames[i]);
   }
+  _sceneFrames.clear();
+  _sceneQuantizer->clearHistogram();
+}
+
+CDXLEncode::PlanarFrame CDXLEncode::convertPalettedFrame(PngLoader& frameLoader) {
+  if(options.optimizePngPalette && !frameLoader.isHamImage() && !frameLoader.isEhbImage()) {
+    // Uses several other options for optimization (HAM codes and EHB indexes depend on the order of the base palette)
+    frameLoader.optimizePngPalette(options);
+  }
+
+  // The CDXL frame is created directly from the chunky image (no ILBM
+  // chunk), only the BMHD, CAMG, and CMAP chunks are used for the header
+  PlanarFrame planarFrame;
+  planarFrame.bmhdChunk.reset(frameLoader.createIffBMHDChunk());
+  planarFrame.camgChunk.reset(frameLoader.createIffCAMGChunk(planarFrame.bmhdChunk.get(),options));
+  planarFrame.cmapChunk.reset(frameLoader.createIffCMAPChunk());
+  planarFrame.video=acquireVideoBuffer();
+  frameLoader.createBitPlanarVideo(*planarFrame.video);
+  return planarFrame;
+}
+
+void CDXLEncode::encodePlanarFrame(PlanarFrame& planarFrame) {
+  CDXLFrame& frame=*new CDXLFrame();
+  importOptions(frame); // sets values in header from command line options
+  frame.header.setFrameNr(_currentFrameNr);
+  frame.header.initialize(planarFrame.bmhdChunk.get(),planarFrame.cmapChunk.get(),planarFrame.camgChunk.get());
+  frame.video=planarFrame.video.release();
+  importFrameData(frame,planarFrame.cmapChunk.get(),planarFrame.camgChunk.get());
+  encodeFrame(frame,planarFrame.camgChunk.get());
+  if(options.debug)
+    cout<<"DEBUG: frame encoding done."<<endl;
+}
+
+std::unique_ptr<CDXLVideo> CDXLEncode::acquireVideoBuffer() {
+  std::lock_guard<std::mutex> lock(_videoBuffersMutex);
+  if(_videoBuffers.empty())
+    return std::make_unique<CDXLVideo>();
+  std::unique_ptr<CDXLVideo> video=std::move(_videoBuffers.back());
+  _videoBuffers.pop_back();
+  return video;
 }
 
 
@@ -459,18 +608,27 @@ void CDXLEncode::visitILBMChunk(IffILBMChunk* ilbmChunk) {
   frame.header.setFrameNr(_currentFrameNr);
   importILBMChunk(frame,ilbmChunk);
 
-  // Special case: KILL EHB flag, can only be set now, after ILBM has been imported
-  if(IffCAMGChunk* iffCAMGChunk=ilbmChunk->getCAMGChunk()) {
-    if(frame.header.getNumberOfBitplanes()==6 && !iffCAMGChunk->isHalfBrite() && !iffCAMGChunk->isHam()) {
-      // Required for AGA with 6 planes to not display EHB mode by default
-      frame.header.setKillEHBFlag(true); 
-    }
-  } else {
+  IffCAMGChunk* iffCAMGChunk=ilbmChunk->getCAMGChunk();
+  if(!iffCAMGChunk) {
     // Manual clean up in lack of ref-counted pointers
     delete ilbmChunk;
     delete &frame;
     throw AGAConvException(99, "no CAMG chunk found. Bailing out.");
   }
+  try {
+    encodeFrame(frame,iffCAMGChunk);
+  } catch(...) {
+    delete ilbmChunk;
+    throw;
+  }
+}
+
+void CDXLEncode::encodeFrame(CDXLFrame& frame, IffCAMGChunk* iffCAMGChunk) {
+  // Special case: KILL EHB flag, can only be set now, after the frame data has been imported
+  if(frame.header.getNumberOfBitplanes()==6 && !iffCAMGChunk->isHalfBrite() && !iffCAMGChunk->isHam()) {
+    // Required for AGA with 6 planes to not display EHB mode by default
+    frame.header.setKillEHBFlag(true); 
+  }
 
   // Set all audio relevant values in CDXL frame
   importAudio(frame);
@@ -480,7 +638,6 @@ void CDXLEncode::visitILBMChunk(IffILBMChunk* ilbmChunk) {
   if(options.enabled32BitCheck && frame.getLength()%4!=0) {
     auto len=std::to_string(frame.getLength());
     // Manual clean up in lack of ref-counted pointers
-    delete ilbmChunk;
     delete &frame;
     if(options.adjustHeight) {
       if(options.width%4!=0 && (options.getPaddingMode()==Options::PAD_32BIT || options.getPaddingMode()==Options::PAD_64BIT))
@@ -511,11 +668,21 @@ void CDXLEncode::visitILBMChunk(IffILBMChunk* ilbmChunk) {
     frame.writeChunk();
   }
 
+  // Keep the video data for the following frames (at most one buffer per job is kept)
+  {
+    std::lock_guard<std::mutex> lock(_videoBuffersMutex);
+    if(_videoBuffers.size()<=_jobs) {
+      _videoBuffers.emplace_back(frame.video);
+      frame.video=nullptr;
+    }
+  }
   delete &frame;
   _currentFrameNr++;
 }
 
 void CDXLEncode::postVisitLastILBMChunk(IffILBMChunk* ilbmChunk) {
+  encodePendingFrames(0);
+  encodeScene();
   // Close CDXL file
   FileSequenceConversion::postVisitLastILBMChunk(ilbmChunk);
   _outFile.close();
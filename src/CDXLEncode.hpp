@@ -19,10 +19,23 @@
 #ifndef CDXL_ENCODE_HPP
 #define CDXL_ENCODE_HPP
 
+#include <atomic>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include "ByteSequence.hpp"
 #include "CDXLFrame.hpp"
 #include "FileSequenceConversion.hpp"
+#include "FrameScaler.hpp"
 #include "Options.hpp"
+#include "PaletteQuantizer.hpp"
+#include "PngLoader.hpp"
+#include "SceneCutDetector.hpp"
+#include "WorkerPool.hpp"
 
 class PngFile;
 
@@ -34,6 +47,7 @@ class CDXLEncode : public FileSequenceConversion {
   void visitILBMChunk(IffILBMChunk*) override;
   void postVisitLastILBMChunk(IffILBMChunk* ilbmChunk) override;
   void run(Options& options) override;
+  void runFrameSource(Options& options, FrameSource frameSource) override;
 
   // AUDIO
   ByteSequence* readAudioData();
@@ -42,10 +56,15 @@ class CDXLEncode : public FileSequenceConversion {
   // PNG
   void visitPngFile(std::string pngFileName) override;
 
+  // Raw paletted or truecolor frames (ffmpeg pipe)
+  void visitRawFrame(std::unique_ptr<RawFrameLoader> frameLoader) override;
+
   // IFF/ILBM
   void processILBMChunk(IffILBMChunk* ilbmChunk);
   void importOptions(CDXLFrame& frame);
   void importILBMChunk(CDXLFrame& frame, IffILBMChunk* ilbmChunk);
+  // Imports palette and options that depend on the frame (requires header and video of the frame)
+  void importFrameData(CDXLFrame& frame, IffCMAPChunk* cmapChunk, IffCAMGChunk* camgChunk);
   void importAudio(CDXLFrame& frame);
   
  protected:
@@ -66,10 +85,65 @@ class CDXLEncode : public FileSequenceConversion {
   int _frameLenSum=0;
   ULONG _previousFrameSize=0;
 private:
+  void prepareEncoding(Options& options);
+  // Data of a paletted frame in CDXL layout (everything but palette, audio, and header, which are encoded in order)
+  struct PlanarFrame {
+    std::unique_ptr<IffBMHDChunk> bmhdChunk;
+    std::unique_ptr<IffCAMGChunk> camgChunk;
+    std::unique_ptr<IffCMAPChunk> cmapChunk;
+    std::unique_ptr<CDXLVideo> video;
+  };
+  // Palette optimization and bit-planar conversion of a paletted frame (runs in the worker of the frame)
+  PlanarFrame convertPalettedFrame(PngLoader& frameLoader);
+  void encodePlanarFrame(PlanarFrame& planarFrame);
+  // Encodes audio and writes the frame (deletes the frame)
+  void encodeFrame(CDXLFrame& frame, IffCAMGChunk* camgChunk);
+  // Video data of encoded frames (reused by the following frames)
+  std::vector<std::unique_ptr<CDXLVideo>> _videoBuffers;
+  std::mutex _videoBuffersMutex;
+  std::unique_ptr<CDXLVideo> acquireVideoBuffer();
+  // Frames are loaded and converted in parallel (one frame per worker) and encoded in order
+  struct ConvertedFrame {
+    std::unique_ptr<PngLoader> sceneFrame; // Truecolor frame, converted when its scene is complete (scene palettes)
+    PlanarFrame planarFrame;
+  };
+  struct PendingFrame {
+    std::string info;
+    std::future<ConvertedFrame> convertedFrame;
+  };
+  ConvertedFrame convertFrame(std::unique_ptr<PngLoader> frameLoader, unsigned threads);
+  void addPendingFrame(std::string info, std::future<ConvertedFrame> convertedFrame);
+  // Encodes pending frames until at most maxPendingFrames are left
+  void encodePendingFrames(std::size_t maxPendingFrames);
+  // Number of frames converted ahead of the encoded frame (--jobs, limited by lookAheadMemory)
+  std::size_t maxPendingFrames();
+  static const std::size_t lookAheadMemory=512*1024*1024;
+  std::atomic<std::size_t> _frameMemory{0}; // Largest memory used by the conversion of one frame
+  std::size_t _jobs=1;
+  unsigned ditherThreads();
+  // Scaling (native scaler) and conversion of a truecolor frame (runs in the worker of the frame)
+  void prepareTruecolorFrame(PngLoader& frameLoader, unsigned threads);
+  std::shared_ptr<const FrameScaler> frameScaler(int inWidth, int inHeight);
+  std::mutex _frameScalerMutex;
+  std::shared_ptr<const FrameScaler> _frameScaler;
+  // Scene palettes: truecolor frames are kept until the scene is complete and then remapped to one palette
+  struct SceneFrame {
+    std::string info;
+    std::unique_ptr<PngLoader> frameLoader;
+  };
+  std::vector<SceneFrame> _sceneFrames;
+  std::unique_ptr<SceneCutDetector> _sceneCutDetector;
+  std::unique_ptr<PaletteQuantizer> _sceneQuantizer;
+  void addFrameToScene(std::string info, std::unique_ptr<PngLoader> frameLoader);
+  void encodeScene();
   void addColorsForTargetPlanes(int targetPlanes, IffCMAPChunk* cmapChunk);
   void addColorsForTargetPlanes(int targetPlanes, CDXLPalette& palette);
   void fillPaletteToMaxColorsOfPlanes(int targetPlanes, CDXLFrame& frame);
   void checkFrequencyForStdCdxl(Options& options);
+  // Declared last: the pool is destroyed first and joins its workers
+  // before the members they use are destroyed
+  std::deque<PendingFrame> _pendingFrames;
+  std::unique_ptr<WorkerPool> _workerPool;
 };
 
 } // namespace AGAConv
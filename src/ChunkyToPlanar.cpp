@@ -0,0 +1,195 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "ChunkyToPlanar.hpp"
+
+#include <cassert>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define AGACONV_C2P_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace AGAConv {
+
+void ChunkyToPlanar::convertLine(const UBYTE* chunky, int width, int numPlanes, UBYTE** planes) {
+  static const LineConverter converter=lineConverter(selectedImplementation());
+  converter(chunky, width, numPlanes, planes);
+}
+
+void ChunkyToPlanar::convertLine(Implementation implementation, const UBYTE* chunky, int width, int numPlanes, UBYTE** planes) {
+  assert(isSupported(implementation));
+  lineConverter(implementation)(chunky, width, numPlanes, planes);
+}
+
+bool ChunkyToPlanar::isSupported(Implementation implementation) {
+  switch(implementation) {
+  case C2P_SCALAR:
+  case C2P_PORTABLE:
+    return true;
+  case C2P_SSE2:
+#if defined(__SSE2__)
+    return true;
+#else
+    return false;
+#endif
+  case C2P_AVX2:
+#if defined(AGACONV_C2P_AVX2)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+  }
+  return false;
+}
+
+ChunkyToPlanar::Implementation ChunkyToPlanar::selectedImplementation() {
+  for(Implementation implementation : {C2P_AVX2, C2P_SSE2}) {
+    if(isSupported(implementation))
+      return implementation;
+  }
+  return C2P_PORTABLE;
+}
+
+string ChunkyToPlanar::implementationName(Implementation implementation) {
+  switch(implementation) {
+  case C2P_SCALAR: return "scalar";
+  case C2P_PORTABLE: return "portable";
+  case C2P_SSE2: return "sse2";
+  case C2P_AVX2: return "avx2";
+  }
+  return "unknown";
+}
+
+ChunkyToPlanar::LineConverter ChunkyToPlanar::lineConverter(Implementation implementation) {
+  switch(implementation) {
+  case C2P_SCALAR: return convertLineScalar;
+  case C2P_PORTABLE: return convertLinePortable;
+  case C2P_SSE2: return convertLineSSE2;
+  case C2P_AVX2: return convertLineAVX2;
+  }
+  return convertLineScalar;
+}
+
+void ChunkyToPlanar::convertLineScalar(const UBYTE* chunky, int width, int numPlanes, UBYTE** planes) {
+  assert(width%8==0 && numPlanes>=1 && numPlanes<=8);
+  for(int byte=0;byte<width/8;byte++) {
+    for(int plane=0;plane<numPlanes;plane++) {
+      UBYTE planeByte=0;
+      for(int bit=0;bit<8;bit++) {
+        planeByte|=((chunky[byte*8+7-bit]>>plane)&1)<<bit;
+      }
+      planes[plane][byte]=planeByte;
+    }
+  }
+}
+
+void ChunkyToPlanar::convertLinePortable(const UBYTE* chunky, int width, int numPlanes, UBYTE** planes) {
+  assert(width%8==0 && numPlanes>=1 && numPlanes<=8);
+  for(int byte=0;byte<width/8;byte++) {
+    // Row r of the bit matrix (byte r) is pixel 7-r, after the transpose byte p holds the bits of plane p
+    const UBYTE* pixels=chunky+byte*8;
+    uint64_t matrix=0;
+    for(int r=0;r<8;r++) {
+      matrix|=(uint64_t)pixels[7-r]<<(8*r);
+    }
+    uint64_t t;
+    t=(matrix^(matrix>>7))&0x00AA00AA00AA00AAULL;
+    matrix^=t^(t<<7);
+    t=(matrix^(matrix>>14))&0x0000CCCC0000CCCCULL;
+    matrix^=t^(t<<14);
+    t=(matrix^(matrix>>28))&0x00000000F0F0F0F0ULL;
+    matrix^=t^(t<<28);
+    for(int plane=0;plane<numPlanes;plane++) {
+      planes[plane][byte]=(UBYTE)(matrix>>(8*plane));
+    }
+  }
+}
+
+void ChunkyToPlanar::convertLineSSE2(const UBYTE* chunky, int width, int numPlanes, UBYTE** planes) {
+#if defined(__SSE2__)
+  assert(width%8==0 && numPlanes>=1 && numPlanes<=8);
+  int x=0;
+  for(;x+16<=width;x+=16) {
+    // Reverse the order of the pixels of each group of 8 (the movemask bit of the first pixel must become bit 7)
+    __m128i pixels=_mm_loadu_si128((const __m128i*)(chunky+x));
+    pixels=_mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, _MM_SHUFFLE(0,1,2,3)), _MM_SHUFFLE(0,1,2,3));
+    pixels=_mm_or_si128(_mm_slli_epi16(pixels, 8), _mm_srli_epi16(pixels, 8));
+    // Bit 7 of each pixel is collected by movemask, adding the pixels to themselves moves the next lower bit to bit 7
+    pixels=_mm_slli_epi16(pixels, 8-numPlanes);
+    pixels=_mm_and_si128(pixels, _mm_set1_epi8((char)(0xFF<<(8-numPlanes))));
+    for(int plane=numPlanes-1;plane>=0;plane--) {
+      int mask=_mm_movemask_epi8(pixels);
+      planes[plane][x/8]=(UBYTE)mask;
+      planes[plane][x/8+1]=(UBYTE)(mask>>8);
+      pixels=_mm_add_epi8(pixels, pixels);
+    }
+  }
+  if(x<width) {
+    UBYTE* remainingPlanes[8];
+    for(int plane=0;plane<numPlanes;plane++)
+      remainingPlanes[plane]=planes[plane]+x/8;
+    convertLinePortable(chunky+x, width-x, numPlanes, remainingPlanes);
+  }
+#else
+  convertLinePortable(chunky, width, numPlanes, planes);
+#endif
+}
+
+#if defined(AGACONV_C2P_AVX2)
+__attribute__((target("avx2")))
+#endif
+void ChunkyToPlanar::convertLineAVX2(const UBYTE* chunky, int width, int numPlanes, UBYTE** planes) {
+#if defined(AGACONV_C2P_AVX2)
+  assert(width%8==0 && numPlanes>=1 && numPlanes<=8);
+  // Reverses the order of the pixels of each group of 8 (in both 128 bit lanes)
+  const __m256i reverse=_mm256_setr_epi8(7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,
+                                         7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+  const __m256i planeBits=_mm256_set1_epi8((char)(0xFF<<(8-numPlanes)));
+  int x=0;
+  for(;x+32<=width;x+=32) {
+    __m256i pixels=_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(chunky+x)), reverse);
+    pixels=_mm256_and_si256(_mm256_slli_epi16(pixels, 8-numPlanes), planeBits);
+    for(int plane=numPlanes-1;plane>=0;plane--) {
+      uint32_t mask=(uint32_t)_mm256_movemask_epi8(pixels);
+      UBYTE* planeBytes=planes[plane]+x/8;
+      planeBytes[0]=(UBYTE)mask;
+      planeBytes[1]=(UBYTE)(mask>>8);
+      planeBytes[2]=(UBYTE)(mask>>16);
+      planeBytes[3]=(UBYTE)(mask>>24);
+      pixels=_mm256_add_epi8(pixels, pixels);
+    }
+  }
+  if(x<width) {
+    UBYTE* remainingPlanes[8];
+    for(int plane=0;plane<numPlanes;plane++)
+      remainingPlanes[plane]=planes[plane]+x/8;
+    convertLineSSE2(chunky+x, width-x, numPlanes, remainingPlanes);
+  }
+#else
+  convertLinePortable(chunky, width, numPlanes, planes);
+#endif
+}
+
+} // namespace AGAConv
@@ -0,0 +1,61 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHUNKY_TO_PLANAR_HPP
+#define CHUNKY_TO_PLANAR_HPP
+
+#include <string>
+
+#include "AmigaTypeDefs.hpp"
+
+namespace AGAConv {
+
+/* Converts lines of chunky pixels (one palette index per byte) into
+   bitplane lines (bit 7 of the first byte of plane p is bit p of the
+   first pixel). Each group of 8 pixels is an 8x8 bit matrix that is
+   transposed at once for all planes: with SSE2 (16 pixels) or AVX2 (32
+   pixels) the bits of one plane are collected with a byte movemask,
+   the portable version transposes 8 pixels in a 64 bit integer. The
+   AVX2 version is selected at run time if the CPU supports it.
+ */
+class ChunkyToPlanar {
+
+ public:
+  enum Implementation { C2P_SCALAR, C2P_PORTABLE, C2P_SSE2, C2P_AVX2 };
+  // Converts width pixels (a multiple of 8) into numPlanes (1..8) lines of width/8 bytes
+  static void convertLine(const UBYTE* chunky, int width, int numPlanes, UBYTE** planes);
+  // Same with a given implementation (must be supported, see isSupported)
+  static void convertLine(Implementation implementation, const UBYTE* chunky, int width, int numPlanes, UBYTE** planes);
+  static bool isSupported(Implementation implementation);
+  // Implementation used by convertLine (the fastest supported one)
+  static Implementation selectedImplementation();
+  static std::string implementationName(Implementation implementation);
+
+ private:
+  typedef void (*LineConverter)(const UBYTE* chunky, int width, int numPlanes, UBYTE** planes);
+  static LineConverter lineConverter(Implementation implementation);
+  // Bit by bit (reference implementation)
+  static void convertLineScalar(const UBYTE* chunky, int width, int numPlanes, UBYTE** planes);
+  static void convertLinePortable(const UBYTE* chunky, int width, int numPlanes, UBYTE** planes);
+  static void convertLineSSE2(const UBYTE* chunky, int width, int numPlanes, UBYTE** planes);
+  static void convertLineAVX2(const UBYTE* chunky, int width, int numPlanes, UBYTE** planes);
+};
+
+} // namespace AGAConv
+
+#endif
@@ -61,7 +61,7 @@ void CommandLineParser::setVersion(std::string version) {
   this->version=version;
 }
 
-// Search for '=' and split if present
+// Search for '=' in options and split if present (values and file names are not split)
 void CommandLineParser::splitArgvOnEqualSign(int argc0, char** argv0) {
   for(int i=0;i<argc0;i++) {
     string s0=argv0[i];
@@ -71,7 +71,7 @@ void CommandLineParser::splitArgvOnEqualSign(int argc0, char** argv0) {
       continue;
     }
     std::size_t found = s0.find("=");
-    if(found!=std::string::npos) {
+    if(found!=std::string::npos && Util::hasPrefix("--",s0)) {
       string s1=s0.substr(0,found);
       // Skip '=' and copy rest
       string s2=s0.substr(found+1,s0.size()-(found+1));
@@ -248,6 +248,8 @@ void CommandLineParser::parse(int argc0, char **argv0, Configuration& config) {
 
   // All options not requiring any input files are handled above
 
+  // Output variants are based on the options before the derived options are set
+  Options unresolvedOptions=options;
   options.checkAndSetOptions();
   
    if(options.outConfigFileName.string().size()>0) {
@@ -314,6 +316,7 @@ void CommandLineParser::parse(int argc0, char **argv0, Configuration& config) {
 
   // Resolving tmpDir here ensures that --help-advanced does not print the PID
   config.resolveTmpDir();
+  config.resolveCacheDir();
 
   // Check input file
   string inFileName=options.inFileName.string();
@@ -322,6 +325,60 @@ void CommandLineParser::parse(int argc0, char **argv0, Configuration& config) {
       throw AGAConvException(14,"file "+inFileName+" does not exist.");
     }
   }
+
+  resolveVariants(options, unresolvedOptions);
+}
+
+void CommandLineParser::resolveVariants(Options& options, const Options& unresolvedOptions) {
+  if(options.variantSpecs.size()==0)
+    return;
+  if(!options.cdxlEncode) {
+    throw AGAConvException(194,"output variants require a video as input file and a CDXL file as output file.");
+  }
+  for(auto spec : options.variantSpecs) {
+    // Format: FILE[:OPTION=VALUE,...]
+    std::size_t fileNameEnd=spec.find(':');
+    string outFileName=spec.substr(0,fileNameEnd);
+    Configuration variantConfig;
+    variantConfig.setOptions(unresolvedOptions);
+    if(fileNameEnd!=string::npos) {
+      stringstream optionList(spec.substr(fileNameEnd+1));
+      string option;
+      while(std::getline(optionList, option, ',')) {
+        std::size_t valueStart=option.find('=');
+        string optionName=option.substr(0,valueStart);
+        uint32_t res=variantConfig.getCLOptionNameArgs(optionName);
+        if(res==0 || (res==2 && valueStart==string::npos)) {
+          throw AGAConvException(195,"output variant "+spec+": unknown option or missing value in "+option+".");
+        }
+        string value;
+        if(valueStart!=string::npos)
+          value=option.substr(valueStart+1);
+        else
+          value=Util::hasPrefix("no-",optionName)?"false":"true";
+        variantConfig.processCLOption(optionName,value);
+      }
+    }
+    Options variant=variantConfig.getOptions();
+    variant.variantSpecs.clear();
+    variant.outFileName=outFileName;
+    if(!isCdxlFileName(outFileName)) {
+      throw AGAConvException(196,"output variant "+spec+": output file must be a CDXL file.");
+    }
+    bool duplicateOutFile=(variant.outFileName==options.outFileName);
+    for(auto& otherVariant : options.variants)
+      duplicateOutFile=duplicateOutFile || (variant.outFileName==otherVariant.outFileName);
+    if(duplicateOutFile) {
+      throw AGAConvException(197,"output variant "+spec+": output file is used several times.");
+    }
+    variant.checkAndSetOptions();
+    variant.cdxlEncode=true;
+    variant.writeCdxl=true;
+    variant.setTmpDirName(options.getTmpDirName());
+    variant.cacheDirResolved=options.cacheDirResolved;
+    variant.hcPathResolved=options.hcPathResolved;
+    options.variants.push_back(variant);
+  }
 }
 
 } // namespace AGAConv
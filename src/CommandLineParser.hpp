@@ -39,6 +39,8 @@ public:
 private:
   void printVersion();
   void checkInOutFileOptions(Options& options);
+  // Derives the options of each output variant from the options provided on the command line
+  void resolveVariants(Options& options, const Options& unresolvedOptions);
   void splitArgvOnEqualSign(int argc, char** argv);
   void inc();
   size_t argc;
@@ -133,6 +133,14 @@ void Configuration::addOptionsEntry(std::string optName, std::filesystem::path&
   optVector.push_back(e);
 }
 
+void Configuration::addOptionsEntry(std::string optName, std::vector<std::string>& var, ToolInterfaceSet ti, std::string options, std::string description) {
+  auto e=OptionEntry{optName,PT_STRING_LIST,&var,ti};
+  e.options=options;
+  e.description=description;
+  optLookupMap[optName]=optId++;
+  optVector.push_back(e);
+}
+
 void Configuration::handleDefaultConfigFile() {
   std::filesystem::path defaultConfigFileName=osLayer->getDefaultConfigFileName();
   if(osLayer->isSupported()) {
@@ -262,7 +270,8 @@ bool Configuration::isSubSet(ToolInterfaceSet& s1, ToolInterfaceSet& s2) {
 }
 
 void Configuration::writeConfigLine(ofstream& configFile, OptionEntry& o) {
-  configFile<<std::left<<std::setw(20)<<o.name
+  // Names with 20 or more characters must also be separated from '='
+  configFile<<std::left<<std::setw(19)<<o.name<<" "
             <<std::setw(2)<<"="
             <<std::setw(20)<<getValAsString(o.name)
             <<" ; "<<o.description;
@@ -319,7 +328,7 @@ void Configuration::printCLOptionsSet(ToolInterfaceSet& tiSet) {
       s1+="]";
       cout<<std::left<<std::setw(32)<<s1<<o.description;
       auto defVal=getValAsString(o.name);
-      bool defPrint=pt!=PT_BOOL1 && o.options!="FILENAME";
+      bool defPrint=pt!=PT_BOOL1 && pt!=PT_STRING_LIST && o.options!="FILENAME";
       if(defPrint) {
         cout<<" (default: "<<(defVal==""?"UNSET":defVal);
       }
@@ -344,6 +353,8 @@ void Configuration::buildOptionsTable() {
   addOptionsEntry("height",opt.height, ToolInterfaceSet{TI_CDXL, TI_CL, TI_CF}, 1, 2160,"auto|NUMBER","height of video - 'auto' derives height for proper aspect ratio");
   addOptionsEntry("frequency",opt.frequency, ToolInterfaceSet{TI_CDXL, TI_CL, TI_CF},1,AGAConv::maxAmigaFrequency,"audio frequency");
   addOptionsEntry("audio_mode",opt.audioMode, ToolInterfaceSet{TI_CDXL, TI_CL, TI_CF},"mono|stereo","audio mode"); // mono|stereo => stereo:bool
+  addOptionsEntry("start",opt.start, ToolInterfaceSet{TI_CDXL, TI_CL},"SECONDS","start of the converted segment of the input video (default: 0)");
+  addOptionsEntry("duration",opt.duration, ToolInterfaceSet{TI_CDXL, TI_CL},"SECONDS","duration of the converted segment (default: until end of input video)");
   addOptionsEntry("adjust_aspect",opt.adjustAspectMode, ToolInterfaceSet{TI_CDXL, TI_CL, TI_CF},"VALUE","adjust ascpect ratio, where VALUE=FLOAT|"+opt.adjustAspectSelectorName1+"(="+adjAspectVal.str()+")");
   addOptionsEntry("hc_path",opt.hcPath, ToolInterfaceSet{TI_CDXL, TI_CL, TI_CF},"PATH", "absolute file path to ham_convert");
   addOptionsBool1("cdxl_info",opt.cdxlInfo,ToolInterfaceSet{TI_CDXL, TI_CL}, "show info of frame 1 of given CDXL video");
@@ -357,6 +368,16 @@ void Configuration::buildOptionsTable() {
   addOptionsBool1("black_and_white",opt.blackAndWhite, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},"convert video to black-and-white colors");
   addOptionsBool1("black_background",opt.reserveBlackBackgroundColor, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL},"reserve black background color (only relevant on OCS systems)");
   addOptionsEntry("dither",opt.ditherMode, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},"STRING","ffmpeg dithering mode when rescaling video, where STRING =floyd_steinberg|bayer:bayer_scale=X|sierra2");
+  addOptionsEntry("ff_bayer_scale",opt.ffBayerScale, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},0,5,"bayer scale of dither mode 'bayer' if not specified in the dither mode");
+  addOptionsEntry("quantizer",opt.quantizer, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},"ffmpeg|native","palette generation with ffmpeg or with the native (in-process) quantizer. For HAM and EHB, native selects the native HAM or EHB encoder (also used if hc_path is not set)");
+  addOptionsEntry("quantizer_kmeans",opt.quantizerKMeans, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},0,32,"number of k-means iterations refining the palettes of the native quantizer");
+  addOptionsEntry("scaler",opt.scaler, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},"ffmpeg|lanczos|bicubic","scaling of the frames with ffmpeg or with the native (in-process) scaler (requires native quantizer)");
+  addOptionsEntry("resampler",opt.resampler, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},"ffmpeg|native","resampling of the audio data with ffmpeg or with the native (in-process) resampler");
+  addOptionsEntry("decoder",opt.decoder, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},"auto|cli|libav","decoding of the input video with the ffmpeg tool (cli) or in-process with libav (auto: ffmpeg tool, libav is experimental)");
+  addOptionsEntry("palette_mode",opt.paletteMode, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},"frame|scene","one palette per frame or one palette per scene (requires native quantizer)");
+  addOptionsEntry("scene_threshold",opt.sceneThreshold, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},0,100,"difference of color histograms of consecutive frames in percent detected as scene cut");
+  addOptionsEntry("scene_max_frames",opt.sceneMaxFrames, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},1,1000,"maximum number of frames sharing one scene palette");
+  addOptionsBool0("no_merge_12bit_colors",opt.merge12BitColors, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},"do not merge palette colors that are identical in 12 bit color depth");
   addOptionsEntry("screen_mode",opt.screenMode, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL},"STRING","screen (resolution) mode, where STRING = auto|unspecified|lores|hires|superhires"); // => resMode:GFX_RESOLUTION, implicit with 'auto'
   addOptionsEntry("force_color_depth",opt.colorDepthBits, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},12,24,"allows to force color depth in palette where NUMBER = auto|12|24");
   addOptionsBool1("install_config",opt.installDefaultConfigFile, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL}, "install default config file");
@@ -366,12 +387,23 @@ void Configuration::buildOptionsTable() {
   addOptionsEntry("load_config",opt.inConfigFileName, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL}, "FILE", "load user configuration file");
   addOptionsEntry("save_config",opt.outConfigFileName, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL}, "FILE", "save user configuration file");
   addOptionsEntry("tmp_dir_prefix",opt.tmpDir, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL}, "DIRNAME", "prefix of temporary directory name.");
+  addOptionsEntry("tmp_storage",opt.tmpStorage, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL}, "disk|ram", "storage of temporary files (ram: RAM disk if it has enough space, otherwise disk).");
+  addOptionsBool1("extraction_cache",opt.extractionCache, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL},"reuse extracted frames and audio of previous runs with the same input file and extraction settings");
+  addOptionsEntry("cache_dir",opt.cacheDir, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL}, "DIR", "directory of the extraction cache (default: user's cache directory)");
+  addOptionsEntry("cache_size",opt.cacheSize, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL},1,1048576, "maximum size of the extraction cache in MB (least recently used entries are removed first)");
   addOptionsBool1("keep_tmp_dir",opt.keepTmpFiles, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},"keep temporary directory (temporary dir is removed by default)");
-  addOptionsEntry("hc_ham_quality",opt.hcHamQuality, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL}, 0, 3,"ham_convert HAM conversion quality"); // ham8: 1-3, ham6 1-7
+  addOptionsBool1("pipe_frames",opt.pipeFrames, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},"stream frames from ffmpeg through a pipe instead of PNG files in tmp dir");
+  addOptionsEntry("extract_jobs",opt.extractJobs, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},1,256,"number of ffmpeg processes extracting frames of different time ranges in parallel");
+  addOptionsEntry("jobs",opt.jobs, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},0,256,"number of frames loaded and converted in parallel (0: number of CPU cores)");
+  addOptionsBool1("overlap_encoding",opt.overlapEncoding, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL, TI_CF},"encode PNG frames while ffmpeg is still extracting frames");
+  addOptionsEntry("variant",opt.variantSpecs, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL},"FILE[:OPT=VAL,..]","additional output file with different options (e.g. color-mode, format), can be used several times");
+  addOptionsEntry("hc_ham_quality",opt.hcHamQuality, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL}, 0, 3,"ham_convert and native encoder HAM conversion quality"); // ham8: 1-3, ham6 1-7
   addOptionsEntry("hc_dither",opt.hcDither, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL},"STRING","ham_convert dither mode where STRING=auto|none|fs|bayer8x8");   // dither_X, X=fs|bayer8x8
   addOptionsEntry("hc_propagation",opt.hcPropagation, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL},0,100,"ham_convert error propagation factor, requires hc_dither = fs");
   addOptionsEntry("hc_diversity",opt.hcDiversity, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL},0,9,"ham_convert diversity X=0-6 for ehb, X=0-9 for other modes, not supported in ham8"); // ehb: 0-6, default 3
   addOptionsEntry("hc_quant",opt.hcQuant, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL},"STRING","ham_convert quantisation algorithm where STRING=wu|neuquant");
+  addOptionsEntry("hc_jobs",opt.hcJobs, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL},1,64,"number of ham_convert instances (JVMs) converting frames in parallel");
+  addOptionsEntry("hc_jvm_heap",opt.hcJvmHeap, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CF, TI_CL},"SIZE","maximum heap size of each ham_convert JVM (e.g. 2g, 1500m)");
   addOptionsBool1("iff_info",opt.ilbmInfo, ToolInterfaceSet{TI_CDXL_ADVANCED, TI_CL},"show IFF info for given IFF file.");
   addOptionsEntry("in_file",opt.inFileName, ToolInterfaceSet{TI_ANIM, TI_CDXL_ADVANCED, TI_CF, TI_CL}, "FILE", "set input file (available for tool generated config)");
   addOptionsEntry("out_file",opt.outFileName, ToolInterfaceSet{TI_ANIM, TI_CDXL_ADVANCED, TI_CF, TI_CL}, "FILE", "set output file (available for tool generated config)");
@@ -418,6 +450,7 @@ string Configuration::typeToCLDocString(ParseType pt) {
   case PT_BOOL0: return "";
   case PT_DOUBLE: return "FLOAT";
   case PT_PATH: return "PATH";
+  case PT_STRING_LIST: return "STRING";
   }
   return "";
 }
@@ -459,6 +492,7 @@ void Configuration::processConfigEntry(int lineNr, string var, string val) {
     case PT_BOOL1: { *(static_cast<bool*>(entry.valPtr)) = convertBoolStringToBool(lineNr,val); return; }
     case PT_DOUBLE: { *(static_cast<double*>(entry.valPtr)) = convertStringToDouble(lineNr,val); return; }
     case PT_PATH: { *(static_cast<std::filesystem::path*>(entry.valPtr)) = val; return; }
+    case PT_STRING_LIST: { static_cast<vector<string>*>(entry.valPtr)->push_back(val); return; }
     }
   } else {
     throw AGAConvException(22,"unknown config option \""+var+"\" in line "+std::to_string(lineNr)+" in config file.");
@@ -485,6 +519,12 @@ string Configuration::getValAsString(string var) {
     case PT_BOOL1: if(*(static_cast<bool*>(entry.valPtr))) ss<<"true";else ss<<"false";break;
     case PT_DOUBLE: ss.precision(2);ss<<fixed<<*(static_cast<double*>(entry.valPtr));break;
     case PT_PATH: ss<<*(static_cast<std::filesystem::path*>(entry.valPtr));break;
+    case PT_STRING_LIST: {
+      auto& list=*(static_cast<vector<string>*>(entry.valPtr));
+      for(size_t i=0;i<list.size();i++)
+        ss<<(i>0?" ":"")<<list[i];
+      break;
+    }
     }
     return ss.str();
   } else {
@@ -681,6 +721,13 @@ void Configuration::resolveHcPath() {
   // Empty hcPath
 }
 
+// Use OS specific default cache dir if no cache dir is set
+void Configuration::resolveCacheDir() {
+  options.cacheDirResolved=expandTilde(options.cacheDir);
+  if(options.cacheDirResolved.string().size()==0)
+    options.cacheDirResolved=osLayer->getDefaultCacheDir();
+}
+
 void Configuration::resolveTmpDir() {
   path tmpPath(options.getTmpDirName());
   if(tmpPath.string().length()==0)
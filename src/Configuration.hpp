@@ -61,6 +61,7 @@ public:
   void setOptions(Options options);
   void resolveHcPath();
   void resolveTmpDir();
+  void resolveCacheDir();
   Options getOptions();
   bool isSupportedOS();
   
@@ -94,6 +95,8 @@ private:
   void addOptionsEntry(std::string optName, std::string& var, ToolInterfaceSet ti, std::string options, std::string description);
   void addOptionsEntry(std::string optName, double& var, ToolInterfaceSet ti, std::string options, std::string description);
   void addOptionsEntry(std::string optName, std::filesystem::path& var, ToolInterfaceSet ti, std::string options, std::string description);
+  // Option can be provided several times, each value is appended to the list
+  void addOptionsEntry(std::string optName, std::vector<std::string>& var, ToolInterfaceSet ti, std::string options, std::string description);
   std::string replaceUnderscoreWithDash(std::string s);
   std::string replaceDashWithUnderscore(std::string s);
 
@@ -110,7 +113,7 @@ private:
   std::uint32_t convertStringToInt(int lineNr, std::string s);
   double convertStringToDouble(int lineNr, std::string s);  
   bool convertBoolStringToBool(int lineNr, std::string s);
-  enum ParseType { PT_UNSET, PT_UINT32, PT_STRING, PT_BOOL0, PT_BOOL1, PT_DOUBLE, PT_PATH };
+  enum ParseType { PT_UNSET, PT_UINT32, PT_STRING, PT_BOOL0, PT_BOOL1, PT_DOUBLE, PT_PATH, PT_STRING_LIST };
   std::string typeToCLDocString(ParseType pt);
   std::string formatError(int lineNr);
   struct OptionEntry {
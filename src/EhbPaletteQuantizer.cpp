@@ -0,0 +1,157 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "EhbPaletteQuantizer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "PaletteQuantizer.hpp"
+
+using namespace std;
+
+namespace AGAConv {
+
+EhbPaletteQuantizer::EhbPaletteQuantizer(bool colors12Bit, bool reserveBackgroundColor):
+  _colors12Bit(colors12Bit),
+  _reserveBackgroundColor(reserveBackgroundColor) {
+}
+
+RGBColor EhbPaletteQuantizer::halfBrightColor(RGBColor color) const {
+  // The hardware halves the color components of the palette (shift right by one bit)
+  if(_colors12Bit) {
+    return RGBColor(RGBColor::convert4BitTo8Bit(RGBColor::convert8BitTo4Bit(color.getRed())>>1),
+                    RGBColor::convert4BitTo8Bit(RGBColor::convert8BitTo4Bit(color.getGreen())>>1),
+                    RGBColor::convert4BitTo8Bit(RGBColor::convert8BitTo4Bit(color.getBlue())>>1));
+  }
+  return RGBColor(color.getRed()>>1, color.getGreen()>>1, color.getBlue()>>1);
+}
+
+RGBColor EhbPaletteQuantizer::colorDepthColor(double red, double green, double blue) const {
+  UBYTE components[3];
+  double values[3]={red, green, blue};
+  for(int c=0;c<3;c++) {
+    components[c]=(UBYTE)std::lround(std::min(255.0,std::max(0.0,values[c])));
+    if(_colors12Bit)
+      components[c]=RGBColor::convert4BitTo8Bit(RGBColor::convert8BitTo4Bit(components[c]));
+  }
+  return RGBColor(components[0], components[1], components[2]);
+}
+
+vector<RGBColor> EhbPaletteQuantizer::fullPalette(const vector<RGBColor>& basePalette) const {
+  assert(basePalette.size()==numBaseColors);
+  vector<RGBColor> palette(basePalette);
+  for(auto color : basePalette) {
+    palette.push_back(halfBrightColor(color));
+  }
+  return palette;
+}
+
+void EhbPaletteQuantizer::buildHistogram(UBYTE** rows, int width, int height, int bytesPerPixel, vector<HistogramCell>& cells) const {
+  const int cellBits=5;
+  vector<HistogramCell> histogram(1<<(3*cellBits), HistogramCell{0,0,0,0});
+  for(int y=0;y<height;y++) {
+    UBYTE* pixel=rows[y];
+    for(int x=0;x<width;x++) {
+      HistogramCell& cell=histogram[((pixel[0]>>3)<<(2*cellBits))|((pixel[1]>>3)<<cellBits)|(pixel[2]>>3)];
+      cell.red+=pixel[0];
+      cell.green+=pixel[1];
+      cell.blue+=pixel[2];
+      cell.weight+=1;
+      pixel+=bytesPerPixel;
+    }
+  }
+  cells.clear();
+  for(auto& cell : histogram) {
+    if(cell.weight>0) {
+      cells.push_back(HistogramCell{cell.red/cell.weight, cell.green/cell.weight, cell.blue/cell.weight, cell.weight});
+    }
+  }
+}
+
+void EhbPaletteQuantizer::refine(const vector<HistogramCell>& cells, vector<RGBColor>& basePalette) const {
+  struct ColorSum {
+    double red, green, blue;
+    double weight;
+  };
+  size_t firstAdjustableColor=_reserveBackgroundColor?1:0;
+  for(int iteration=0;iteration<refinementIterations;iteration++) {
+    vector<RGBColor> palette=fullPalette(basePalette);
+    vector<ColorSum> sums(numBaseColors, ColorSum{0,0,0,0});
+    for(auto& cell : cells) {
+      size_t nearest=0;
+      double nearestDistance=0;
+      for(size_t i=0;i<palette.size();i++) {
+        double dr=palette[i].getRed()-cell.red;
+        double dg=palette[i].getGreen()-cell.green;
+        double db=palette[i].getBlue()-cell.blue;
+        double distance=dr*dr+dg*dg+db*db;
+        if(i==0 || distance<nearestDistance) {
+          nearest=i;
+          nearestDistance=distance;
+        }
+      }
+      // The error of a half-bright color is a quarter of the error of its base color to the doubled cell color
+      ColorSum& sum=sums[nearest%numBaseColors];
+      if(nearest<numBaseColors) {
+        sum.red+=cell.weight*cell.red;
+        sum.green+=cell.weight*cell.green;
+        sum.blue+=cell.weight*cell.blue;
+        sum.weight+=cell.weight;
+      } else {
+        sum.red+=cell.weight*0.25*2*cell.red;
+        sum.green+=cell.weight*0.25*2*cell.green;
+        sum.blue+=cell.weight*0.25*2*cell.blue;
+        sum.weight+=cell.weight*0.25;
+      }
+    }
+    bool changed=false;
+    for(size_t i=firstAdjustableColor;i<numBaseColors;i++) {
+      if(sums[i].weight>0) {
+        RGBColor color=colorDepthColor(sums[i].red/sums[i].weight, sums[i].green/sums[i].weight, sums[i].blue/sums[i].weight);
+        if(color.getRed()!=basePalette[i].getRed() || color.getGreen()!=basePalette[i].getGreen() || color.getBlue()!=basePalette[i].getBlue()) {
+          basePalette[i]=color;
+          changed=true;
+        }
+      }
+    }
+    if(!changed)
+      break;
+  }
+}
+
+void EhbPaletteQuantizer::computePalette(UBYTE** rows, int width, int height, int bytesPerPixel, vector<RGBColor>& basePalette) {
+  assert(bytesPerPixel==3 || bytesPerPixel==4);
+  uint32_t reservedColors=_reserveBackgroundColor?1:0;
+  PaletteQuantizer quantizer(numBaseColors-reservedColors, 0, _colors12Bit);
+  vector<RGBColor> quantizedPalette;
+  quantizer.computePalette(rows, width, height, bytesPerPixel, quantizedPalette);
+  basePalette.clear();
+  if(_reserveBackgroundColor)
+    basePalette.push_back(RGBColor(0,0,0));
+  basePalette.insert(basePalette.end(), quantizedPalette.begin(), quantizedPalette.end());
+  // Unused base colors are black (refinement can move them to colors of the frame)
+  while(basePalette.size()<numBaseColors)
+    basePalette.push_back(RGBColor(0,0,0));
+  vector<HistogramCell> cells;
+  buildHistogram(rows, width, height, bytesPerPixel, cells);
+  refine(cells, basePalette);
+}
+
+} // namespace AGAConv
@@ -0,0 +1,70 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef EHB_PALETTE_QUANTIZER_HPP
+#define EHB_PALETTE_QUANTIZER_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "AmigaTypeDefs.hpp"
+#include "RGBColor.hpp"
+
+namespace AGAConv {
+
+/* Computes the 32 base colors of an Extra-Half-Brite (EHB) frame. In
+   EHB mode the 6th bitplane selects the half-bright version of the
+   base color given by the other 5 bitplanes, hence a frame is
+   displayed with 64 colors. The base colors are initialized with the
+   PaletteQuantizer and refined with k-means iterations on a color
+   histogram (5 bits per color channel), where each histogram cell is
+   assigned to the nearest of the 64 colors and a base color is moved
+   to the weighted mean of its own cells and of the doubled colors
+   of the cells of its half-bright color.
+   The pixels are mapped to the 64 colors with FrameDitherer (see
+   fullPalette).
+ */
+class EhbPaletteQuantizer {
+
+ public:
+  static const uint32_t numBaseColors=32;
+  // With colors12Bit the base colors are 12 bit colors. With reserveBackgroundColor base color 0 is black.
+  EhbPaletteQuantizer(bool colors12Bit, bool reserveBackgroundColor);
+  // Pixel data is given as rows of bytesPerPixel bytes per pixel (RGB, followed by an ignored byte if bytesPerPixel is 4).
+  // Writes the 32 base colors into basePalette.
+  void computePalette(UBYTE** rows, int width, int height, int bytesPerPixel, std::vector<RGBColor>& basePalette);
+  // The 64 displayed colors (base colors followed by their half-bright colors)
+  std::vector<RGBColor> fullPalette(const std::vector<RGBColor>& basePalette) const;
+
+ private:
+  static const int refinementIterations=8;
+  struct HistogramCell {
+    double red, green, blue; // mean color of the pixels in the cell
+    double weight; // number of pixels
+  };
+  RGBColor halfBrightColor(RGBColor color) const;
+  void buildHistogram(UBYTE** rows, int width, int height, int bytesPerPixel, std::vector<HistogramCell>& cells) const;
+  void refine(const std::vector<HistogramCell>& cells, std::vector<RGBColor>& basePalette) const;
+  RGBColor colorDepthColor(double red, double green, double blue) const;
+  bool _colors12Bit;
+  bool _reserveBackgroundColor;
+};
+
+} // namespace AGAConv
+
+#endif
@@ -1,14 +1,24 @@
 #include "ExternalToolDriver.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <cmath>
 #include <exception>
 #include <filesystem>
+#include <future>
+#include <iomanip>
 #include <iostream>
 #include <regex>
 #include <sstream>
+#include <thread>
 
 #include "AGAConvException.hpp"
+#include "AudioResampler.hpp"
+#include "ExtractionCache.hpp"
+#include "FFmpegProgress.hpp"
+#include "FrameFileWatcher.hpp"
+#include "LibavDecoder.hpp"
 
 using namespace std;
 
@@ -17,44 +27,91 @@ namespace AGAConv {
 ExternalToolDriver::ExternalToolDriver():_osLayer(OSLayer::createOSLayer()) {
 }
 
-void ExternalToolDriver::checkCommandProcessor() {
-  if (!system(nullptr)) {
-    throw AGAConvException(79, "Command processor does not exist. Cannot run any external tool.");
+void ExternalToolDriver::runFFMPEGExtraction(const Options& options) {
+  if(options.extractionCache) {
+    ExtractionCache cache(options, extractionSettings(options));
+    if(cache.restore())
+      return;
+    runFFMPEGAudioAndVideoExtraction(options);
+    cache.store();
+  } else {
+    runFFMPEGAudioAndVideoExtraction(options);
   }
 }
 
-void ExternalToolDriver::runFFMPEGExtraction(const Options& options) {
-  runFFMPEGAudioExtraction(options);
-  runFFMPEGVideoExtraction(options);  
+string ExternalToolDriver::extractionSettings(const Options& options) {
+  // All options that determine the files extracted by ffmpeg. The format tag must be changed
+  // when the extraction commands change (invalidates all existing cache entries).
+  stringstream settings;
+  settings<<"extraction-v1"
+          <<";tool="<<options.conversionTool
+          <<";filter="<<ffmpegVideoFilter(options, ffmpegHeightExpression(options))
+          <<";digits="<<options.fixedFrameDigits
+          <<";start="<<options.startFrame()<<";frames="<<options.durationFrames()
+          <<";audio="<<audioSettings(options);
+  return settings.str();
+}
+
+string ExternalToolDriver::audioSettings(const Options& options) {
+  return std::to_string(options.frequency)+(options.stereo?"stereo":"mono")+(options.nativeResampler()?";resampler=native":"");
+}
+
+void ExternalToolDriver::runFFMPEGAudioAndVideoExtraction(const Options& options) {
+  // Both passes decode the same input file, but are independent of each other. The audio pass
+  // runs in a separate thread while the video pass is running (both are separate ffmpeg processes).
+  auto audioExtraction=std::async(std::launch::async, [this, &options]() { runFFMPEGAudioExtraction(options); });
+  try {
+    runFFMPEGVideoExtraction(options, false);
+  } catch(...) {
+    // Stop the audio pass before reporting the error of the video pass
+    terminateRunningTools();
+    audioExtraction.wait();
+    throw;
+  }
+  // Rethrows the exception of the audio pass (if any)
+  audioExtraction.get();
 }
 
 void ExternalToolDriver::runFFMPEGAudioExtraction(const Options& options) {
-  string audioModeFFMPEGOption="unset";
   std::filesystem::path audioFileName=options.getTmpDirSndFileName();
-  if(options.stereo) {
-    audioModeFFMPEGOption="";
-  } else {
-    audioModeFFMPEGOption="-ac 1";
-  }
-  assert(audioModeFFMPEGOption!="unset");
   assert(options.hasInFile());
   assert(options.hasSndFile());
-  stringstream audioCommand;
-  audioCommand<<"-i "<<options.inFileName
-              <<" "<<_allQuietOptions
-              <<" -ar "<<options.frequency
-              <<" "<<"-f u8 -acodec pcm_u8"
-              <<" "<<audioModeFFMPEGOption
-              <<" "<<audioFileName
-    ;
-  // Extract audio data from input video file
-  runFFMPEG(options, audioCommand.str(), "ffmpeg (extracting audio data with frequency "+std::to_string(options.frequency)+")");
+  // Audio starts at the first extracted frame and has the length of all extracted frames
+  vector<string> audioCommand=ffmpegSeekOptions(options, 0);
+  if(options.durationFrames()>0)
+    audioCommand.insert(audioCommand.end(), {"-t", ffmpegTime(options, options.durationFrames())});
+  audioCommand.insert(audioCommand.end(), {"-i", options.inFileName.string()});
+  audioCommand.insert(audioCommand.end(), _allQuietOptions.begin(), _allQuietOptions.end());
+  if(options.nativeResampler()) {
+    // 16 bit samples at the original frequency, resampled and converted to 8 bit by agaconv
+    audioCommand.insert(audioCommand.end(), {"-f", "wav", "-acodec", "pcm_s16le", "-ac", options.stereo?"2":"1"});
+    audioCommand.push_back(options.getTmpDirWavFileName().string());
+    runFFMPEG(options, audioCommand, "ffmpeg (extracting audio data)");
+    AudioResampler::convertWavFile(options.getTmpDirWavFileName(), audioFileName, options.frequency, options.verbose);
+    std::filesystem::remove(options.getTmpDirWavFileName());
+  } else {
+    audioCommand.insert(audioCommand.end(), {"-ar", std::to_string(options.frequency), "-f", "u8", "-acodec", "pcm_u8"});
+    if(!options.stereo) {
+      audioCommand.insert(audioCommand.end(), {"-ac", "1"});
+    }
+    audioCommand.push_back(audioFileName.string());
+    // Extract audio data from input video file
+    runFFMPEG(options, audioCommand, "ffmpeg (extracting audio data with frequency "+std::to_string(options.frequency)+")");
+  }
   if(options.verbose>=2) {
     cout<<"Extracted audio file "<<audioFileName<<" (sound mode:"<<options.audioModeToString()<<")"<<endl;
   }
 }
 
-void ExternalToolDriver::prepareTmpDir(const Options& options) {
+void ExternalToolDriver::prepareTmpDir(Options& options) {
+  namespace fs = std::filesystem;
+  if(options.tmpStorage=="ram") {
+    selectRamDiskTmpDir(options);
+  }
+  createTmpDir(options);
+}
+
+void ExternalToolDriver::createTmpDir(const Options& options) {
   namespace fs = std::filesystem;
   fs::path tmpPath(options.getTmpDirName());
   // Checked in configuration setup, must be true here
@@ -72,19 +129,80 @@ void ExternalToolDriver::prepareTmpDir(const Options& options) {
   if(options.verbose>=3) cout<<"Using temporary directory "<<tmpPath<<endl;
 }
 
+void ExternalToolDriver::selectRamDiskTmpDir(Options& options) {
+  namespace fs = std::filesystem;
+  fs::path ramDiskDir=_osLayer->getRamDiskDir();
+  if(ramDiskDir.empty()) {
+    if(options.verbose>=1) cout<<"Note: no RAM disk available. Using disk for temporary files."<<endl;
+    return;
+  }
+  std::uintmax_t requiredSize=estimatedTmpDirSize(options);
+  std::error_code ec;
+  fs::space_info ramDiskSpace=fs::space(ramDiskDir, ec);
+  // Keep a margin, the size of compressed frame files is only estimated
+  if(requiredSize==0 || ec || ramDiskSpace.available<requiredSize+requiredSize/4) {
+    if(options.verbose>=1) {
+      if(requiredSize==0)
+        cout<<"Note: could not estimate size of temporary files. Using disk for temporary files."<<endl;
+      else
+        cout<<"Note: not enough space on RAM disk "<<ramDiskDir<<" (required: "<<(requiredSize>>20)<<" MiB). Using disk for temporary files."<<endl;
+    }
+    return;
+  }
+  options.setTmpDirName(ramDiskDir/options.getTmpDirName().filename());
+  if(options.verbose>=2) cout<<"Using RAM disk for temporary files (estimated size: "<<(requiredSize>>20)<<" MiB)"<<endl;
+}
+
+std::uintmax_t ExternalToolDriver::estimatedTmpDirSize(const Options& options) {
+  uint32_t numFrames=expectedNumberOfFrames(options);
+  if(numFrames==0)
+    return 0;
+  double duration=(double)numFrames/options.fps;
+  std::uintmax_t frames=(std::uintmax_t)numFrames+1;
+  std::uintmax_t pixels=0;
+  if(options.nativeScaler()) {
+    // Frames are extracted in their original size
+    uint32_t inWidth=0, inHeight=0;
+    probeVideoDimensions(options, inWidth, inHeight);
+    pixels=(std::uintmax_t)inWidth*inHeight;
+  } else {
+    pixels=(std::uintmax_t)options.width*scaledVideoHeight(options);
+  }
+  std::uintmax_t frameSize=0;
+  if(!options.pipeFrames) {
+    if(options.conversionTool=="ffmpeg" && !options.nativeQuantizer()) {
+      // Paletted PNG files (upper bound without compression)
+      frameSize=pixels+1024;
+    } else {
+      // RGB PNG files and the IFF files with up to 8 bitplanes generated by ham_convert
+      frameSize=pixels*3+pixels;
+    }
+  }
+  std::uintmax_t audioSize=(std::uintmax_t)(duration*options.frequency)*(options.stereo?2:1);
+  if(options.nativeResampler()) {
+    // 16 bit samples at the original frequency (assumed to be at most 48kHz) before resampling
+    audioSize+=(std::uintmax_t)(duration*48000)*2*(options.stereo?2:1);
+  }
+  return frames*frameSize+audioSize;
+}
+
 std::uintmax_t ExternalToolDriver::removeFrameFiles(const Options& options, string extension) {
   std::uintmax_t numFiles=0;
   if(std::filesystem::is_directory(options.getTmpDirName())) {
+    std::regex hamConvertRegex("frame[0-9]+(_output)?");
+    // Frame files that ffmpeg did not complete (-atomic_writing), not counted
+    std::regex partialFrameRegex("frame[0-9]+\\."+extension);
     for (auto const& dir_entry : std::filesystem::directory_iterator{options.getTmpDirName()}) {
       if(std::filesystem::is_regular_file(dir_entry)) {
         std::filesystem::path filePath=dir_entry.path();
         string fileName=filePath.stem();
         string fileExt=filePath.extension();
-        std::regex hamConvertRegex("frame[0-9]+(_output)?");
         if(std::regex_match(fileName, hamConvertRegex) && fileExt==("."+extension)) {
           bool success=std::filesystem::remove(filePath);
           if(success)
             numFiles++;
+        } else if(std::regex_match(fileName, partialFrameRegex) && fileExt==".tmp") {
+          std::filesystem::remove(filePath);
         }
       }
     }
@@ -110,12 +228,19 @@ void ExternalToolDriver::removeTmpDir(const Options& options, bool strict) {
       throw AGAConvException(72, "Did not remove tmp directory "+options.getTmpDirName().string());
     }
   }
+  // Only exists if the conversion failed while resampling with the native resampler
+  std::filesystem::remove(options.getTmpDirWavFileName());
   
-  // Only to be removed when ham_convert is used
-  std::filesystem::path hcBatchFile=options.getTmpDirName()/options.hamConvertBatchFileName;
-  success=std::filesystem::remove(hcBatchFile);
-  if(success && options.verbose==2)
-    cout<<"- Removed 1 batch file "<<hcBatchFile<<endl;
+  // Only to be removed when ham_convert is used (one batch file per ham_convert instance)
+  // (fewer instances than hc_jobs are used for short videos, including a single one)
+  vector<std::filesystem::path> hcBatchFiles={hamConvertBatchFileName(options, 0, 1)};
+  for(size_t job=0;options.hcJobs>1 && job<options.hcJobs;job++)
+    hcBatchFiles.push_back(hamConvertBatchFileName(options, job, options.hcJobs));
+  for(auto& hcBatchFile : hcBatchFiles) {
+    success=std::filesystem::remove(hcBatchFile);
+    if(success && options.verbose==2)
+      cout<<"- Removed 1 batch file "<<hcBatchFile<<endl;
+  }
   
   std::uintmax_t num1=removeFrameFiles(options,"png");
   std::uintmax_t num2=removeFrameFiles(options,"iff");
@@ -146,159 +271,648 @@ void ExternalToolDriver::finalizeTmpDir(const Options& options) {
   removeTmpDir(options,strict);
 }
 
-void ExternalToolDriver::runFFMPEGVideoExtraction(const Options& options) {
-  string heightString;
+string ExternalToolDriver::ffmpegHeightExpression(const Options& options) {
   if(options.height==Options::autoValue) {
     // Height 'auto' mode
     // ffmpeg vars: iw, ih; yscale: ratio=iw/width; height=ih/ratio*yscale (explicit values with iw, ih for ffmpeg)
-    string divString="unset";
-    if(options.resMode==Options::GFX_UNSPECIFIED) {
-      divString="";
-    } else {
-      if(!options.screenModeLace) {
-        if(options.resMode==Options::GFX_SUPERHIRES)
-          divString="/4";
-        else if(options.resMode==Options::GFX_HIRES)
-          divString="/2";
-        else
-          divString="";
-        assert(options.resMode!=Options::GFX_AUTO);
-      } else {
-        divString="";
-      }
-    }
-    assert(divString!="unset");
-    heightString="(ih"+divString+")"+"/(iw/"+std::to_string(options.width)+")*"+std::to_string(options.yScaleFactor);
+    uint32_t divisor=options.autoHeightDivisor();
+    string divString=(divisor==1)?"":"/"+std::to_string(divisor);
+    return "(ih"+divString+")"+"/(iw/"+std::to_string(options.width)+")*"+std::to_string(options.yScaleFactor);
   } else {
     // Height 'auto' mode off. Height is explicitly defined by user or in config file.
     // Consequently, screen-resolution and scale-ratio are not considered in height computation.
-    heightString=std::to_string(options.height);
+    return std::to_string(options.height);
   }
+}
 
-  string ffmpegBlackAndWhiteOption;
-  if(options.blackAndWhite)
-    ffmpegBlackAndWhiteOption=",format=gray";
+uint32_t ExternalToolDriver::scaledVideoHeight(const Options& options) {
+  if(options.height!=Options::autoValue)
+    return options.height;
+  uint32_t inWidth=0, inHeight=0;
+  probeVideoDimensions(options, inWidth, inHeight);
+  return options.scaledHeight(inWidth, inHeight);
+}
 
-  stringstream videoCommand;
-  string ffmpegVerbosity;
+void ExternalToolDriver::probeVideoDimensions(const Options& options, uint32_t& width, uint32_t& height) {
+  vector<string> probeCommand={"-v", "error", "-select_streams", "v:0", "-show_entries", "stream=width,height", "-of", "csv=p=0:s=x", options.inFileName.string()};
+  string dimensions=runToolAndReadOutput(options, "ffprobe", probeCommand, "ffprobe (determining video dimensions)");
+  // Format: WIDTHxHEIGHT
+  std::smatch match;
+  std::regex dimensionsRegex("([0-9]+)x([0-9]+)\\s*");
+  if(!std::regex_match(dimensions, match, dimensionsRegex)) {
+    throw AGAConvException(82, "could not determine video dimensions of "+options.inFileName.string()+" (ffprobe reported: '"+dimensions+"').");
+  }
+  width=(uint32_t)std::stoul(match[1]);
+  height=(uint32_t)std::stoul(match[2]);
+  if(width==0 || height==0) {
+    throw AGAConvException(82, "could not determine video dimensions of "+options.inFileName.string()+" (ffprobe reported: '"+dimensions+"').");
+  }
+  if(options.verbose>=2) {
+    cout<<"Input video dimensions: "<<width<<"x"<<height<<endl;
+  }
+}
+
+vector<string> ExternalToolDriver::ffmpegVerbosity(const Options& options) {
   if(options.verbose<=1)
-    ffmpegVerbosity=this->_allQuietOptions;
+    return this->_allQuietOptions;
   else if(options.verbose<=2)
-    ffmpegVerbosity=this->_frameInfoOptions;
+    return this->_frameInfoOptions;
   else
-    ffmpegVerbosity="";
-  
-  if(options.conversionTool=="ffmpeg") {
-    videoCommand
-      <<"-i "<<options.inFileName
-      <<" "<<ffmpegVerbosity
-      <<" "<<"-filter_complex \"[0:v] fps="<<options.fps
-      <<ffmpegBlackAndWhiteOption
-      <<",scale=w="<<options.width
-      <<":h="<<heightString<<":sws_flags=lanczos:param0=3:sws_dither=none,split [a][b];[a] palettegen=max_colors="<<options.maxColorsCorrected()
-      <<":stats_mode=single:reserve_transparent=false [p];[b][p] paletteuse=new=1:dither="<<options.ditherMode<<"\""
-      <<" "<<(options.getTmpDirName()/(options.ffmpegFrameNameSuffix()+".png"))
-      ;
+    return _quietOptions;
+}
+
+string ExternalToolDriver::ffmpegVideoFilter(const Options& options, const string& heightString) {
+  if(options.conversionTool=="ffmpeg" && !options.nativeQuantizer()) {
+    return "[0:v] "+ffmpegScaleFilter(options, heightString)+","+ffmpegPaletteFilter(options, "");
   } else {
-    // For all other conversion tools only extract frames and resize, don't change color format (except for black-and-white option)
-    videoCommand
-      <<"-i "<<options.inFileName
-      <<" "<<ffmpegVerbosity
-      <<" "<<"-filter_complex \"[0:v] fps="<<options.fps
-      <<ffmpegBlackAndWhiteOption
-      <<",scale=w="<<options.width<<":h="+heightString<<":sws_flags=lanczos:param0=3:sws_dither=none\""
-      <<" "<<(options.getTmpDirName()/(options.ffmpegFrameNameSuffix()+".png"))
-      ;
+    // For all other conversion tools and the native quantizer only extract frames and resize, don't change color format (except for black-and-white option)
+    return "[0:v] "+ffmpegScaleFilter(options, heightString);
   }
-  runFFMPEG(options,videoCommand.str(), "ffmpeg (extracting frames as PNG files)");
 }
 
-void ExternalToolDriver::runFFMPEG(const Options& options, const string& ffmpegCommandLine, const string& info) {
-  runTool(options, "ffmpeg",ffmpegCommandLine, info);
+string ExternalToolDriver::ffmpegScaleFilter(const Options& options, const string& heightString) {
+  string ffmpegBlackAndWhiteOption;
+  if(options.blackAndWhite)
+    ffmpegBlackAndWhiteOption=",format=gray";
+  stringstream filter;
+  if(options.nativeScaler()) {
+    // Frames are extracted in their original size and scaled by agaconv
+    filter<<"fps="<<options.fps<<ffmpegBlackAndWhiteOption;
+    return filter.str();
+  }
+  filter
+    <<"fps="<<options.fps
+    <<ffmpegBlackAndWhiteOption
+    <<",scale=w="<<options.width
+    <<":h="<<heightString<<":sws_flags=lanczos:param0=3:sws_dither=none"
+    ;
+  return filter.str();
 }
 
-void ExternalToolDriver::runTool(const Options& options, const string& tool, const string& commandLine, const string& info) {
-  if(options.verbose>=1) cout<<"Running external tool "<<info<<endl;
-  string cl=tool+" "+commandLine;
+string ExternalToolDriver::ffmpegPaletteFilter(const Options& options, const string& labelSuffix) {
+  // Truecolor frames are quantized by agaconv
+  if(options.nativeQuantizer())
+    return "null";
+  stringstream filter;
+  filter
+    <<"split [a"<<labelSuffix<<"][b"<<labelSuffix<<"];[a"<<labelSuffix<<"] palettegen=max_colors="<<options.maxColorsCorrected()
+    <<":stats_mode=single:reserve_transparent=false [p"<<labelSuffix<<"];[b"<<labelSuffix<<"][p"<<labelSuffix<<"] paletteuse=new=1:dither="<<options.ditherMode
+    ;
+  if(options.ditherMode=="bayer")
+    filter<<":bayer_scale="<<options.ffBayerScale;
+  return filter.str();
+}
+
+string ExternalToolDriver::ffmpegMultiOutputVideoFilter(const vector<const Options*>& outputGroups) {
+  // Frames are decoded and scaled once, then split into one palette conversion per output group
+  stringstream filter;
+  filter<<"[0:v] "<<ffmpegScaleFilter(*outputGroups[0], ffmpegHeightExpression(*outputGroups[0]))<<",split="<<outputGroups.size()<<" ";
+  for(size_t i=0;i<outputGroups.size();i++)
+    filter<<"[s"<<i<<"]";
+  for(size_t i=0;i<outputGroups.size();i++)
+    filter<<";[s"<<i<<"] "<<ffmpegPaletteFilter(*outputGroups[i], std::to_string(i))<<" [v"<<i<<"]";
+  return filter.str();
+}
+
+double ExternalToolDriver::probeVideoDuration(const Options& options) {
+  vector<string> probeCommand={"-v", "error", "-show_entries", "format=duration", "-of", "csv=p=0", options.inFileName.string()};
+  string duration=runToolAndReadOutput(options, "ffprobe", probeCommand, "ffprobe (determining video duration)");
+  // Format: SECONDS (or N/A if unknown)
+  std::regex durationRegex("([0-9]+(\\.[0-9]*)?)\\s*");
+  std::smatch match;
+  if(!std::regex_match(duration, match, durationRegex))
+    return 0.0;
+  return std::stod(match[1]);
+}
+
+uint32_t ExternalToolDriver::expectedNumberOfFrames(const Options& options) {
+  if(options.durationFrames()>0)
+    return options.durationFrames();
+  // Number of frames generated by the fps filter (rounds to the nearest frame)
+  uint32_t videoFrames=(uint32_t)std::lround(probeVideoDuration(options)*options.fps);
+  if(videoFrames<=options.startFrame())
+    return 0;
+  return videoFrames-options.startFrame();
+}
+
+string ExternalToolDriver::ffmpegTime(const Options& options, uint32_t frames) {
+  stringstream time;
+  time<<std::fixed<<std::setprecision(6)<<(double)frames/options.fps;
+  return time.str();
+}
+
+vector<string> ExternalToolDriver::ffmpegSeekOptions(const Options& options, uint32_t frameOffset) {
+  // Input seeking (before -i). Timestamps start at 0 again, therefore the fps filter grid is aligned
+  // to the first frame and the audio data starts exactly at the first frame.
+  uint32_t firstFrame=options.startFrame()+frameOffset;
+  if(firstFrame==0)
+    return {};
+  return {"-ss", ffmpegTime(options, firstFrame)};
+}
+
+vector<ExternalToolDriver::ExtractionSegment> ExternalToolDriver::extractionSegments(const Options& options, uint32_t totalFrames) {
+  vector<ExtractionSegment> segments;
+  uint32_t jobs=options.extractJobs;
+  if(jobs>1) {
+    if(totalFrames==0) {
+      if(options.verbose>=1)
+        cout<<"Note: could not determine video duration. Extracting frames with one ffmpeg process."<<endl;
+    } else {
+      jobs=std::min(jobs,totalFrames);
+      for(uint32_t i=0;i<jobs;i++) {
+        ExtractionSegment segment;
+        segment.firstFrame=(uint32_t)((uint64_t)totalFrames*i/jobs);
+        // The last segment is not limited, it covers frames beyond the estimated total number of frames
+        if(i<jobs-1)
+          segment.numFrames=(uint32_t)((uint64_t)totalFrames*(i+1)/jobs)-segment.firstFrame;
+        segments.push_back(segment);
+      }
+    }
+  }
+  if(segments.size()==0)
+    segments.push_back(ExtractionSegment());
+  // With a given duration the last segment is limited as well
+  if(options.durationFrames()>0)
+    segments.back().numFrames=options.durationFrames()-segments.back().firstFrame;
+  return segments;
+}
+
+vector<string> ExternalToolDriver::ffmpegVideoExtractionCommand(const Options& options, bool atomicFrameFiles, ExtractionSegment segment, const vector<const Options*>& outputGroups) {
+  vector<string> videoCommand=ffmpegSeekOptions(options, segment.firstFrame);
+  videoCommand.insert(videoCommand.end(), {"-i", options.inFileName.string()});
+  vector<string> verbosity=ffmpegVerbosity(options);
+  videoCommand.insert(videoCommand.end(), verbosity.begin(), verbosity.end());
+  if(outputGroups.size()<=1) {
+    videoCommand.insert(videoCommand.end(), {"-filter_complex", ffmpegVideoFilter(options, ffmpegHeightExpression(options))});
+    appendFrameOutputOptions(videoCommand, options, atomicFrameFiles, segment);
+  } else {
+    videoCommand.insert(videoCommand.end(), {"-filter_complex", ffmpegMultiOutputVideoFilter(outputGroups)});
+    for(size_t i=0;i<outputGroups.size();i++) {
+      videoCommand.insert(videoCommand.end(), {"-map", "[v"+std::to_string(i)+"]"});
+      appendFrameOutputOptions(videoCommand, *outputGroups[i], atomicFrameFiles, segment);
+    }
+  }
+  return videoCommand;
+}
+
+void ExternalToolDriver::appendFrameOutputOptions(vector<string>& videoCommand, const Options& options, bool atomicFrameFiles, ExtractionSegment segment) {
+  if(atomicFrameFiles)
+    videoCommand.insert(videoCommand.end(), {"-atomic_writing", "1"});
+  if(segment.numFrames>0)
+    videoCommand.insert(videoCommand.end(), {"-frames:v", std::to_string(segment.numFrames)});
+  if(segment.firstFrame>0)
+    videoCommand.insert(videoCommand.end(), {"-start_number", std::to_string(segment.firstFrame+1)}); // ffmpeg default start number is 1
+  videoCommand.push_back((options.getTmpDirName()/(options.ffmpegFrameNameSuffix()+".png")).string());
+}
+
+bool ExternalToolDriver::showProgress(const Options& options) {
+  // For higher verbose levels the tools print their own information line by line
+  return options.verbose==1 && _osLayer->isTerminalOutput();
+}
+
+void ExternalToolDriver::runFFMPEGVideoExtraction(const Options& options, bool atomicFrameFiles, const vector<const Options*>& outputGroups) {
+  uint32_t totalFrames=0;
+  if(options.extractJobs>1 || showProgress(options) || options.durationFrames()>0)
+    totalFrames=expectedNumberOfFrames(options);
+  vector<ExtractionSegment> segments=extractionSegments(options, totalFrames);
+  FFmpegProgress progress("Extracting frames", totalFrames, showProgress(options));
+  if(segments.size()==1) {
+    runFFMPEG(options, ffmpegVideoExtractionCommand(options, atomicFrameFiles, segments[0], outputGroups), "ffmpeg (extracting frames as PNG files)", &progress, 0);
+  } else {
+    // Each ffmpeg process writes a disjoint range of frame numbers
+    vector<std::future<void>> segmentExtractions;
+    for(size_t i=0;i<segments.size();i++) {
+      string info="ffmpeg (extracting frames as PNG files, segment "+std::to_string(i+1)+"/"+std::to_string(segments.size())
+        +" starting at frame "+std::to_string(segments[i].firstFrame+1)+")";
+      vector<string> command=ffmpegVideoExtractionCommand(options, atomicFrameFiles, segments[i], outputGroups);
+      segmentExtractions.push_back(std::async(std::launch::async, [this, &options, command, info, &progress, i]() { runFFMPEG(options, command, info, &progress, i); }));
+    }
+    try {
+      waitForAllTools(segmentExtractions);
+    } catch(...) {
+      progress.finish();
+      throw;
+    }
+  }
+  progress.finish();
+  if(options.verbose>=2) {
+    cout<<"Extracted "<<progress.getFrames()<<" frames ("<<std::fixed<<std::setprecision(1)<<progress.getFramesPerSecond()<<" fps)"<<endl;
+    cout<<std::defaultfloat;
+  }
+}
+
+void ExternalToolDriver::runFFMPEGPipedConversion(Options& options) {
+  assert(options.conversionTool=="ffmpeg" || options.conversionTool=="native");
+  runFFMPEGAudioExtraction(options);
+  // Raw frames carry no dimensions, therefore the height must be known before ffmpeg is started
+  uint32_t width=options.width;
+  uint32_t height=0;
+  if(options.nativeScaler()) {
+    // Frames are streamed in their original size and scaled by agaconv
+    probeVideoDimensions(options, width, height);
+  } else {
+    height=scaledVideoHeight(options);
+  }
+  vector<string> videoCommand=ffmpegSeekOptions(options, 0);
+  videoCommand.insert(videoCommand.end(), {"-i", options.inFileName.string()});
+  vector<string> verbosity=ffmpegVerbosity(options);
+  videoCommand.insert(videoCommand.end(), verbosity.begin(), verbosity.end());
+  videoCommand.insert(videoCommand.begin(), {"-progress", "pipe:"+std::to_string(ProcessRunner::progressFileDescriptor)});
+  videoCommand.insert(videoCommand.end(), {"-filter_complex", ffmpegVideoFilter(options, std::to_string(height))});
+  if(options.durationFrames()>0)
+    videoCommand.insert(videoCommand.end(), {"-frames:v", std::to_string(options.durationFrames())});
+  videoCommand.insert(videoCommand.end(), {"-f", "rawvideo", "-pix_fmt", options.nativeQuantizer()?"rgb24":"pal8", "-"});
+  FFmpegProgress progress("Converting frames", showProgress(options)?expectedNumberOfFrames(options):0, showProgress(options));
+  auto process=std::make_shared<ProcessRunner>("ffmpeg", videoCommand);
+  process->setStdoutMode(ProcessRunner::OUTPUT_PIPE);
+  process->setProgress(&progress, 0);
+  startTool(options, process, "ffmpeg (streaming frames through pipe, "+std::to_string(width)+"x"+std::to_string(height)+")");
+  CDXLEncode stage;
+  try {
+    stage.runFrameStream(options, process->getStdoutStream(), (int)width, (int)height);
+  } catch(...) {
+    terminateRunningTools();
+    progress.finish();
+    throw;
+  }
+  finishTool(process);
+  progress.finish();
+}
+
+#ifdef AGACONV_LIBAV
+void ExternalToolDriver::runLibavConversion(Options& options) {
+  assert(options.libavDecoder());
+  auto decoder=std::make_unique<LibavDecoder>(options);
+  if(options.verbose>=2) {
+    cout<<"Decoding input video with libav"<<endl;
+  }
+  decoder->decodeAudio(options.getTmpDirSndFileName());
+  uint32_t inWidth=0, inHeight=0;
+  decoder->getVideoDimensions(inWidth, inHeight);
+  int width=(int)options.width;
+  int height=(int)(options.height!=Options::autoValue?options.height:options.scaledHeight(inWidth, inHeight));
+  if(options.nativeScaler()) {
+    // Frames are decoded in their original size and scaled by agaconv
+    width=(int)inWidth;
+    height=(int)inHeight;
+  }
+  FFmpegProgress progress("Converting frames", showProgress(options)?decoder->expectedNumberOfFrames():0, showProgress(options));
+  uint32_t frameNr=0;
+  CDXLEncode stage;
+  stage.runFrameSource(options, [&decoder, &progress, &frameNr, width, height]() {
+    auto frameLoader=decoder->nextFrame(width, height);
+    if(frameLoader)
+      progress.processProgressLine(0, "frame="+std::to_string(++frameNr));
+    return frameLoader;
+  });
+  progress.finish();
+}
+
+#endif
+void ExternalToolDriver::runFFMPEGOverlappedConversion(Options& options) {
+  assert(options.conversionTool=="ffmpeg" || options.conversionTool=="native");
+  std::filesystem::path inFileWithPath=options.getTmpDirName()/("frame"+options.firstFrameNumberToString()+".png");
+  std::unique_ptr<ExtractionCache> cache;
+  if(options.extractionCache) {
+    cache=std::make_unique<ExtractionCache>(options, extractionSettings(options));
+    if(cache->restore()) {
+      // All frames are available, nothing to overlap with
+      CDXLEncode stage;
+      stage.setInFileWithPath(inFileWithPath);
+      stage.run(options);
+      return;
+    }
+  }
+  FrameFileWatcher frameFileWatcher(options.getTmpDirName());
+  if(options.verbose>=2) {
+    cout<<"Encoding frames during extraction ("<<(frameFileWatcher.usesFileSystemEvents()?"inotify":"polling")<<")"<<endl;
+  }
+  auto videoExtraction=std::async(std::launch::async, [this, &options, &frameFileWatcher]() {
+    try {
+      runFFMPEGVideoExtraction(options, true);
+    } catch(...) {
+      frameFileWatcher.setProducerFinished();
+      throw;
+    }
+    frameFileWatcher.setProducerFinished();
+  });
+  try {
+    // The encoder requires the complete audio data before the first frame is encoded
+    runFFMPEGAudioExtraction(options);
+    CDXLEncode stage;
+    stage.setInFileWithPath(inFileWithPath);
+    stage.setFrameFileWatcher(&frameFileWatcher);
+    stage.run(options);
+  } catch(...) {
+    // A failed ffmpeg frame extraction is the more likely cause of an encoder error, report it first.
+    // Otherwise ffmpeg is stopped and the encoder error is reported.
+    if(videoExtraction.wait_for(std::chrono::seconds(0))==std::future_status::ready) {
+      videoExtraction.get();
+    } else {
+      terminateRunningTools();
+      videoExtraction.wait();
+    }
+    throw;
+  }
+  // Reports an error of ffmpeg even if all frames written before the error were encoded
+  videoExtraction.get();
+  if(cache)
+    cache->store();
+}
+
+void ExternalToolDriver::runFFMPEGVariantsConversion(Options& options) {
+  vector<Options*> outputs={&options};
+  for(auto& variant : options.variants)
+    outputs.push_back(&variant);
+  string scaleFilter=ffmpegScaleFilter(options, ffmpegHeightExpression(options));
+  for(auto output : outputs) {
+    if(output->conversionTool!="ffmpeg" && output->conversionTool!="native") {
+      throw AGAConvException(84,"output "+output->outFileName.string()+": color mode "+output->colorMode+" requires "+output->conversionTool+", which is not supported with output variants.");
+    }
+    if(ffmpegScaleFilter(*output, ffmpegHeightExpression(*output))!=scaleFilter
+       || output->startFrame()!=options.startFrame() || output->durationFrames()!=options.durationFrames()) {
+      throw AGAConvException(85,"output "+output->outFileName.string()+": all output variants must have the same frame size, frame rate, and segment (options width, height, fps, black-and-white, start, duration).");
+    }
+  }
+
+  // Outputs with the same palette and audio settings share PNG files and audio file (one tmp dir per group)
+  vector<const Options*> outputGroups;
+  try {
+    std::map<string,string> groupTmpDirs;
+    for(auto output : outputs) {
+      stringstream groupKey;
+      groupKey<<ffmpegPaletteFilter(*output, "")<<";audio="<<audioSettings(*output);
+      auto group=groupTmpDirs.find(groupKey.str());
+      if(group!=groupTmpDirs.end()) {
+        output->setTmpDirName((*group).second);
+        continue;
+      }
+      if(outputGroups.size()>0) {
+        output->setTmpDirName(options.getTmpDirName().string()+"-v"+std::to_string(outputGroups.size()));
+        createTmpDir(*output);
+      }
+      groupTmpDirs[groupKey.str()]=output->getTmpDirName().string();
+      outputGroups.push_back(output);
+    }
+    if(options.verbose>=2) {
+      cout<<"Generating "<<outputs.size()<<" output files from "<<outputGroups.size()<<" different frame conversions."<<endl;
+    }
+
+    // Audio data is extracted once for each audio setting and copied to the other groups
+    vector<std::future<void>> extractions;
+    std::map<string,const Options*> audioGroups;
+    vector<std::pair<const Options*,const Options*>> audioCopies;
+    for(auto group : outputGroups) {
+      string audioKey=audioSettings(*group);
+      auto audioGroup=audioGroups.find(audioKey);
+      if(audioGroup!=audioGroups.end()) {
+        audioCopies.push_back({(*audioGroup).second, group});
+        continue;
+      }
+      audioGroups[audioKey]=group;
+      extractions.push_back(std::async(std::launch::async, [this, group]() { runFFMPEGAudioExtraction(*group); }));
+    }
+    extractions.push_back(std::async(std::launch::async, [this, &options, &outputGroups]() { runFFMPEGVideoExtraction(options, false, outputGroups); }));
+    waitForAllTools(extractions);
+    for(auto audioCopy : audioCopies) {
+      std::filesystem::copy_file(audioCopy.first->getTmpDirSndFileName(), audioCopy.second->getTmpDirSndFileName(), std::filesystem::copy_options::overwrite_existing);
+    }
+
+    // Encoders are independent of each other, they run at the same time and share the threads (--jobs)
+    size_t jobs=options.jobs>0?options.jobs:std::max(1u,std::thread::hardware_concurrency());
+    for(auto output : outputs)
+      output->jobs=(uint32_t)std::max<size_t>(1,jobs/outputs.size());
+    vector<std::future<void>> encodings;
+    for(auto output : outputs) {
+      encodings.push_back(std::async(std::launch::async, [output]() {
+        CDXLEncode stage;
+        stage.setInFileWithPath(output->getTmpDirName()/("frame"+output->firstFrameNumberToString()+".png"));
+        stage.run(*output);
+      }));
+    }
+    waitForAllTools(encodings);
+  } catch(...) {
+    // The tmp dirs of the other groups are unknown to the caller, they are removed here
+    removeGroupTmpDirs(outputGroups);
+    throw;
+  }
+
+  // The tmp dir of the first group is the tmp dir of the conversion
+  for(size_t i=1;i<outputGroups.size();i++)
+    finalizeTmpDir(*outputGroups[i]);
+}
+
+void ExternalToolDriver::removeGroupTmpDirs(const vector<const Options*>& outputGroups) {
+  for(size_t i=1;i<outputGroups.size();i++) {
+    if(outputGroups[i]->keepTmpFiles)
+      continue;
+    try {
+      bool strict=false;
+      removeTmpDir(*outputGroups[i],strict);
+    } catch(std::exception& e) {
+      // The error of the conversion is reported
+      cerr<<e.what()<<endl;
+    }
+  }
+}
+
+void ExternalToolDriver::runFFMPEG(const Options& options, const vector<string>& arguments, const string& info, FFmpegProgress* progress, size_t progressId) {
+  vector<string> ffmpegArguments=arguments;
+  if(progress) {
+    // Global option, ffmpeg writes key=value lines to the progress pipe
+    ffmpegArguments.insert(ffmpegArguments.begin(), {"-progress", "pipe:"+std::to_string(ProcessRunner::progressFileDescriptor)});
+  }
+  auto process=std::make_shared<ProcessRunner>("ffmpeg", ffmpegArguments);
+  if(progress) {
+    process->setProgress(progress, progressId);
+  }
+  runToolProcess(options, process, info);
+}
+
+void ExternalToolDriver::runTool(const Options& options, const string& tool, const vector<string>& arguments, const string& info) {
+  runToolProcess(options, std::make_shared<ProcessRunner>(tool, arguments), info);
+}
+
+void ExternalToolDriver::runToolProcess(const Options& options, std::shared_ptr<ProcessRunner> process, const string& info) {
   // Verbose is reversed, because output is turned off up to this level, hence, turned on above it
   if(options.verbose<=1) {
-    cl+=(" "+_osLayer->redirectOutputToNullDevice());
+    process->setStdoutMode(ProcessRunner::OUTPUT_DISCARD);
   }
+  startTool(options, process, info);
+  finishTool(process);
+}
+
+void ExternalToolDriver::startTool(const Options& options, std::shared_ptr<ProcessRunner> process, const string& info) {
+  if(options.verbose>=1) cout<<"Running external tool "<<info<<endl;
   if(options.verbose>=3) {
-    cout<<"TOOL COMMAND: "<<cl<<endl;
+    cout<<"TOOL COMMAND: "<<process->commandLineToString()<<endl;
   }
-  if(!_osLayer->isInstalledTool(tool)) {
+  if(!_osLayer->isInstalledTool(process->getTool())) {
     // Command doesn't exist
-    throw AGAConvException(78, "Tool "+tool+" is not installed");
+    throw AGAConvException(78, "Tool "+process->getTool()+" is not installed");
   }
-  int systemCode=std::system((const char *) (cl.c_str()));
-  if(systemCode!=0) {
-    throw AGAConvException(75, "Invocation of "+tool+" failed with system code "+std::to_string(systemCode));
+  // Error output is only shown for higher verbose levels, or when the tool fails
+  process->setEchoStderr(options.verbose>=2);
+  std::lock_guard<std::mutex> lock(_runningToolsMutex);
+  if(_toolsTerminated) {
+    throw AGAConvException(83, "Conversion aborted. Did not start "+process->getTool()+".");
   }
+  process->start();
+  _runningTools.insert(process);
 }
 
-void ExternalToolDriver::runHamConvert(Options& options) {
-  if(options.hcPath=="") {
-    throw AGAConvException(76, options.colorMode+" conversion requested, but 'hc_path' not set. Cannot find ham_convert. Exiting.");
+void ExternalToolDriver::finishTool(std::shared_ptr<ProcessRunner> process) {
+  int exitCode=process->wait();
+  {
+    std::lock_guard<std::mutex> lock(_runningToolsMutex);
+    _runningTools.erase(process);
   }
-  const std::filesystem::path tmpDir(options.getTmpDirName());
-  std::list<std::string> batchFileLines;
-  for (auto const& dir_entry : std::filesystem::directory_iterator{options.getTmpDirName()})  {
-    stringstream ss;
-    std::filesystem::path filePath=dir_entry.path();
-    string fileName=filePath.stem();
-    string fileExt=filePath.extension();
-    std::regex frameFileRegex("frame[0-9]+");
-    string extension="png";
-    if(std::regex_match(fileName, frameFileRegex) && fileExt==("."+extension)) {
-      ss<<dir_entry;
+  if(exitCode!=0) {
+    string errorOutput;
+    if(!process->getEchoStderr()) {
+      errorOutput=process->getStderrTail();
+      while(errorOutput.size()>0 && std::isspace((unsigned char)errorOutput.back()))
+        errorOutput.pop_back();
+      if(errorOutput.size()>0)
+        errorOutput="\n"+errorOutput;
+    }
+    throw AGAConvException(75, "Invocation of "+process->getTool()+" failed with exit code "+std::to_string(exitCode)+errorOutput);
+  }
+}
+
+void ExternalToolDriver::waitForAllTools(vector<std::future<void>>& toolRuns) {
+  // Rethrows the exception of the first failed tool (if any), the remaining tools are stopped
+  for(auto& toolRun : toolRuns) {
+    try {
+      toolRun.get();
+    } catch(...) {
+      terminateRunningTools();
+      for(auto& otherToolRun : toolRuns)
+        if(otherToolRun.valid())
+          otherToolRun.wait();
+      throw;
     }
-    batchFileLines.push_back(ss.str());
   }
-  batchFileLines.sort();
-  // Open file
-  ofstream batchFile;
-  std::filesystem::path batchFileName=options.getTmpDirName()/options.hamConvertBatchFileName;
-  batchFile.open(batchFileName, ios::out | ios::binary);
-  if(!batchFile.is_open()) {
-    throw AGAConvException(77, "could not open batch file "+batchFileName.string());
+}
+
+void ExternalToolDriver::terminateRunningTools() {
+  std::lock_guard<std::mutex> lock(_runningToolsMutex);
+  _toolsTerminated=true;
+  for(auto& process : _runningTools)
+    process->terminate();
+}
+
+string ExternalToolDriver::runToolAndReadOutput(const Options& options, const string& tool, const vector<string>& arguments, const string& info) {
+  auto process=std::make_shared<ProcessRunner>(tool, arguments);
+  process->setStdoutMode(ProcessRunner::OUTPUT_PIPE);
+  startTool(options, process, info);
+  FILE* stream=process->getStdoutStream();
+  string output;
+  char buffer[256];
+  size_t numRead;
+  while((numRead=fread(buffer, 1, sizeof(buffer), stream))>0) {
+    output.append(buffer, numRead);
   }
-  for(auto line : batchFileLines) {
-    batchFile<<line<<endl;
+  finishTool(process);
+  return output;
+}
+
+std::filesystem::path ExternalToolDriver::hamConvertBatchFileName(const Options& options, size_t job, size_t jobs) {
+  std::filesystem::path batchFileName=options.hamConvertBatchFileName;
+  if(jobs>1) {
+    batchFileName=batchFileName.stem().string()+"_"+std::to_string(job+1)+batchFileName.extension().string();
   }
-  batchFile.close();
-  const string jvmMemoryOptions="-Xms500m -Xmx2g";
+  return options.getTmpDirName()/batchFileName;
+}
+
+void ExternalToolDriver::runHamConvertJVM(const Options& options, const std::filesystem::path& batchFileName, const string& info, size_t job) {
+  // Initial heap size must not exceed the maximum heap size
+  const uint64_t initialHeapSize=500ull<<20;
+  const vector<string> jvmMemoryOptions={
+    "-Xms"+(options.hcJvmHeapSizeInBytes()<initialHeapSize?options.hcJvmHeap:string("500m")),
+    "-Xmx"+options.hcJvmHeap};
   const string hamQuality="q0"; // ham6:q0-7, ham8:q0-4
   string hcColorMode="";
   if(options.colorMode=="ehb")
     hcColorMode="ehb";
   else
     hcColorMode=options.colorMode+"_"+"q"+std::to_string(options.hcHamQuality);
-  string hamConvertCommand=
-    jvmMemoryOptions+" -jar "+options.hcPathResolved.string()
-    +" "+batchFileName.string()
-    +" "+hcColorMode
-    +" "+(options.reserveBlackBackgroundColor?"black_bkd":"")
-    +" norle nopng";
+  vector<string> hamConvertCommand=jvmMemoryOptions;
+  hamConvertCommand.insert(hamConvertCommand.end(), {"-jar", options.hcPathResolved.string(), batchFileName.string(), hcColorMode});
+  if(options.reserveBlackBackgroundColor)
+    hamConvertCommand.push_back("black_bkd");
+  hamConvertCommand.insert(hamConvertCommand.end(), {"norle", "nopng"});
   if(options.hcDither!="auto")
-    hamConvertCommand+=+" dither_"+options.hcDither;
+    hamConvertCommand.push_back("dither_"+options.hcDither);
   if(options.hcDither=="fs" && options.hcPropagation!=Options::autoValue)
-    hamConvertCommand+=(" propagation_"+std::to_string(options.hcPropagation)); // requires dither_fs
+    hamConvertCommand.push_back("propagation_"+std::to_string(options.hcPropagation)); // requires dither_fs
   if(options.colorMode!="ham8" && options.hcDiversity!=Options::autoValue)
-    hamConvertCommand+=(" diversity_"+std::to_string(options.hcDiversity));
+    hamConvertCommand.push_back("diversity_"+std::to_string(options.hcDiversity));
   if(options.hcQuant!="auto")
-    hamConvertCommand+=(" quant_"+options.hcQuant);
+    hamConvertCommand.push_back("quant_"+options.hcQuant);
 
   const string xvfbTool="xvfb-run";
   const string javaTool="java";
   // check xvfb-run (only relevant for MS Ubuntu app). If available use it, otherwise not.
   if(_osLayer->isInstalledTool(xvfbTool) && _osLayer->isInstalledTool(javaTool)) {
-    // with xvfb-run
-    ExternalToolDriver::runTool(options, xvfbTool ,string("-a ")+javaTool+" "+hamConvertCommand, "ham_convert with xvfb-run (converting PNG frames to IFF/ILBM frames)");
+    // with xvfb-run. Parallel instances search for a free server number starting at different numbers
+    // (the search of xvfb-run is not safe against concurrently started instances).
+    vector<string> xvfbCommand={"-a", "-n", std::to_string(99+10*job), javaTool};
+    xvfbCommand.insert(xvfbCommand.end(), hamConvertCommand.begin(), hamConvertCommand.end());
+    ExternalToolDriver::runTool(options, xvfbTool, xvfbCommand, info+" with xvfb-run");
   } else {
     // with java only (reports error if not installed)
-    ExternalToolDriver::runTool(options, javaTool, hamConvertCommand, "ham_convert (converting PNG frames to IFF/ILBM frames)");
+    ExternalToolDriver::runTool(options, javaTool, hamConvertCommand, info);
+  }
+}
+
+void ExternalToolDriver::runHamConvert(Options& options) {
+  if(options.hcPath=="") {
+    throw AGAConvException(76, options.colorMode+" conversion requested, but 'hc_path' not set. Cannot find ham_convert. Exiting.");
+  }
+  std::vector<std::string> batchFileLines;
+  std::regex frameFileRegex("frame[0-9]+");
+  for (auto const& dir_entry : std::filesystem::directory_iterator{options.getTmpDirName()})  {
+    stringstream ss;
+    std::filesystem::path filePath=dir_entry.path();
+    string fileName=filePath.stem();
+    string fileExt=filePath.extension();
+    string extension="png";
+    if(std::regex_match(fileName, frameFileRegex) && fileExt==("."+extension)) {
+      ss<<dir_entry;
+      batchFileLines.push_back(ss.str());
+    }
+  }
+  std::sort(batchFileLines.begin(), batchFileLines.end());
+
+  // Each ham_convert instance (JVM) converts a consecutive range of frames listed in its own batch file.
+  // All instances write their IFF files into the tmp dir, hence, the converted frames form one sequence again.
+  size_t jobs=std::max<size_t>(1, std::min<size_t>(options.hcJobs, batchFileLines.size()));
+  vector<std::future<void>> hamConverts;
+  for(size_t job=0;job<jobs;job++) {
+    std::filesystem::path batchFileName=hamConvertBatchFileName(options, job, jobs);
+    ofstream batchFile;
+    batchFile.open(batchFileName, ios::out | ios::binary);
+    if(!batchFile.is_open()) {
+      // The stopped JVMs fail, their errors are superseded by this one
+      terminateRunningTools();
+      for(auto& hamConvert : hamConverts)
+        hamConvert.wait();
+      throw AGAConvException(77, "could not open batch file "+batchFileName.string());
+    }
+    size_t first=batchFileLines.size()*job/jobs;
+    size_t last=batchFileLines.size()*(job+1)/jobs;
+    for(size_t i=first;i<last;i++) {
+      batchFile<<batchFileLines[i]<<endl;
+    }
+    batchFile.close();
+    string info="ham_convert (converting PNG frames to IFF/ILBM frames";
+    if(jobs>1)
+      info+=", instance "+std::to_string(job+1)+"/"+std::to_string(jobs)+" with "+std::to_string(last-first)+" frames";
+    info+=")";
+    hamConverts.push_back(std::async(std::launch::async, [this, &options, batchFileName, info, job]() { runHamConvertJVM(options, batchFileName, info, job); }));
   }
+  waitForAllTools(hamConverts);
 
   CDXLEncode stage;
   std::filesystem::path inFileWithPath=options.getTmpDirName()/
@@ -1,32 +1,114 @@
 #ifndef EXTERNAL_TOOL_DRIVER_HPP
 #define EXTERNAL_TOOL_DRIVER_HPP
 
+#include <cstdio>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <vector>
 #include "CDXLEncode.hpp"
 #include "Options.hpp"
 #include "OSLayer.hpp"
+#include "ProcessRunner.hpp"
 
 namespace AGAConv {
 
+class FFmpegProgress;
+
 class ExternalToolDriver {
 public:
   ExternalToolDriver();
-  void checkCommandProcessor();
+  // Extracts audio data and frames (two concurrently running ffmpeg processes)
   void runFFMPEGExtraction(const Options& options);
+  // Extracts audio data and encodes frames streamed from ffmpeg (no frame files in tmp dir)
+  void runFFMPEGPipedConversion(Options& options);
+#ifdef AGACONV_LIBAV
+  // Decodes audio data and frames in-process with libav and encodes the frames (falls back to
+  // the piped conversion with ffmpeg if libav cannot decode the input and the decoder is 'auto')
+  void runLibavConversion(Options& options);
+#endif
+  // Encodes PNG frames while ffmpeg is still extracting frames
+  void runFFMPEGOverlappedConversion(Options& options);
+  // Generates the output file and all output variants from the same decoded and scaled frames
+  void runFFMPEGVariantsConversion(Options& options);
   void runHamConvert(Options& options);
-  void prepareTmpDir(const Options& options); // Modifies tmpDir if necessary
+  void prepareTmpDir(Options& options); // Modifies tmpDir if necessary
   void finalizeTmpDir(const Options& options);
-  void runTool(const Options& options, const std::string& tool, const std::string& commandLine, const std::string& info);
+  void runTool(const Options& options, const std::string& tool, const std::vector<std::string>& arguments, const std::string& info);
+  // Terminates all running tools. No tool is started anymore afterwards.
+  void terminateRunningTools();
 private:
+  void runFFMPEGAudioAndVideoExtraction(const Options& options);
+  // Options that determine the extracted files (key of the extraction cache)
+  std::string extractionSettings(const Options& options);
+  // Frequency, audio mode, and resampler (identical settings result in identical audio files)
+  std::string audioSettings(const Options& options);
   void runFFMPEGAudioExtraction(const Options& options);
-  void runFFMPEGVideoExtraction(const Options& options);
-  void runFFMPEG(const Options& options, const std::string& ffmpegCommandLine, const std::string& info);
+  // With atomicFrameFiles a frame file becomes visible only once it is completely written
+  // With several output groups one ffmpeg process generates frames for each group (in the tmp dir of each group)
+  void runFFMPEGVideoExtraction(const Options& options, bool atomicFrameFiles, const std::vector<const Options*>& outputGroups={});
+  // Range of frames extracted by one ffmpeg process (numFrames=0: all remaining frames)
+  struct ExtractionSegment {
+    uint32_t firstFrame=0;
+    uint32_t numFrames=0;
+  };
+  std::vector<ExtractionSegment> extractionSegments(const Options& options, uint32_t totalFrames);
+  std::vector<std::string> ffmpegVideoExtractionCommand(const Options& options, bool atomicFrameFiles, ExtractionSegment segment, const std::vector<const Options*>& outputGroups);
+  void appendFrameOutputOptions(std::vector<std::string>& videoCommand, const Options& options, bool atomicFrameFiles, ExtractionSegment segment);
+  // Reports progress of ffmpeg to progress (with id progressId) if not null
+  void runFFMPEG(const Options& options, const std::vector<std::string>& arguments, const std::string& info, FFmpegProgress* progress=nullptr, std::size_t progressId=0);
+  std::vector<std::string> ffmpegVerbosity(const Options& options);
+  std::string ffmpegVideoFilter(const Options& options, const std::string& heightString);
+  // Frame rate and scaling (shared by all output variants)
+  std::string ffmpegScaleFilter(const Options& options, const std::string& heightString);
+  // Palette generation and conversion to paletted frames, labelSuffix makes the labels of the filter graph unique
+  std::string ffmpegPaletteFilter(const Options& options, const std::string& labelSuffix);
+  std::string ffmpegMultiOutputVideoFilter(const std::vector<const Options*>& outputGroups);
+  std::string ffmpegHeightExpression(const Options& options);
+  // Computes the height ffmpeg uses for scaling (requires ffprobe in height 'auto' mode)
+  uint32_t scaledVideoHeight(const Options& options);
+  void probeVideoDimensions(const Options& options, uint32_t& width, uint32_t& height);
+  // Returns 0 if the duration cannot be determined
+  double probeVideoDuration(const Options& options);
+  // Number of frames of the converted segment. Returns 0 if the number of frames cannot be determined
+  uint32_t expectedNumberOfFrames(const Options& options);
+  // Time of a number of frames in seconds
+  std::string ffmpegTime(const Options& options, uint32_t frames);
+  // Input seeking to frame frameOffset of the converted segment
+  std::vector<std::string> ffmpegSeekOptions(const Options& options, uint32_t frameOffset);
+  bool showProgress(const Options& options);
+  void runToolProcess(const Options& options, std::shared_ptr<ProcessRunner> process, const std::string& info);
+  // A started tool is registered as running until finishTool is called (throws if the tool failed)
+  void startTool(const Options& options, std::shared_ptr<ProcessRunner> process, const std::string& info);
+  void finishTool(std::shared_ptr<ProcessRunner> process);
+  std::string runToolAndReadOutput(const Options& options, const std::string& tool, const std::vector<std::string>& arguments, const std::string& info);
+  // Batch file of ham_convert instance job (of jobs instances)
+  std::filesystem::path hamConvertBatchFileName(const Options& options, std::size_t job, std::size_t jobs);
+  void runHamConvertJVM(const Options& options, const std::filesystem::path& batchFileName, const std::string& info, std::size_t job);
+  // Waits for tools run in separate threads
+  void waitForAllTools(std::vector<std::future<void>>& toolRuns);
+  // Moves the tmp dir to the RAM disk if it has enough space for all temporary files
+  void selectRamDiskTmpDir(Options& options);
+  // Returns 0 if the size cannot be estimated
+  std::uintmax_t estimatedTmpDirSize(const Options& options);
+  void createTmpDir(const Options& options);
   void removeTmpDir(const Options& options, bool strict);
+  // Removes the tmp dirs of output variant groups (all but the first group) after a failed conversion
+  void removeGroupTmpDirs(const std::vector<const Options*>& outputGroups);
   std::uintmax_t removeFrameFiles(const Options& options, std::string extension);
-  const std::string _quietOptions="-y -hide_banner";
-  const std::string _allQuietOptions=_quietOptions+" "+"-loglevel fatal -nostats";
-  const std::string _frameInfoOptions=_quietOptions+" "+"-loglevel info -nostats";
+  // ffmpeg does not read commands from stdin (several instances may run at the same time)
+  const std::vector<std::string> _quietOptions={"-y", "-nostdin", "-hide_banner"};
+  // Error messages are reported when ffmpeg fails (error output is not shown otherwise)
+  const std::vector<std::string> _allQuietOptions={"-y", "-nostdin", "-hide_banner", "-loglevel", "error", "-nostats"};
+  const std::vector<std::string> _frameInfoOptions={"-y", "-nostdin", "-hide_banner", "-loglevel", "info", "-nostats"};
   std::unique_ptr<OSLayer> _osLayer;
+  std::mutex _runningToolsMutex;
+  std::set<std::shared_ptr<ProcessRunner>> _runningTools;
+  bool _toolsTerminated=false;
 };
 
 } // namespace AGAConv
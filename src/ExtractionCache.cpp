@@ -0,0 +1,194 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "ExtractionCache.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace AGAConv {
+
+const std::string ExtractionCache::completeMarkerFileName="complete";
+const std::string ExtractionCache::tmpEntrySuffix=".incomplete";
+
+// FNV-1a (64 bit)
+static const uint64_t fnvOffsetBasis=14695981039346656037ull;
+static const uint64_t fnvPrime=1099511628211ull;
+
+ExtractionCache::ExtractionCache(const Options& options, const string& extractionSettings):_options(options) {
+  uint64_t hash=hashFile(options.inFileName, fnvOffsetBasis);
+  hash=hashString(extractionSettings, hash);
+  stringstream entryName;
+  entryName<<std::hex<<std::setw(16)<<std::setfill('0')<<hash;
+  _entryDir=options.cacheDirResolved/entryName.str();
+  if(options.verbose>=3) {
+    cout<<"Extraction cache entry: "<<_entryDir<<" (settings: "<<extractionSettings<<")"<<endl;
+  }
+}
+
+uint64_t ExtractionCache::hashString(const string& s, uint64_t hash) {
+  for(unsigned char c : s) {
+    hash^=c;
+    hash*=fnvPrime;
+  }
+  return hash;
+}
+
+uint64_t ExtractionCache::hashFile(const fs::path& fileName, uint64_t hash) {
+  ifstream file(fileName, ios::in | ios::binary);
+  vector<char> buffer(1<<20);
+  while(file) {
+    file.read(buffer.data(), buffer.size());
+    std::streamsize numRead=file.gcount();
+    for(std::streamsize i=0;i<numRead;i++) {
+      hash^=(unsigned char)buffer[i];
+      hash*=fnvPrime;
+    }
+  }
+  return hash;
+}
+
+bool ExtractionCache::isExtractedFile(const fs::path& fileName) {
+  static const std::regex frameFileRegex("frame[0-9]+");
+  return (std::regex_match(fileName.stem().string(), frameFileRegex) && fileName.extension()==".png")
+    || fileName.filename()==_options.getTmpDirSndFileName().filename();
+}
+
+void ExtractionCache::linkOrCopyFile(const fs::path& from, const fs::path& to, std::error_code& ec) {
+  fs::create_hard_link(from, to, ec);
+  if(ec) {
+    ec.clear();
+    fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+  }
+}
+
+bool ExtractionCache::restore() {
+  std::error_code ec;
+  if(!fs::exists(_entryDir/completeMarkerFileName, ec))
+    return false;
+  vector<fs::path> restoredFiles;
+  for(auto const& dirEntry : fs::directory_iterator(_entryDir, ec)) {
+    fs::path fileName=dirEntry.path().filename();
+    if(!isExtractedFile(fileName))
+      continue;
+    linkOrCopyFile(dirEntry.path(), _options.getTmpDirName()/fileName, ec);
+    if(ec)
+      break;
+    restoredFiles.push_back(_options.getTmpDirName()/fileName);
+  }
+  if(ec) {
+    if(_options.verbose>=1) cout<<"Note: could not restore files from extraction cache ("<<ec.message()<<"). Running extraction."<<endl;
+    // Restored files are hard links to the cache entry, the extraction must not write through them
+    std::error_code removeEc;
+    for(auto& restoredFile : restoredFiles)
+      fs::remove(restoredFile, removeEc);
+    return false;
+  }
+  // Most recently used entry (LRU order)
+  fs::last_write_time(_entryDir, fs::file_time_type::clock::now(), ec);
+  if(_options.verbose>=1) cout<<"Restored "<<restoredFiles.size()<<" extracted files from extraction cache "<<_entryDir<<endl;
+  return true;
+}
+
+void ExtractionCache::store() {
+  std::error_code ec;
+  fs::path tmpEntryDir=_entryDir.string()+tmpEntrySuffix+"-"+_options.getTmpDirName().filename().string();
+  fs::create_directories(tmpEntryDir, ec);
+  uint32_t numFiles=0;
+  if(!ec) {
+    for(auto const& dirEntry : fs::directory_iterator(_options.getTmpDirName(), ec)) {
+      fs::path fileName=dirEntry.path().filename();
+      if(!isExtractedFile(fileName))
+        continue;
+      linkOrCopyFile(dirEntry.path(), tmpEntryDir/fileName, ec);
+      if(ec)
+        break;
+      numFiles++;
+    }
+  }
+  if(!ec) {
+    ofstream marker(tmpEntryDir/completeMarkerFileName);
+    if(!marker)
+      ec=std::make_error_code(std::errc::io_error);
+  }
+  if(!ec) {
+    // Another instance may have stored the same entry in the meantime, then the existing entry is kept
+    fs::rename(tmpEntryDir, _entryDir, ec);
+  }
+  if(ec) {
+    if(!fs::exists(_entryDir/completeMarkerFileName) && _options.verbose>=1)
+      cout<<"Note: could not store extracted files in extraction cache ("<<ec.message()<<")."<<endl;
+    fs::remove_all(tmpEntryDir, ec);
+    return;
+  }
+  if(_options.verbose>=2) cout<<"Stored "<<numFiles<<" extracted files in extraction cache "<<_entryDir<<endl;
+  evictLeastRecentlyUsedEntries();
+}
+
+uintmax_t ExtractionCache::entrySize(const fs::path& entryDir) {
+  std::error_code ec;
+  uintmax_t size=0;
+  for(auto const& dirEntry : fs::directory_iterator(entryDir, ec)) {
+    uintmax_t fileSize=dirEntry.file_size(ec);
+    if(!ec)
+      size+=fileSize;
+  }
+  return size;
+}
+
+void ExtractionCache::evictLeastRecentlyUsedEntries() {
+  struct CacheEntry {
+    fs::path dir;
+    fs::file_time_type lastUsed;
+    uintmax_t size;
+  };
+  vector<CacheEntry> entries;
+  uintmax_t totalSize=0;
+  std::error_code ec;
+  for(auto const& dirEntry : fs::directory_iterator(_options.cacheDirResolved, ec)) {
+    // Incomplete entries of other running instances are neither counted nor evicted
+    if(!dirEntry.is_directory(ec) || !fs::exists(dirEntry.path()/completeMarkerFileName, ec))
+      continue;
+    CacheEntry entry={dirEntry.path(), fs::last_write_time(dirEntry.path(), ec), entrySize(dirEntry.path())};
+    totalSize+=entry.size;
+    entries.push_back(entry);
+  }
+  std::sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b) { return a.lastUsed<b.lastUsed; });
+  const uintmax_t maxSize=(uintmax_t)_options.cacheSize<<20;
+  for(auto& entry : entries) {
+    if(totalSize<=maxSize)
+      break;
+    // The entry of this conversion is kept (even if it exceeds the cache size on its own)
+    if(entry.dir==_entryDir)
+      continue;
+    fs::remove_all(entry.dir, ec);
+    if(ec)
+      continue;
+    totalSize-=entry.size;
+    if(_options.verbose>=2) cout<<"Evicted extraction cache entry "<<entry.dir<<endl;
+  }
+}
+
+} // namespace AGAConv
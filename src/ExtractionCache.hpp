@@ -0,0 +1,66 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef EXTRACTION_CACHE_HPP
+#define EXTRACTION_CACHE_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include "Options.hpp"
+
+namespace AGAConv {
+
+/* Persistent cache of the files extracted by ffmpeg (PNG frames and
+   audio track) across runs. An entry is a directory in the cache
+   dir. Its name is a hash of the input file's contents and of the
+   extraction settings (all ffmpeg options that determine the
+   extracted data). Settings that only affect the CDXL encoding
+   (e.g. format, padding) are not part of the key, hence, a video
+   can be re-encoded with those settings without running ffmpeg
+   again. The total size of the cache is bounded, least recently
+   used entries are evicted first. Failures of the cache are reported
+   as notes and never abort a conversion.
+ */
+class ExtractionCache {
+
+ public:
+  ExtractionCache(const Options& options, const std::string& extractionSettings);
+  // Copies (or links) the cached files into the tmp dir. Returns false if no entry exists
+  // or the entry cannot be restored completely (no restored file is left in the tmp dir then).
+  bool restore();
+  // Stores the extracted files of the tmp dir as new entry and evicts old entries.
+  void store();
+
+ private:
+  static uint64_t hashFile(const std::filesystem::path& fileName, uint64_t hash);
+  static uint64_t hashString(const std::string& s, uint64_t hash);
+  bool isExtractedFile(const std::filesystem::path& fileName);
+  // Hard link if possible (same file system), copy otherwise
+  static void linkOrCopyFile(const std::filesystem::path& from, const std::filesystem::path& to, std::error_code& ec);
+  static std::uintmax_t entrySize(const std::filesystem::path& entryDir);
+  void evictLeastRecentlyUsedEntries();
+  const Options& _options;
+  std::filesystem::path _entryDir;
+  static const std::string completeMarkerFileName;
+  static const std::string tmpEntrySuffix;
+};
+
+} // namespace AGAConv
+
+#endif
@@ -0,0 +1,109 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "FFmpegProgress.hpp"
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+namespace AGAConv {
+
+FFmpegProgress::FFmpegProgress(const string& info, uint32_t expectedFrames, bool display)
+  :_info(info),_expectedFrames(expectedFrames),_display(display) {
+  _startTime=std::chrono::steady_clock::now();
+  _lastDisplayTime=_startTime;
+}
+
+void FFmpegProgress::processProgressLine(size_t progressId, const string& line) {
+  // Only the frame number is used, all other keys are ignored (e.g. fps, out_time_us, progress=continue|end)
+  const string frameKey="frame=";
+  if(line.compare(0, frameKey.size(), frameKey)!=0)
+    return;
+  uint32_t frame=0;
+  try {
+    frame=(uint32_t)std::stoul(line.substr(frameKey.size()));
+  } catch(...) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(_mutex);
+  _frames[progressId]=frame;
+  if(_display) {
+    auto now=std::chrono::steady_clock::now();
+    if(std::chrono::duration<double>(now-_lastDisplayTime).count()>=displayIntervalSeconds) {
+      _lastDisplayTime=now;
+      _displayed=true;
+      cout<<"\r"<<_info<<": "<<toString()<<"   "<<flush;
+    }
+  }
+}
+
+void FFmpegProgress::finish() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if(_displayed) {
+    cout<<"\r"<<_info<<": "<<toString()<<"   "<<endl;
+    _displayed=false;
+  }
+}
+
+uint32_t FFmpegProgress::sumFrames() {
+  uint32_t frames=0;
+  for(auto& entry : _frames)
+    frames+=entry.second;
+  return frames;
+}
+
+double FFmpegProgress::elapsedSeconds() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now()-_startTime).count();
+}
+
+uint32_t FFmpegProgress::getFrames() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return sumFrames();
+}
+
+double FFmpegProgress::getFramesPerSecond() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  double seconds=elapsedSeconds();
+  return seconds>0.0?sumFrames()/seconds:0.0;
+}
+
+string FFmpegProgress::formatSeconds(double seconds) {
+  uint32_t s=(uint32_t)(seconds+0.5);
+  stringstream ss;
+  ss<<s/60<<":"<<std::setw(2)<<std::setfill('0')<<s%60;
+  return ss.str();
+}
+
+string FFmpegProgress::toString() {
+  uint32_t frames=sumFrames();
+  double seconds=elapsedSeconds();
+  double fps=seconds>0.0?frames/seconds:0.0;
+  stringstream ss;
+  ss<<"frame "<<frames;
+  if(_expectedFrames>0)
+    ss<<"/"<<_expectedFrames;
+  ss<<" ("<<std::fixed<<std::setprecision(1)<<fps<<" fps";
+  if(_expectedFrames>0 && fps>0.0 && frames<=_expectedFrames)
+    ss<<", ETA "<<formatSeconds((_expectedFrames-frames)/fps);
+  ss<<")";
+  return ss.str();
+}
+
+} // namespace AGAConv
@@ -0,0 +1,66 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef FFMPEG_PROGRESS_HPP
+#define FFMPEG_PROGRESS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace AGAConv {
+
+/* Collects the progress reported by one or more ffmpeg processes
+   (ffmpeg option '-progress', key=value lines) and computes the
+   number of processed frames, frames per second, and the estimated
+   remaining time. If display is enabled, the progress is shown in
+   one line that is updated in place (for terminals).
+ */
+class FFmpegProgress {
+
+ public:
+  // expectedFrames=0: unknown (no ETA)
+  FFmpegProgress(const std::string& info, uint32_t expectedFrames, bool display);
+  // Called by the progress reader of process progressId for each line
+  void processProgressLine(std::size_t progressId, const std::string& line);
+  // Ends the progress line (if shown)
+  void finish();
+  uint32_t getFrames();
+  double getFramesPerSecond();
+
+ private:
+  uint32_t sumFrames();
+  double elapsedSeconds();
+  std::string formatSeconds(double seconds);
+  // Requires _mutex to be locked
+  std::string toString();
+  std::string _info;
+  uint32_t _expectedFrames;
+  bool _display;
+  bool _displayed=false;
+  std::map<std::size_t,uint32_t> _frames;
+  std::chrono::steady_clock::time_point _startTime;
+  std::chrono::steady_clock::time_point _lastDisplayTime;
+  std::mutex _mutex;
+  static constexpr double displayIntervalSeconds=0.5;
+};
+
+} // namespace AGAConv
+
+#endif
@@ -27,11 +27,13 @@
 #include <string>
 
 #include "AGAConvException.hpp"
+#include "FrameFileWatcher.hpp"
 #include "IffCAMGChunk.hpp"
 #include "IffCMAPChunk.hpp"
 #include "IffILBMChunk.hpp"
 #include "IffUnknownChunk.hpp"
 #include "Options.hpp"
+#include "RawFrameLoader.hpp"
 #include "Util.hpp"
 
 using namespace std;
@@ -112,6 +114,10 @@ void FileSequenceConversion::setInFileWithPath(std::string inFileNameWithPath) {
   initFileName(inFileName);
 }
 
+void FileSequenceConversion::setFrameFileWatcher(FrameFileWatcher* frameFileWatcherIn) {
+  frameFileWatcher=frameFileWatcherIn;
+}
+
 void FileSequenceConversion::run(Options& optionsIn) {
   options=optionsIn;
   assert(inFileName!=""); // required to be set before run is called
@@ -121,8 +127,12 @@ void FileSequenceConversion::run(Options& optionsIn) {
   IffILBMChunk* lastILBMChunk=nullptr;
   while(true) {
     if(options.debug) cout<<"DEBUG: Reading "<<inFileName<<endl;
-    if(!Util::fileExists(inFileName))
+    if(frameFileWatcher) {
+      if(!frameFileWatcher->waitForFile(inFileName))
+        break;
+    } else if(!Util::fileExists(inFileName)) {
       break;
+    }
     if(lastILBMChunk) {
       delete lastILBMChunk;
     }
@@ -157,6 +167,31 @@ void FileSequenceConversion::run(Options& optionsIn) {
   delete lastILBMChunk;
 }
 
+void FileSequenceConversion::runFrameStream(Options& optionsIn, FILE* stream, int width, int height) {
+  assert(stream);
+  bool truecolor=optionsIn.nativeQuantizer();
+  runFrameSource(optionsIn, [stream, width, height, truecolor]() {
+    auto frameLoader=std::make_unique<RawFrameLoader>(width,height,truecolor);
+    if(!frameLoader->readFrame(stream))
+      frameLoader.reset();
+    return frameLoader;
+  });
+}
+
+void FileSequenceConversion::runFrameSource(Options& optionsIn, FrameSource frameSource) {
+  options=optionsIn;
+  frames=0;
+  preVisitFirstFrame();
+  while(auto frameLoader=frameSource()) {
+    visitRawFrame(std::move(frameLoader));
+    frames++;
+  }
+  if(frames==0) {
+    throw AGAConvException(66, "no frames received from frame stream.");
+  }
+  postVisitLastILBMChunk(nullptr);
+}
+
 void FileSequenceConversion::preVisitFirstFrame() {
   // empty by default
 }
@@ -175,6 +210,13 @@ void FileSequenceConversion::visitPngFile(std::string pngFileName) {
   }
 }
 
+void FileSequenceConversion::visitRawFrame(std::unique_ptr<RawFrameLoader> frameLoader) {
+  if(options.debug) {
+    cout<<"stream frame "<<frames+1;
+    cout<<endl;
+  }
+}
+
 void FileSequenceConversion::postVisitLastILBMChunk(IffILBMChunk* ilbmChunk) {
   if(ilbmChunk) {
     if(IffBMHDChunk* bmhdChunk=dynamic_cast<IffBMHDChunk*>(ilbmChunk->getChunkByName("BMHD"))) {
@@ -19,7 +19,10 @@
 #ifndef FILE_SEQUENCE_CONVERSION_HPP
 #define FILE_SEQUENCE_CONVERSION_HPP
 
+#include <cstdio>
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
 
 #include "AGAConvException.hpp"
@@ -29,6 +32,9 @@
 
 namespace AGAConv {
 
+class FrameFileWatcher;
+class RawFrameLoader;
+
 /* Read a sequence of iff files and allow to operate on each
    file. Each file is read in as ILBM chunk data structure with access
    functions to each chunk's information. This allows to implement
@@ -53,9 +59,23 @@ class FileSequenceConversion : public Stage {
   
   virtual void visitPngFile(std::string inFileName);
 
+  // reads raw paletted (or truecolor, with the native quantizer)
+  // frames of fixed size from a stream (e.g. a pipe from ffmpeg)
+  // instead of a sequence of files.
+  void runFrameStream(Options& opt, std::FILE* stream, int width, int height);
+  // returns the next frame, or nullptr after the last frame.
+  typedef std::function<std::unique_ptr<RawFrameLoader>()> FrameSource;
+  // reads raw frames from a frame source (e.g. an in-process decoder).
+  virtual void runFrameSource(Options& opt, FrameSource frameSource);
+  // the visitor takes ownership of the frame
+  virtual void visitRawFrame(std::unique_ptr<RawFrameLoader> frameLoader);
+
   // sets in file name with full path. File must be set, otherwise
   // conversion aborts.
   void setInFileWithPath(std::string inFileWithPath);
+  // files are consumed while they are being produced (by default
+  // all files must exist when run is called). The watcher is not owned.
+  void setFrameFileWatcher(FrameFileWatcher* frameFileWatcher);
   enum FileType { FILE_UNKNOWN, FILE_PNG, FILE_IFF };
   FileType determineFileType(std::string inFileName);
  protected:
@@ -71,6 +91,7 @@ class FileSequenceConversion : public Stage {
   std::string inFileName; // state variable
   std::string firstInFileName;
   std::string lastInFileName;
+  FrameFileWatcher* frameFileWatcher=nullptr;
 
  private:
   std::size_t startNumber;
@@ -0,0 +1,243 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "FrameDitherer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <future>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+namespace AGAConv {
+
+// Error diffusion: distance to the current pixel and weight (in 1/16)
+struct DiffusionWeight {
+  int dx;
+  int dy;
+  int weight;
+};
+static const vector<DiffusionWeight> floydSteinbergWeights={{1,0,7},{-1,1,3},{0,1,5},{1,1,1}};
+static const vector<DiffusionWeight> sierra2Weights={{1,0,4},{2,0,3},{-2,1,1},{-1,1,2},{0,1,3},{1,1,2},{2,1,1}};
+static const vector<DiffusionWeight> sierraLiteWeights={{1,0,8},{-1,1,4},{0,1,4}};
+
+static int clampColor(int value) {
+  return std::min(255,std::max(0,value));
+}
+
+static int roundedError(int error) {
+  return (error>=0?error+8:error-8)/16;
+}
+
+FrameDitherer::FrameDitherer(const NearestColorIndex& paletteIndex, DitherMethod method, uint32_t bayerScale):
+  _method(method),
+  _bayerScale(bayerScale),
+  _paletteIndex(paletteIndex) {
+  assert(bayerScale<=maxBayerScale);
+}
+
+bool FrameDitherer::parseDitherMode(const string& ditherMode, uint32_t defaultBayerScale, DitherMethod& method, uint32_t& bayerScale) {
+  bayerScale=defaultBayerScale;
+  if(ditherMode=="none") {
+    method=DM_NONE;
+  } else if(ditherMode=="floyd_steinberg") {
+    method=DM_FLOYD_STEINBERG;
+  } else if(ditherMode=="sierra2") {
+    method=DM_SIERRA2;
+  } else if(ditherMode=="sierra2_4a") {
+    method=DM_SIERRA_LITE;
+  } else if(ditherMode=="bayer") {
+    method=DM_BAYER;
+  } else if(ditherMode.size()==19 && ditherMode.compare(0,18,"bayer:bayer_scale=")==0 && ditherMode[18]>='0' && ditherMode[18]<='9') {
+    method=DM_BAYER;
+    bayerScale=(uint32_t)(ditherMode[18]-'0');
+  } else {
+    return false;
+  }
+  return bayerScale<=maxBayerScale;
+}
+
+void FrameDitherer::dither(UBYTE** rows, int width, int height, int bytesPerPixel, UBYTE** indexRows, unsigned threads) {
+  assert(bytesPerPixel==3 || bytesPerPixel==4);
+  int numBands=(height+bandHeight-1)/bandHeight;
+  auto ditherBands=[this, rows, width, height, bytesPerPixel, indexRows, numBands](int firstBand, int bandStep) {
+    for(int band=firstBand;band<numBands;band+=bandStep) {
+      int firstRow=band*bandHeight;
+      int endRow=std::min(height,firstRow+bandHeight);
+      switch(_method) {
+      case DM_NONE:
+        mapBand(rows, width, firstRow, endRow, bytesPerPixel, indexRows);
+        break;
+      case DM_FLOYD_STEINBERG:
+      case DM_SIERRA2:
+      case DM_SIERRA_LITE:
+        diffuseErrorInBand(rows, width, firstRow, endRow, bytesPerPixel, indexRows);
+        break;
+      case DM_BAYER:
+        orderedDitherBand(rows, width, firstRow, endRow, bytesPerPixel, indexRows);
+        break;
+      }
+    }
+  };
+  int numThreads=std::max(1,std::min((int)threads,numBands));
+  vector<future<void>> workers;
+  for(int thread=1;thread<numThreads;thread++) {
+    workers.push_back(std::async(std::launch::async, ditherBands, thread, numThreads));
+  }
+  ditherBands(0, numThreads);
+  for(auto& worker : workers) {
+    worker.get();
+  }
+}
+
+FrameDitherer::NearestColorCache::NearestColorCache():
+  _entries(1<<cacheBits) {
+}
+
+FrameDitherer::NearestColorCache::Entry& FrameDitherer::NearestColorCache::entry(uint32_t color) {
+  // Fibonacci hashing of the 24 bit color
+  return _entries[(color*2654435761u)>>(32-cacheBits)];
+}
+
+int FrameDitherer::nearestColorIndex(int r, int g, int b, NearestColorCache& cache) const {
+  uint32_t color=((uint32_t)r<<16)|((uint32_t)g<<8)|(uint32_t)b;
+  NearestColorCache::Entry& entry=cache.entry(color);
+  if(entry.color!=color) {
+    entry.color=color;
+    entry.index=_paletteIndex.nearestColorIndex(r, g, b);
+  }
+  return entry.index;
+}
+
+void FrameDitherer::mapBand(UBYTE** rows, int width, int firstRow, int endRow, int bytesPerPixel, UBYTE** indexRows) const {
+  NearestColorCache cache;
+  for(int y=firstRow;y<endRow;y++) {
+    UBYTE* pixel=rows[y];
+    UBYTE* index=indexRows[y];
+    for(int x=0;x<width;x++) {
+      index[x]=(UBYTE)nearestColorIndex(pixel[0], pixel[1], pixel[2], cache);
+      pixel+=bytesPerPixel;
+    }
+  }
+}
+
+void FrameDitherer::diffuseErrorInBand(UBYTE** rows, int width, int firstRow, int endRow, int bytesPerPixel, UBYTE** indexRows) const {
+  const vector<DiffusionWeight>* weights=&floydSteinbergWeights;
+  if(_method==DM_SIERRA2)
+    weights=&sierra2Weights;
+  else if(_method==DM_SIERRA_LITE)
+    weights=&sierraLiteWeights;
+  // Accumulated error (in 1/16) of each color component in the current and the next row, with a border
+  // of 2 pixels on each side for the weights outside of the frame
+  const int border=2;
+  vector<int> currentErrors((width+2*border)*3, 0);
+  vector<int> nextErrors((width+2*border)*3, 0);
+  NearestColorCache cache;
+  for(int y=firstRow;y<endRow;y++) {
+    UBYTE* pixel=rows[y];
+    UBYTE* index=indexRows[y];
+    for(int x=0;x<width;x++) {
+      int* error=&currentErrors[(x+border)*3];
+      int r=clampColor(pixel[0]+roundedError(error[0]));
+      int g=clampColor(pixel[1]+roundedError(error[1]));
+      int b=clampColor(pixel[2]+roundedError(error[2]));
+      int i=nearestColorIndex(r, g, b, cache);
+      index[x]=(UBYTE)i;
+      int errorRed=r-_paletteIndex.getRed(i);
+      int errorGreen=g-_paletteIndex.getGreen(i);
+      int errorBlue=b-_paletteIndex.getBlue(i);
+      for(auto& weight : *weights) {
+        int* target=&(weight.dy==0?currentErrors:nextErrors)[(x+border+weight.dx)*3];
+        target[0]+=errorRed*weight.weight;
+        target[1]+=errorGreen*weight.weight;
+        target[2]+=errorBlue*weight.weight;
+      }
+      pixel+=bytesPerPixel;
+    }
+    currentErrors.swap(nextErrors);
+    std::fill(nextErrors.begin(), nextErrors.end(), 0);
+  }
+}
+
+int FrameDitherer::bayerValue(int position) {
+  // Value 0..63 of the 8x8 Bayer matrix at position (y*8+x), computed as in ffmpeg's paletteuse
+  int q=position^(position>>3);
+  return ((position&4)>>2)|((q&4)>>1)|((position&2)<<1)|((q&2)<<2)|((position&1)<<4)|((q&1)<<5);
+}
+
+void FrameDitherer::orderedDitherBand(UBYTE** rows, int width, int firstRow, int endRow, int bytesPerPixel, UBYTE** indexRows) const {
+  NearestColorCache cache;
+  for(int y=firstRow;y<endRow;y++) {
+    // Offsets of 8 consecutive pixels in this row (RGBX), split into a positive and a negative part
+    int offsets[8];
+    UBYTE positiveOffsets[32]={0};
+    UBYTE negativeOffsets[32]={0};
+    for(int i=0;i<8;i++) {
+      offsets[i]=(bayerValue(((y&7)<<3)|i)>>_bayerScale)-(1<<(maxBayerScale-_bayerScale));
+      for(int c=0;c<3;c++) {
+        positiveOffsets[i*4+c]=(UBYTE)std::max(0,offsets[i]);
+        negativeOffsets[i*4+c]=(UBYTE)std::max(0,-offsets[i]);
+      }
+    }
+    UBYTE* index=indexRows[y];
+    int x=0;
+    if(bytesPerPixel==4) {
+      UBYTE biasedPixels[32];
+      for(;x+8<=width;x+=8) {
+        addOrderedDitherOffsets(rows[y]+x*4, positiveOffsets, negativeOffsets, biasedPixels);
+        for(int i=0;i<8;i++) {
+          index[x+i]=(UBYTE)nearestColorIndex(biasedPixels[i*4], biasedPixels[i*4+1], biasedPixels[i*4+2], cache);
+        }
+      }
+    }
+    for(;x<width;x++) {
+      UBYTE* pixel=rows[y]+x*bytesPerPixel;
+      int offset=offsets[x&7];
+      index[x]=(UBYTE)nearestColorIndex(clampColor(pixel[0]+offset), clampColor(pixel[1]+offset), clampColor(pixel[2]+offset), cache);
+    }
+  }
+}
+
+void FrameDitherer::addOrderedDitherOffsets(const UBYTE* pixels, const UBYTE* positiveOffsets, const UBYTE* negativeOffsets, UBYTE* result) {
+#if defined(__SSE2__)
+  for(int i=0;i<32;i+=16) {
+    __m128i p=_mm_loadu_si128((const __m128i*)(pixels+i));
+    p=_mm_adds_epu8(p, _mm_loadu_si128((const __m128i*)(positiveOffsets+i)));
+    p=_mm_subs_epu8(p, _mm_loadu_si128((const __m128i*)(negativeOffsets+i)));
+    _mm_storeu_si128((__m128i*)(result+i), p);
+  }
+#elif defined(__ARM_NEON)
+  for(int i=0;i<32;i+=16) {
+    uint8x16_t p=vld1q_u8(pixels+i);
+    p=vqaddq_u8(p, vld1q_u8(positiveOffsets+i));
+    p=vqsubq_u8(p, vld1q_u8(negativeOffsets+i));
+    vst1q_u8(result+i, p);
+  }
+#else
+  for(int i=0;i<32;i++) {
+    result[i]=(UBYTE)clampColor((int)pixels[i]+positiveOffsets[i]-negativeOffsets[i]);
+  }
+#endif
+}
+
+} // namespace AGAConv
@@ -0,0 +1,88 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAME_DITHERER_HPP
+#define FRAME_DITHERER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "AmigaTypeDefs.hpp"
+#include "NearestColorIndex.hpp"
+
+namespace AGAConv {
+
+/* Maps the pixels of a truecolor frame to the colors of a given
+   palette, optionally with dithering (in-process replacement of
+   ffmpeg's paletteuse). Supported are the error diffusion methods
+   Floyd-Steinberg, Sierra-2 and Sierra-lite (ffmpeg: sierra2_4a),
+   and ordered dithering with an 8x8 Bayer matrix (same offsets as
+   ffmpeg's bayer mode with bayer_scale).
+   The palette must be given with the colors that are finally stored
+   in the CDXL file (i.e. for 12 bit palettes with 4-bit color
+   components), such that the diffused error is the error of the
+   displayed colors.
+   The frame is processed in bands of rows which are dithered in
+   parallel. Error diffusion starts with zero error in each band,
+   the result does not depend on the number of threads.
+ */
+class FrameDitherer {
+
+ public:
+  enum DitherMethod { DM_NONE, DM_FLOYD_STEINBERG, DM_SIERRA2, DM_SIERRA_LITE, DM_BAYER };
+  // The palette is given by its nearest color index
+  FrameDitherer(const NearestColorIndex& paletteIndex, DitherMethod method, uint32_t bayerScale);
+  // Parses an ffmpeg dither mode string (e.g. "floyd_steinberg" or "bayer:bayer_scale=3"). If no bayer scale
+  // is given, defaultBayerScale is used. Returns false for dither modes not supported by the native dithering.
+  static bool parseDitherMode(const std::string& ditherMode, uint32_t defaultBayerScale, DitherMethod& method, uint32_t& bayerScale);
+  // Pixel data is given as rows of bytesPerPixel bytes per pixel (RGB, followed by an ignored byte if bytesPerPixel is 4).
+  // Writes one palette index per pixel into indexRows.
+  void dither(UBYTE** rows, int width, int height, int bytesPerPixel, UBYTE** indexRows, unsigned threads);
+
+ private:
+  static const int bandHeight=64;
+  static const int maxBayerScale=5;
+  // Direct mapped cache of nearest palette colors (avoids index lookups for repeated colors), one per band (thread)
+  class NearestColorCache {
+  public:
+    struct Entry {
+      uint32_t color=0xFFFFFFFF; // no 24 bit color
+      int index=0;
+    };
+    NearestColorCache();
+    Entry& entry(uint32_t color);
+  private:
+    static const int cacheBits=12;
+    std::vector<Entry> _entries;
+  };
+  int nearestColorIndex(int r, int g, int b, NearestColorCache& cache) const;
+  void mapBand(UBYTE** rows, int width, int firstRow, int endRow, int bytesPerPixel, UBYTE** indexRows) const;
+  void diffuseErrorInBand(UBYTE** rows, int width, int firstRow, int endRow, int bytesPerPixel, UBYTE** indexRows) const;
+  void orderedDitherBand(UBYTE** rows, int width, int firstRow, int endRow, int bytesPerPixel, UBYTE** indexRows) const;
+  // Adds the signed offsets (given as a positive and a negative part) to 32 color bytes with saturation
+  static void addOrderedDitherOffsets(const UBYTE* pixels, const UBYTE* positiveOffsets, const UBYTE* negativeOffsets, UBYTE* result);
+  static int bayerValue(int position);
+  DitherMethod _method;
+  uint32_t _bayerScale;
+  const NearestColorIndex& _paletteIndex;
+};
+
+} // namespace AGAConv
+
+#endif
@@ -0,0 +1,89 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "FrameFileWatcher.hpp"
+
+#include <chrono>
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace AGAConv {
+
+FrameFileWatcher::FrameFileWatcher(std::filesystem::path dir):_dir(dir) {
+#ifdef __linux__
+  _inotifyFd=inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+  if(_inotifyFd>=0) {
+    if(inotify_add_watch(_inotifyFd, _dir.c_str(), IN_MOVED_TO|IN_CLOSE_WRITE)<0) {
+      close(_inotifyFd);
+      _inotifyFd=-1;
+    }
+  }
+#endif
+}
+
+FrameFileWatcher::~FrameFileWatcher() {
+#ifdef __linux__
+  if(_inotifyFd>=0)
+    close(_inotifyFd);
+#endif
+}
+
+bool FrameFileWatcher::usesFileSystemEvents() const {
+  return _inotifyFd>=0;
+}
+
+void FrameFileWatcher::setProducerFinished() {
+  _producerFinished=true;
+}
+
+bool FrameFileWatcher::waitForFile(const std::filesystem::path& fileName) {
+  while(true) {
+    // The flag must be read before the file is checked. Otherwise a file created just before the
+    // producer finished could be missed.
+    bool producerFinished=_producerFinished;
+    if(std::filesystem::exists(fileName))
+      return true;
+    if(producerFinished)
+      return false;
+    waitForDirectoryChange();
+  }
+}
+
+void FrameFileWatcher::waitForDirectoryChange() {
+#ifdef __linux__
+  if(_inotifyFd>=0) {
+    struct pollfd pfd={_inotifyFd, POLLIN, 0};
+    if(poll(&pfd, 1, maxWaitMilliSeconds)>0) {
+      // Drain all pending events, only the wakeup matters
+      char buffer[4096];
+      while(read(_inotifyFd, buffer, sizeof(buffer))>0)
+        ;
+    }
+    return;
+  }
+#endif
+  std::this_thread::sleep_for(std::chrono::milliseconds(maxWaitMilliSeconds/5));
+}
+
+} // namespace AGAConv
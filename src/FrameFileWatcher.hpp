@@ -0,0 +1,55 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef FRAME_FILE_WATCHER_HPP
+#define FRAME_FILE_WATCHER_HPP
+
+#include <atomic>
+#include <filesystem>
+
+namespace AGAConv {
+
+/* Allows to consume frame files while they are still being produced
+   by an external tool running in another thread. The producer must
+   make a frame file visible only once it is complete (ffmpeg option
+   '-atomic_writing 1' writes a tmp file and renames it). On Linux the
+   watcher sleeps on inotify events of the directory, on other systems
+   (or if inotify is not available) the directory is polled.
+ */
+class FrameFileWatcher {
+
+ public:
+  FrameFileWatcher(std::filesystem::path dir);
+  ~FrameFileWatcher();
+  //! Blocks until the file exists (returns true) or the producer finished without creating it (returns false).
+  bool waitForFile(const std::filesystem::path& fileName);
+  //! Called by the producer when no more files are created (on success and on failure).
+  void setProducerFinished();
+  bool usesFileSystemEvents() const;
+
+ private:
+  void waitForDirectoryChange();
+  std::filesystem::path _dir;
+  std::atomic<bool> _producerFinished=false;
+  int _inotifyFd=-1;
+  // Upper bound of a wait, the producer does not notify the watcher when it finishes
+  static const int maxWaitMilliSeconds=50;
+};
+
+} // namespace AGAConv
+
+#endif
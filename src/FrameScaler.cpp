@@ -0,0 +1,342 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "FrameScaler.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <future>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define AGACONV_SCALER_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace AGAConv {
+
+static const double pi=3.14159265358979323846;
+
+static double sinc(double x) {
+  if(x==0.0)
+    return 1.0;
+  return std::sin(pi*x)/(pi*x);
+}
+
+bool FrameScaler::parseScaleFilter(const string& name, ScaleFilter& filter) {
+  if(name=="lanczos") {
+    filter=SF_LANCZOS;
+  } else if(name=="bicubic") {
+    filter=SF_BICUBIC;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+FrameScaler::FrameScaler(int inWidth, int inHeight, int outWidth, int outHeight, ScaleFilter filter):
+  _inWidth(inWidth),
+  _inHeight(inHeight),
+  _outWidth(outWidth),
+  _outHeight(outHeight),
+  _horizontalTaps(computeTaps(inWidth, outWidth, filter)),
+  _verticalTaps(computeTaps(inHeight, outHeight, filter)),
+  _useAVX2(isAVX2Supported()) {
+}
+
+bool FrameScaler::isAVX2Supported() {
+#if defined(AGACONV_SCALER_AVX2)
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+bool FrameScaler::hasInputSize(int inWidth, int inHeight) const {
+  return inWidth==_inWidth && inHeight==_inHeight;
+}
+
+int FrameScaler::getOutWidth() const {
+  return _outWidth;
+}
+
+int FrameScaler::getOutHeight() const {
+  return _outHeight;
+}
+
+double FrameScaler::filterRadius(ScaleFilter filter) {
+  return filter==SF_LANCZOS?3.0:2.0;
+}
+
+double FrameScaler::filterValue(ScaleFilter filter, double x) {
+  x=std::fabs(x);
+  if(x>=filterRadius(filter))
+    return 0.0;
+  if(filter==SF_LANCZOS)
+    return sinc(x)*sinc(x/3.0);
+  // Mitchell-Netravali cubic with B=0, C=0.6 (default parameters of ffmpeg's bicubic scaling)
+  const double b=0.0, c=0.6;
+  if(x<1.0)
+    return ((12-9*b-6*c)*x*x*x+(-18+12*b+6*c)*x*x+(6-2*b))/6;
+  return ((-b-6*c)*x*x*x+(6*b+30*c)*x*x+(-12*b-48*c)*x+(8*b+24*c))/6;
+}
+
+FrameScaler::FilterTaps FrameScaler::computeTaps(int inSize, int outSize, ScaleFilter filter) {
+  assert(inSize>0 && outSize>0);
+  FilterTaps taps;
+  double scaleFactor=(double)inSize/outSize;
+  // When downscaling the filter is stretched over the input pixels that are combined into one output pixel
+  double filterScale=std::max(1.0,scaleFactor);
+  double support=filterRadius(filter)*filterScale;
+  taps.numTaps=std::min(inSize,2*(int)std::ceil(support)+1);
+  taps.first.resize(outSize);
+  taps.weights.resize((size_t)outSize*taps.numTaps);
+  vector<double> weights(taps.numTaps);
+  for(int i=0;i<outSize;i++) {
+    double center=(i+0.5)*scaleFactor-0.5;
+    int left=(int)std::floor(center-support)+1;
+    // Taps outside of the input are moved to the border pixels
+    int first=std::min(std::max(left,0),inSize-taps.numTaps);
+    std::fill(weights.begin(), weights.end(), 0.0);
+    double sum=0.0;
+    for(int j=left;j<left+taps.numTaps;j++) {
+      double weight=filterValue(filter, (j-center)/filterScale);
+      weights[std::min(std::max(j,0),inSize-1)-first]+=weight;
+      sum+=weight;
+    }
+    // Normalized fixed point weights, the rounding error is added to the largest weight
+    int16_t* fixedWeights=&taps.weights[(size_t)i*taps.numTaps];
+    int fixedSum=0;
+    int largest=0;
+    for(int k=0;k<taps.numTaps;k++) {
+      fixedWeights[k]=(int16_t)std::lround(weights[k]/sum*(1<<weightBits));
+      fixedSum+=fixedWeights[k];
+      if(fixedWeights[k]>fixedWeights[largest])
+        largest=k;
+    }
+    fixedWeights[largest]=(int16_t)(fixedWeights[largest]+(1<<weightBits)-fixedSum);
+    taps.first[i]=first;
+  }
+  return taps;
+}
+
+void FrameScaler::scaleRowHorizontally(const UBYTE* inRow, int16_t* outRow) const {
+  const int numTaps=_horizontalTaps.numTaps;
+  const int shift=weightBits-intermediateBits;
+  for(int x=0;x<_outWidth;x++) {
+    const UBYTE* pixel=inRow+_horizontalTaps.first[x]*4;
+    const int16_t* weights=&_horizontalTaps.weights[(size_t)x*numTaps];
+    int k=0;
+#if defined(__SSE2__)
+    // Two taps at a time: the channels of both pixels are interleaved and multiplied
+    // with the interleaved weights, madd adds the two products of each channel
+    const __m128i zero=_mm_setzero_si128();
+    __m128i sums=_mm_setzero_si128();
+    for(;k+2<=numTaps;k+=2) {
+      __m128i pixels=_mm_unpacklo_epi8(_mm_cvtsi32_si128(loadPixel(pixel)), _mm_cvtsi32_si128(loadPixel(pixel+4)));
+      __m128i weightPair=_mm_set1_epi32((int)((uint32_t)(uint16_t)weights[k] | ((uint32_t)(uint16_t)weights[k+1]<<16)));
+      sums=_mm_add_epi32(sums, _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weightPair));
+      pixel+=8;
+    }
+    if(k<numTaps) {
+      // Last tap, the second pixel and weight of the pair are zero
+      __m128i channels=_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(loadPixel(pixel)), zero), zero);
+      sums=_mm_add_epi32(sums, _mm_madd_epi16(channels, _mm_set1_epi32((uint16_t)weights[k])));
+    }
+    // Rounding, shift, and saturation to 16 bit (same as the scalar version)
+    sums=_mm_srai_epi32(_mm_add_epi32(sums, _mm_set1_epi32(1<<(shift-1))), shift);
+    _mm_storel_epi64((__m128i*)(outRow+x*4), _mm_packs_epi32(sums, sums));
+#elif defined(__ARM_NEON)
+    int32x4_t sums=vdupq_n_s32(0);
+    for(;k<numTaps;k++) {
+      int16x4_t channels=vreinterpret_s16_u16(vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(loadPixel(pixel))))));
+      sums=vmlal_n_s16(sums, channels, weights[k]);
+      pixel+=4;
+    }
+    // Rounding shift and saturation to 16 bit (same as the scalar version)
+    vst1_s16(outRow+x*4, vqmovn_s32(vrshrq_n_s32(sums, shift)));
+#else
+    int32_t sums[4]={0,0,0,0};
+    for(;k<numTaps;k++) {
+      for(int c=0;c<4;c++) {
+        sums[c]+=weights[k]*pixel[c];
+      }
+      pixel+=4;
+    }
+    for(int c=0;c<4;c++) {
+      outRow[x*4+c]=(int16_t)std::min(32767,std::max(-32768,(sums[c]+(1<<(shift-1)))>>shift));
+    }
+#endif
+  }
+}
+
+#if defined(AGACONV_SCALER_AVX2)
+__attribute__((target("avx2")))
+#endif
+void FrameScaler::scaleRowHorizontallyAVX2(const UBYTE* inRow, int16_t* outRow) const {
+#if defined(AGACONV_SCALER_AVX2)
+  const int numTaps=_horizontalTaps.numTaps;
+  const int shift=weightBits-intermediateBits;
+  // Interleaves the channels of pixels 0 and 1 and of pixels 2 and 3 (see SSE2 version)
+  const __m128i interleave=_mm_setr_epi8(0,4,1,5,2,6,3,7,8,12,9,13,10,14,11,15);
+  // Weight pair of taps 0 and 1 in the low lane, of taps 2 and 3 in the high lane
+  const __m256i weightPairs=_mm256_setr_epi32(0,0,0,0,1,1,1,1);
+  for(int x=0;x<_outWidth;x++) {
+    const UBYTE* pixel=inRow+_horizontalTaps.first[x]*4;
+    const int16_t* weights=&_horizontalTaps.weights[(size_t)x*numTaps];
+    __m256i sums=_mm256_setzero_si256();
+    int k=0;
+    for(;k+4<=numTaps;k+=4) {
+      __m256i channels=_mm256_cvtepu8_epi16(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)pixel), interleave));
+      __m256i weightVector=_mm256_permutevar8x32_epi32(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i*)(weights+k))), weightPairs);
+      sums=_mm256_add_epi32(sums, _mm256_madd_epi16(channels, weightVector));
+      pixel+=16;
+    }
+    __m128i sum=_mm_add_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+    const __m128i zero=_mm_setzero_si128();
+    for(;k<numTaps;k++) {
+      __m128i channels=_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(loadPixel(pixel)), zero), zero);
+      sum=_mm_add_epi32(sum, _mm_madd_epi16(channels, _mm_set1_epi32((uint16_t)weights[k])));
+      pixel+=4;
+    }
+    sum=_mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1<<(shift-1))), shift);
+    _mm_storel_epi64((__m128i*)(outRow+x*4), _mm_packs_epi32(sum, sum));
+  }
+#else
+  scaleRowHorizontally(inRow, outRow);
+#endif
+}
+
+uint32_t FrameScaler::loadPixel(const UBYTE* pixel) {
+  uint32_t value;
+  std::memcpy(&value, pixel, sizeof(value));
+  return value;
+}
+
+void FrameScaler::accumulateRow(const int16_t* row, int16_t weight, int32_t* sums, int n) {
+  int i=0;
+#if defined(__SSE2__)
+  const __m128i weights=_mm_set1_epi16(weight);
+  for(;i+8<=n;i+=8) {
+    __m128i values=_mm_loadu_si128((const __m128i*)(row+i));
+    __m128i low=_mm_mullo_epi16(values, weights);
+    __m128i high=_mm_mulhi_epi16(values, weights);
+    __m128i* sum=(__m128i*)(sums+i);
+    _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), _mm_unpacklo_epi16(low, high)));
+    _mm_storeu_si128(sum+1, _mm_add_epi32(_mm_loadu_si128(sum+1), _mm_unpackhi_epi16(low, high)));
+  }
+#elif defined(__ARM_NEON)
+  const int16x4_t weights=vdup_n_s16(weight);
+  for(;i+8<=n;i+=8) {
+    int16x8_t values=vld1q_s16(row+i);
+    vst1q_s32(sums+i, vmlal_s16(vld1q_s32(sums+i), vget_low_s16(values), weights));
+    vst1q_s32(sums+i+4, vmlal_s16(vld1q_s32(sums+i+4), vget_high_s16(values), weights));
+  }
+#endif
+  for(;i<n;i++) {
+    sums[i]+=weight*row[i];
+  }
+}
+
+#if defined(AGACONV_SCALER_AVX2)
+__attribute__((target("avx2")))
+#endif
+void FrameScaler::accumulateRowAVX2(const int16_t* row, int16_t weight, int32_t* sums, int n) {
+#if defined(AGACONV_SCALER_AVX2)
+  int i=0;
+  const __m256i weights=_mm256_set1_epi16(weight);
+  for(;i+16<=n;i+=16) {
+    __m256i values=_mm256_loadu_si256((const __m256i*)(row+i));
+    __m256i low=_mm256_mullo_epi16(values, weights);
+    __m256i high=_mm256_mulhi_epi16(values, weights);
+    // The unpacked products are in lane order (values 0-3 and 8-11, 4-7 and 12-15)
+    __m256i products0=_mm256_unpacklo_epi16(low, high);
+    __m256i products1=_mm256_unpackhi_epi16(low, high);
+    __m256i* sum=(__m256i*)(sums+i);
+    _mm256_storeu_si256(sum, _mm256_add_epi32(_mm256_loadu_si256(sum), _mm256_permute2x128_si256(products0, products1, 0x20)));
+    _mm256_storeu_si256(sum+1, _mm256_add_epi32(_mm256_loadu_si256(sum+1), _mm256_permute2x128_si256(products0, products1, 0x31)));
+  }
+  if(i<n)
+    accumulateRow(row+i, weight, sums+i, n-i);
+#else
+  accumulateRow(row, weight, sums, n);
+#endif
+}
+
+void FrameScaler::scaleBand(UBYTE** inRows, int firstRow, int endRow, UBYTE** outRows) const {
+  const int numTaps=_verticalTaps.numTaps;
+  const int rowValues=_outWidth*4;
+  // Horizontally scaled input rows required by the band
+  int firstInRow=_verticalTaps.first[firstRow];
+  int endInRow=_verticalTaps.first[endRow-1]+numTaps;
+  vector<int16_t> intermediate((size_t)(endInRow-firstInRow)*rowValues);
+  for(int y=firstInRow;y<endInRow;y++) {
+    if(_useAVX2)
+      scaleRowHorizontallyAVX2(inRows[y], &intermediate[(size_t)(y-firstInRow)*rowValues]);
+    else
+      scaleRowHorizontally(inRows[y], &intermediate[(size_t)(y-firstInRow)*rowValues]);
+  }
+  vector<int32_t> sums(rowValues);
+  const int shift=weightBits+intermediateBits;
+  for(int y=firstRow;y<endRow;y++) {
+    std::fill(sums.begin(), sums.end(), 0);
+    const int16_t* weights=&_verticalTaps.weights[(size_t)y*numTaps];
+    for(int k=0;k<numTaps;k++) {
+      if(weights[k]==0)
+        continue;
+      const int16_t* row=&intermediate[(size_t)(_verticalTaps.first[y]+k-firstInRow)*rowValues];
+      if(_useAVX2)
+        accumulateRowAVX2(row, weights[k], sums.data(), rowValues);
+      else
+        accumulateRow(row, weights[k], sums.data(), rowValues);
+    }
+    UBYTE* outRow=outRows[y];
+    for(int i=0;i<rowValues;i++) {
+      outRow[i]=(UBYTE)std::min(255,std::max(0,(sums[i]+(1<<(shift-1)))>>shift));
+    }
+  }
+}
+
+void FrameScaler::scale(UBYTE** inRows, UBYTE** outRows, unsigned threads) const {
+  int numBands=(_outHeight+bandHeight-1)/bandHeight;
+  auto scaleBands=[this, inRows, outRows, numBands](int firstBand, int bandStep) {
+    for(int band=firstBand;band<numBands;band+=bandStep) {
+      int firstRow=band*bandHeight;
+      scaleBand(inRows, firstRow, std::min(_outHeight,firstRow+bandHeight), outRows);
+    }
+  };
+  int numThreads=std::max(1,std::min((int)threads,numBands));
+  vector<future<void>> workers;
+  for(int thread=1;thread<numThreads;thread++) {
+    workers.push_back(std::async(std::launch::async, scaleBands, thread, numThreads));
+  }
+  scaleBands(0, numThreads);
+  for(auto& worker : workers) {
+    worker.get();
+  }
+}
+
+} // namespace AGAConv
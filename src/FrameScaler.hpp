@@ -0,0 +1,84 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAME_SCALER_HPP
+#define FRAME_SCALER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "AmigaTypeDefs.hpp"
+
+namespace AGAConv {
+
+/* Scales truecolor frames with a separable Lanczos (3 lobes) or
+   bicubic (B=0, C=0.6) filter (in-process replacement of ffmpeg's
+   scale filter). The filter taps of both directions are computed
+   once per geometry (input and output size) in 14 bit fixed point.
+   The rows are first scaled horizontally into 16 bit intermediate
+   rows (6 fractional bits), which are then combined vertically. Both
+   passes are vectorized with SSE2 or NEON, the AVX2 versions are
+   selected at run time if the CPU supports them. Bands of output rows
+   are scaled in parallel, a scaler object can be used by several
+   threads at the same time.
+ */
+class FrameScaler {
+
+ public:
+  enum ScaleFilter { SF_LANCZOS, SF_BICUBIC };
+  // Parses the name of a scale filter (lanczos or bicubic). Returns false for unknown names.
+  static bool parseScaleFilter(const std::string& name, ScaleFilter& filter);
+  FrameScaler(int inWidth, int inHeight, int outWidth, int outHeight, ScaleFilter filter);
+  bool hasInputSize(int inWidth, int inHeight) const;
+  int getOutWidth() const;
+  int getOutHeight() const;
+  // Pixel data is given as rows of 4 bytes per pixel (RGB, followed by an ignored byte). Writes the scaled rows into outRows.
+  void scale(UBYTE** inRows, UBYTE** outRows, unsigned threads) const;
+
+ private:
+  static const int weightBits=14;
+  static const int intermediateBits=6;
+  static const int bandHeight=32;
+  // Taps of each output pixel of one direction (numTaps input pixels, starting at first)
+  struct FilterTaps {
+    int numTaps=0;
+    std::vector<int> first;
+    std::vector<int16_t> weights;
+  };
+  static double filterRadius(ScaleFilter filter);
+  static double filterValue(ScaleFilter filter, double x);
+  static FilterTaps computeTaps(int inSize, int outSize, ScaleFilter filter);
+  static bool isAVX2Supported();
+  void scaleRowHorizontally(const UBYTE* inRow, int16_t* outRow) const;
+  void scaleRowHorizontallyAVX2(const UBYTE* inRow, int16_t* outRow) const;
+  static uint32_t loadPixel(const UBYTE* pixel);
+  void scaleBand(UBYTE** inRows, int firstRow, int endRow, UBYTE** outRows) const;
+  // Adds weight*row[i] to sums[i] for all n values
+  static void accumulateRow(const int16_t* row, int16_t weight, int32_t* sums, int n);
+  static void accumulateRowAVX2(const int16_t* row, int16_t weight, int32_t* sums, int n);
+  int _inWidth, _inHeight;
+  int _outWidth, _outHeight;
+  FilterTaps _horizontalTaps;
+  FilterTaps _verticalTaps;
+  bool _useAVX2;
+};
+
+} // namespace AGAConv
+
+#endif
@@ -0,0 +1,209 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "HamEncoder.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <future>
+
+#include "PaletteQuantizer.hpp"
+
+using namespace std;
+
+namespace AGAConv {
+
+// Beam width and number of tried base colors for each quality level
+static const uint32_t beamWidths[HamEncoder::maxQuality+1]={1,4,8,16};
+static const uint32_t baseCandidateNums[HamEncoder::maxQuality+1]={1,2,4,8};
+
+HamEncoder::HamEncoder(uint32_t numPlanes, uint32_t quality, uint32_t kmeansIterations, bool colors12Bit, bool reserveBackgroundColor):
+  _numPlanes(numPlanes),
+  _numBaseColors(1u<<(numPlanes-2)),
+  _kmeansIterations(kmeansIterations),
+  _colors12Bit(colors12Bit),
+  _reserveBackgroundColor(reserveBackgroundColor) {
+  assert(numPlanes==6 || numPlanes==8);
+  _dataBits=(int)numPlanes-2;
+  // A 12 bit display can only be modeled for HAM6, HAM8 always modifies 6 of 8 bits
+  _channelBits=(colors12Bit && _dataBits<=4)?4:8;
+  if(quality>maxQuality)
+    quality=maxQuality;
+  _beamWidth=beamWidths[quality];
+  _baseCandidates=std::min(baseCandidateNums[quality],_numBaseColors);
+}
+
+int HamEncoder::displayedValue(int value) const {
+  return _channelBits==4?value*17:value;
+}
+
+int HamEncoder::modifiedValue(int previousValue, int target) const {
+  // The data bits replace the upper bits of the color component, the lower bits are kept
+  int shift=_channelBits-_dataBits;
+  int step=1<<shift;
+  int low=previousValue&(step-1);
+  int targetValue=(_channelBits==4)?(target*15+127)/255:target;
+  int data=std::max(0,targetValue-low+step/2)/step;
+  data=std::min(data,(1<<_dataBits)-1);
+  return (data<<shift)|low;
+}
+
+uint32_t HamEncoder::colorError(const UBYTE* color, const UBYTE* target) const {
+  uint32_t error=0;
+  for(int c=0;c<3;c++) {
+    int d=displayedValue(color[c])-target[c];
+    error+=(uint32_t)(d*d);
+  }
+  return error;
+}
+
+void HamEncoder::encode(UBYTE** rows, int width, int height, int bytesPerPixel, vector<RGBColor>& basePalette, UBYTE** codeRows, unsigned threads) {
+  assert(bytesPerPixel==3 || bytesPerPixel==4);
+  // Base palette
+  uint32_t reservedColors=_reserveBackgroundColor?1:0;
+  PaletteQuantizer quantizer(_numBaseColors-reservedColors, _kmeansIterations, _colors12Bit);
+  vector<RGBColor> quantizedPalette;
+  quantizer.computePalette(rows, width, height, bytesPerPixel, quantizedPalette);
+  basePalette.clear();
+  if(_reserveBackgroundColor)
+    basePalette.push_back(RGBColor(0,0,0));
+  basePalette.insert(basePalette.end(), quantizedPalette.begin(), quantizedPalette.end());
+  // Unused entries are black (all codes refer to entries of the full base palette)
+  uint32_t numUsedBaseColors=(uint32_t)basePalette.size();
+  while(basePalette.size()<_numBaseColors)
+    basePalette.push_back(RGBColor(0,0,0));
+  _baseColors.clear();
+  for(auto color : basePalette) {
+    UBYTE components[3]={color.getRed(),color.getGreen(),color.getBlue()};
+    for(int c=0;c<3;c++)
+      _baseColors.push_back(_channelBits==4?components[c]/17:components[c]);
+  }
+  _baseColors.resize(numUsedBaseColors*3);
+
+  // Scanlines are independent, each thread encodes every numThreads-th line
+  int numThreads=std::max(1,std::min((int)threads,height));
+  auto encodeLines=[this, rows, width, height, bytesPerPixel, codeRows](int firstLine, int lineStep) {
+    LineBuffers buffers;
+    for(int y=firstLine;y<height;y+=lineStep) {
+      encodeLine(rows[y], width, bytesPerPixel, codeRows[y], buffers);
+    }
+  };
+  vector<future<void>> workers;
+  for(int thread=1;thread<numThreads;thread++) {
+    workers.push_back(std::async(std::launch::async, encodeLines, thread, numThreads));
+  }
+  encodeLines(0, numThreads);
+  for(auto& worker : workers) {
+    worker.get();
+  }
+}
+
+bool HamEncoder::betterState(const BeamState& a, const BeamState& b) {
+  if(a.error!=b.error)
+    return a.error<b.error;
+  if(a.parent!=b.parent)
+    return a.parent<b.parent;
+  return a.code<b.code;
+}
+
+void HamEncoder::encodeLine(const UBYTE* pixels, int width, int bytesPerPixel, UBYTE* codes, LineBuffers& buffers) const {
+  const int numBaseColors=(int)_baseColors.size()/3;
+  const int shift=_channelBits-_dataBits;
+  const uint32_t baseCandidates=std::min(_baseCandidates,(uint32_t)numBaseColors);
+  vector<BeamState>& beam=buffers.beam;
+  vector<BeamState>& candidates=buffers.candidates;
+  // Each scanline starts with the background color
+  beam.assign(1, BeamState{{_baseColors[0],_baseColors[1],_baseColors[2]}, 0, 0, 0});
+  // Per pixel and kept state: state of the previous pixel (upper byte) and code (lower byte)
+  buffers.trellis.resize((size_t)width*_beamWidth);
+  buffers.baseErrors.resize(numBaseColors);
+  buffers.baseOrder.resize(numBaseColors);
+  // Hash table of the candidate colors of one pixel (candidates with the same color are merged)
+  buffers.colorSlots.assign(colorSlotsSize, -1);
+  auto addCandidate=[&candidates, &buffers](const BeamState& candidate) {
+    uint32_t slot=((candidate.color[0]*31u+candidate.color[1])*31u+candidate.color[2])&(colorSlotsSize-1);
+    while(buffers.colorSlots[slot]>=0) {
+      BeamState& other=candidates[buffers.colorSlots[slot]];
+      if(other.color[0]==candidate.color[0] && other.color[1]==candidate.color[1] && other.color[2]==candidate.color[2]) {
+        if(betterState(candidate, other))
+          other=candidate;
+        return;
+      }
+      slot=(slot+1)&(colorSlotsSize-1);
+    }
+    buffers.colorSlots[slot]=(int)candidates.size();
+    candidates.push_back(candidate);
+  };
+  for(int x=0;x<width;x++) {
+    const UBYTE* target=pixels+x*bytesPerPixel;
+    candidates.clear();
+    // Base colors: only the best state of the previous pixel is relevant
+    vector<uint32_t>& baseErrors=buffers.baseErrors;
+    for(int i=0;i<numBaseColors;i++) {
+      baseErrors[i]=colorError(&_baseColors[i*3], target);
+      buffers.baseOrder[i]=i;
+    }
+    std::partial_sort(buffers.baseOrder.begin(), buffers.baseOrder.begin()+baseCandidates, buffers.baseOrder.end(),
+                      [&baseErrors](int a, int b) { return baseErrors[a]<baseErrors[b] || (baseErrors[a]==baseErrors[b] && a<b); });
+    // The beam is sorted by error, the first state is the best
+    for(uint32_t i=0;i<baseCandidates;i++) {
+      int index=buffers.baseOrder[i];
+      const UBYTE* color=&_baseColors[index*3];
+      addCandidate(BeamState{{color[0],color[1],color[2]}, beam[0].error+baseErrors[index], 0, (UBYTE)((HAM_BASE<<_dataBits)|index)});
+    }
+    // Modification of one color component of each state
+    static const HamControl modifyControls[3]={HAM_MODIFY_RED, HAM_MODIFY_GREEN, HAM_MODIFY_BLUE};
+    for(size_t s=0;s<beam.size();s++) {
+      for(int c=0;c<3;c++) {
+        BeamState candidate=beam[s];
+        int value=modifiedValue(candidate.color[c], target[c]);
+        candidate.color[c]=(UBYTE)value;
+        candidate.error=beam[s].error+colorError(candidate.color, target);
+        candidate.parent=(uint16_t)s;
+        candidate.code=(UBYTE)((modifyControls[c]<<_dataBits)|(value>>shift));
+        addCandidate(candidate);
+      }
+    }
+    for(auto& candidate : candidates) {
+      uint32_t slot=((candidate.color[0]*31u+candidate.color[1])*31u+candidate.color[2])&(colorSlotsSize-1);
+      while(buffers.colorSlots[slot]>=0) {
+        buffers.colorSlots[slot]=-1;
+        slot=(slot+1)&(colorSlotsSize-1);
+      }
+    }
+    // Keep the best states
+    if(candidates.size()>_beamWidth) {
+      std::nth_element(candidates.begin(), candidates.begin()+_beamWidth, candidates.end(), betterState);
+      candidates.resize(_beamWidth);
+    }
+    std::sort(candidates.begin(), candidates.end(), betterState);
+    for(size_t i=0;i<candidates.size();i++) {
+      buffers.trellis[(size_t)x*_beamWidth+i]=(uint16_t)((candidates[i].parent<<8)|candidates[i].code);
+    }
+    beam.swap(candidates);
+  }
+  // Trace back the codes of the best state at the end of the scanline
+  size_t state=0;
+  for(int x=width-1;x>=0;x--) {
+    uint16_t entry=buffers.trellis[(size_t)x*_beamWidth+state];
+    codes[x]=(UBYTE)(entry&0xFF);
+    state=entry>>8;
+  }
+}
+
+} // namespace AGAConv
@@ -0,0 +1,94 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef HAM_ENCODER_HPP
+#define HAM_ENCODER_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "AmigaTypeDefs.hpp"
+#include "RGBColor.hpp"
+
+namespace AGAConv {
+
+/* Encodes a truecolor frame in HAM6 or HAM8 (in-process replacement
+   of ham_convert). The base palette (16 colors for HAM6, 64 colors
+   for HAM8) is computed with the PaletteQuantizer. Each pixel is
+   encoded either as base palette index or as modification of one
+   color component of the pixel to its left (hold-and-modify). For
+   each scanline the codes are determined with a beam search over
+   the colors that can be displayed at each pixel, the width of the
+   beam is given by the quality level (0: greedy choice per pixel).
+   Each scanline starts with the background color (color 0), hence
+   the scanlines are independent and are encoded in parallel.
+   The codes are written as one byte per pixel (control bits in the
+   two upper planes, data bits in the lower planes).
+ */
+class HamEncoder {
+
+ public:
+  static const uint32_t maxQuality=3;
+  // With colors12Bit the base palette consists of 12 bit colors and (for HAM6) modifications are computed
+  // for a 12 bit display. With reserveBackgroundColor the base palette color 0 is black.
+  HamEncoder(uint32_t numPlanes, uint32_t quality, uint32_t kmeansIterations, bool colors12Bit, bool reserveBackgroundColor);
+  // Pixel data is given as rows of bytesPerPixel bytes per pixel (RGB, followed by an ignored byte if bytesPerPixel is 4).
+  // Writes one HAM code per pixel into codeRows and the base palette colors into basePalette.
+  void encode(UBYTE** rows, int width, int height, int bytesPerPixel, std::vector<RGBColor>& basePalette, UBYTE** codeRows, unsigned threads);
+
+ private:
+  // Control bits of the HAM codes
+  enum HamControl { HAM_BASE=0, HAM_MODIFY_BLUE=1, HAM_MODIFY_RED=2, HAM_MODIFY_GREEN=3 };
+  // Color that is displayed after a pixel of a scanline (components with _channelBits bits)
+  struct BeamState {
+    UBYTE color[3];
+    uint32_t error; // accumulated error of the scanline up to this pixel
+    uint16_t parent; // state of the previous pixel
+    UBYTE code;
+  };
+  static bool betterState(const BeamState& a, const BeamState& b);
+  static const uint32_t colorSlotsSize=256;
+  // Buffers of one thread, reused for all scanlines
+  struct LineBuffers {
+    std::vector<BeamState> beam;
+    std::vector<BeamState> candidates;
+    std::vector<uint16_t> trellis;
+    std::vector<uint32_t> baseErrors;
+    std::vector<int> baseOrder;
+    std::vector<int> colorSlots;
+  };
+  void encodeLine(const UBYTE* pixels, int width, int bytesPerPixel, UBYTE* codes, LineBuffers& buffers) const;
+  int displayedValue(int value) const;
+  int modifiedValue(int previousValue, int target) const;
+  uint32_t colorError(const UBYTE* color, const UBYTE* target) const;
+  uint32_t _numPlanes;
+  uint32_t _numBaseColors;
+  uint32_t _kmeansIterations;
+  bool _colors12Bit;
+  bool _reserveBackgroundColor;
+  int _channelBits; // 4 (12 bit display) or 8 bits per color component
+  int _dataBits; // number of data bits of a code (numPlanes-2)
+  uint32_t _beamWidth; // number of states kept per pixel
+  uint32_t _baseCandidates; // number of nearest base colors tried per pixel
+  // Base palette colors with _channelBits bits per component
+  std::vector<UBYTE> _baseColors;
+};
+
+} // namespace AGAConv
+
+#endif
@@ -122,5 +122,11 @@ void IffCAMGChunk::setSuperHires() {
 void IffCAMGChunk::setUltraHires() {
   throw AGAConvException(143, "Ultrahires not supported in CAMG chunk.");
 }
+void IffCAMGChunk::setHam() {
+  viewMode|=CAMG_HAM;
+}
+void IffCAMGChunk::setHalfBrite() {
+  viewMode|=CAMG_EHB;
+}
 
 } // namespace AGAConv
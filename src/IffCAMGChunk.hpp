@@ -57,6 +57,8 @@ class IffCAMGChunk : public IffChunk {
   void setHires();
   void setSuperHires();
   void setUltraHires();
+  void setHam();
+  void setHalfBrite();
  private:
   ULONG viewMode; // viewmode bits
 };
@@ -34,6 +34,11 @@ void IffDataChunk::add(UBYTE byte) {
   dataSize++;
 }
 
+void IffDataChunk::add(const UBYTE* bytes, std::size_t numBytes) {
+  data.insert(data.end(), bytes, bytes+numBytes);
+  dataSize+=(ULONG)numBytes;
+}
+
 void IffDataChunk::readData(ULONG dataSize0) {
   if(IffChunk::debug) cout<<"DEBUG: IffDataChunk: readData - dataSize:"<<dataSize0<<endl;
   for(ULONG i=0;i<dataSize0;i++) {
@@ -19,6 +19,7 @@
 #ifndef IFF_DATA_CHUNK_HPP
 #define IFF_DATA_CHUNK_HPP
 
+#include <cstddef>
 #include <vector>
 #include "IffChunk.hpp"
 
@@ -35,6 +36,7 @@ typedef std::vector<UBYTE>::iterator IffDataChunkIterator;
    std::string indent();
    void removeData();
    void add(UBYTE byte);
+   void add(const UBYTE* bytes, std::size_t numBytes);
    IffDataChunkIterator begin();
    IffDataChunkIterator end();
  protected:
@@ -0,0 +1,88 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "ImageBuffer.hpp"
+
+#include <cassert>
+
+using namespace std;
+
+namespace AGAConv {
+
+std::mutex ImageBuffer::_poolMutex;
+std::vector<std::unique_ptr<ImageBuffer>> ImageBuffer::_pool;
+
+std::unique_ptr<ImageBuffer> ImageBuffer::acquire(int rowBytes, int height) {
+  assert(rowBytes>=0 && height>=0);
+  size_t size=((size_t)rowBytes+15)/16*16*height;
+  unique_ptr<ImageBuffer> buffer;
+  {
+    lock_guard<mutex> lock(_poolMutex);
+    if(!_pool.empty()) {
+      // Prefer the smallest buffer that is large enough, otherwise the largest buffer is enlarged
+      size_t selected=0;
+      for(size_t i=1;i<_pool.size();i++) {
+        size_t capacity=_pool[i]->_data.size();
+        size_t selectedCapacity=_pool[selected]->_data.size();
+        if(selectedCapacity>=size ? (capacity>=size && capacity<selectedCapacity) : capacity>selectedCapacity) {
+          selected=i;
+        }
+      }
+      buffer=std::move(_pool[selected]);
+      _pool[selected]=std::move(_pool.back());
+      _pool.pop_back();
+    }
+  }
+  if(!buffer)
+    buffer.reset(new ImageBuffer());
+  buffer->reshape(rowBytes, height);
+  return buffer;
+}
+
+void ImageBuffer::release(std::unique_ptr<ImageBuffer> buffer) {
+  if(!buffer)
+    return;
+  lock_guard<mutex> lock(_poolMutex);
+  if(_pool.size()<maxPooledBuffers)
+    _pool.push_back(std::move(buffer));
+}
+
+void ImageBuffer::reshape(int rowBytes, int height) {
+  _stride=((size_t)rowBytes+15)/16*16;
+  size_t size=_stride*height;
+  // Memory is only allocated if the buffer is too small (it is never shrunk)
+  if(_data.size()<size)
+    _data.resize(size);
+  _rows.resize(height);
+  for(int y=0;y<height;y++) {
+    _rows[y]=_data.data()+y*_stride;
+  }
+}
+
+UBYTE** ImageBuffer::rows() {
+  return _rows.data();
+}
+
+std::size_t ImageBuffer::stride() const {
+  return _stride;
+}
+
+int ImageBuffer::height() const {
+  return (int)_rows.size();
+}
+
+} // namespace AGAConv
@@ -0,0 +1,63 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef IMAGE_BUFFER_HPP
+#define IMAGE_BUFFER_HPP
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "AmigaTypeDefs.hpp"
+
+namespace AGAConv {
+
+/* Image data in one contiguous block of memory (rows of stride bytes,
+   aligned to 16 bytes) with the array of row pointers that is used by
+   libpng and the frame converters. Buffers are acquired from and
+   released to a pool that is shared by all threads (frames are loaded
+   and converted in worker threads). Released buffers keep their
+   memory, such that converting frames of the same geometry does not
+   allocate memory once the pool holds enough buffers.
+ */
+class ImageBuffer {
+
+ public:
+  // Returns a buffer of height rows with (at least) rowBytes bytes each. The contents are undefined.
+  static std::unique_ptr<ImageBuffer> acquire(int rowBytes, int height);
+  // Returns the buffer to the pool (the buffer is deleted if the pool is full)
+  static void release(std::unique_ptr<ImageBuffer> buffer);
+  UBYTE** rows();
+  std::size_t stride() const;
+  int height() const;
+
+ private:
+  ImageBuffer() = default;
+  void reshape(int rowBytes, int height);
+  std::vector<UBYTE> _data;
+  std::vector<UBYTE*> _rows;
+  std::size_t _stride=0;
+  // Upper bound of buffers kept in the pool (e.g. after all frames of a scene have been released at once)
+  static const std::size_t maxPooledBuffers=32;
+  static std::mutex _poolMutex;
+  static std::vector<std::unique_ptr<ImageBuffer>> _pool;
+};
+
+} // namespace AGAConv
+
+#endif
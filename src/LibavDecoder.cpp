@@ -0,0 +1,346 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "LibavDecoder.hpp"
+
+#ifdef AGACONV_LIBAV
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/error.h>
+#include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
+}
+
+#include "AGAConvException.hpp"
+#include "AudioResampler.hpp"
+
+using namespace std;
+
+namespace AGAConv {
+
+static string libavErrorString(int error) {
+  char errorString[AV_ERROR_MAX_STRING_SIZE]={0};
+  av_strerror(error, errorString, sizeof(errorString));
+  return errorString;
+}
+
+// Demuxer and decoder of one stream of the input file
+struct LibavDecoder::StreamDecoder {
+  AVFormatContext* format=nullptr;
+  AVCodecContext* codec=nullptr;
+  AVPacket* packet=nullptr;
+  AVFrame* frame=nullptr;
+  int streamIndex=-1;
+  bool endOfInput=false;
+  ~StreamDecoder() {
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&codec);
+    avformat_close_input(&format);
+  }
+  AVStream* stream() const {
+    return format->streams[streamIndex];
+  }
+  // Decodes the next frame into frame. Returns false at the end of the stream.
+  bool receiveFrame() {
+    while(true) {
+      int result=avcodec_receive_frame(codec, frame);
+      if(result==0)
+        return true;
+      if(result==AVERROR_EOF)
+        return false;
+      if(result!=AVERROR(EAGAIN))
+        throw AGAConvException(242, "libav: decoding failed ("+libavErrorString(result)+").");
+      // The decoder requires more data. At the end of the input the decoder is flushed (empty packet).
+      assert(!endOfInput);
+      if(av_read_frame(format, packet)<0) {
+        endOfInput=true;
+        avcodec_send_packet(codec, nullptr);
+        continue;
+      }
+      if(packet->stream_index==streamIndex) {
+        result=avcodec_send_packet(codec, packet);
+        // Invalid packets are skipped (as done by ffmpeg)
+        if(result<0 && result!=AVERROR_INVALIDDATA) {
+          av_packet_unref(packet);
+          throw AGAConvException(242, "libav: decoding failed ("+libavErrorString(result)+").");
+        }
+      }
+      av_packet_unref(packet);
+    }
+  }
+};
+
+LibavDecoder::LibavDecoder(const Options& options):
+  _options(options),
+  _segmentStart((double)options.startFrame()/options.fps) {
+  _video=openStream(AVMEDIA_TYPE_VIDEO);
+  if(!_video) {
+    throw AGAConvException(241, "libav: no video stream in "+options.inFileName.string()+".");
+  }
+}
+
+LibavDecoder::~LibavDecoder() {
+  sws_freeContext(_scaler);
+}
+
+unique_ptr<LibavDecoder::StreamDecoder> LibavDecoder::openStream(int mediaType) {
+  auto decoder=std::make_unique<StreamDecoder>();
+  string fileName=_options.inFileName.string();
+  int result=avformat_open_input(&decoder->format, fileName.c_str(), nullptr, nullptr);
+  if(result<0) {
+    throw AGAConvException(240, "libav: cannot open input file "+fileName+" ("+libavErrorString(result)+").");
+  }
+  result=avformat_find_stream_info(decoder->format, nullptr);
+  if(result<0) {
+    throw AGAConvException(240, "libav: cannot read stream info of "+fileName+" ("+libavErrorString(result)+").");
+  }
+  const AVCodec* codec=nullptr;
+  decoder->streamIndex=av_find_best_stream(decoder->format, (AVMediaType)mediaType, -1, -1, &codec, 0);
+  if(decoder->streamIndex<0)
+    return nullptr;
+  decoder->codec=avcodec_alloc_context3(codec);
+  if(!decoder->codec || avcodec_parameters_to_context(decoder->codec, decoder->stream()->codecpar)<0) {
+    throw AGAConvException(241, "libav: cannot set up decoder of "+fileName+".");
+  }
+  // Number of decoding threads is chosen by libavcodec
+  decoder->codec->thread_count=0;
+  result=avcodec_open2(decoder->codec, codec, nullptr);
+  if(result<0) {
+    throw AGAConvException(241, "libav: cannot open decoder "+string(codec->name)+" ("+libavErrorString(result)+").");
+  }
+  decoder->packet=av_packet_alloc();
+  decoder->frame=av_frame_alloc();
+  if(!decoder->packet || !decoder->frame) {
+    throw AGAConvException(241, "libav: out of memory.");
+  }
+  // Same as input seeking of ffmpeg: starts at the key frame before the segment, earlier frames are skipped when decoded
+  if(_segmentStart>0.0) {
+    int64_t timestamp=(int64_t)(_segmentStart*AV_TIME_BASE);
+    if(decoder->format->start_time!=AV_NOPTS_VALUE)
+      timestamp+=decoder->format->start_time;
+    result=avformat_seek_file(decoder->format, -1, INT64_MIN, timestamp, timestamp, 0);
+    if(result<0) {
+      throw AGAConvException(240, "libav: cannot seek to start of segment in "+fileName+" ("+libavErrorString(result)+").");
+    }
+  }
+  return decoder;
+}
+
+double LibavDecoder::frameTime(const StreamDecoder& decoder, int64_t timestamp) const {
+  double time=timestamp*av_q2d(decoder.stream()->time_base);
+  if(decoder.format->start_time!=AV_NOPTS_VALUE)
+    time-=(double)decoder.format->start_time/AV_TIME_BASE;
+  return time-_segmentStart;
+}
+
+void LibavDecoder::getVideoDimensions(uint32_t& width, uint32_t& height) const {
+  width=(uint32_t)_video->codec->width;
+  height=(uint32_t)_video->codec->height;
+  if(width==0 || height==0) {
+    throw AGAConvException(246, "libav: could not determine video dimensions of "+_options.inFileName.string()+".");
+  }
+  if(_options.verbose>=2) {
+    cout<<"Input video dimensions: "<<width<<"x"<<height<<endl;
+  }
+}
+
+uint32_t LibavDecoder::expectedNumberOfFrames() const {
+  if(_options.durationFrames()>0)
+    return _options.durationFrames();
+  if(_video->format->duration==AV_NOPTS_VALUE)
+    return 0;
+  double duration=(double)_video->format->duration/AV_TIME_BASE-_segmentStart;
+  return duration>0.0?(uint32_t)std::lround(duration*_options.fps):0;
+}
+
+void LibavDecoder::decodeAudio(const std::filesystem::path& pcmFileName) {
+  unique_ptr<StreamDecoder> audio=openStream(AVMEDIA_TYPE_AUDIO);
+  if(!audio) {
+    throw AGAConvException(243, "libav: no audio stream in "+_options.inFileName.string()+".");
+  }
+  ofstream pcmFile(pcmFileName, ios::out | ios::binary);
+  if(!pcmFile.is_open()) {
+    throw AGAConvException(244, "cannot open PCM file "+pcmFileName.string());
+  }
+  int numChannels=_options.stereo?2:1;
+  int inFrequency=audio->codec->sample_rate;
+  bool nativeResampler=_options.nativeResampler();
+  // With the native resampler libswresample only converts the sample format and the channels
+  int outFrequency=nativeResampler?inFrequency:(int)_options.frequency;
+  AVSampleFormat outFormat=nativeResampler?AV_SAMPLE_FMT_FLTP:AV_SAMPLE_FMT_U8;
+  AVChannelLayout outLayout;
+  av_channel_layout_default(&outLayout, numChannels);
+  SwrContext* converter=nullptr;
+  int result=swr_alloc_set_opts2(&converter, &outLayout, outFormat, outFrequency,
+                                 &audio->codec->ch_layout, audio->codec->sample_fmt, inFrequency, 0, nullptr);
+  if(result<0 || (result=swr_init(converter))<0) {
+    swr_free(&converter);
+    throw AGAConvException(245, "libav: cannot set up audio conversion ("+libavErrorString(result)+").");
+  }
+  unique_ptr<SwrContext, void(*)(SwrContext*)> converterOwner(converter, [](SwrContext* context) { swr_free(&context); });
+  vector<AudioResampler> resamplers;
+  if(nativeResampler)
+    resamplers.assign(numChannels, AudioResampler((uint32_t)inFrequency, _options.frequency));
+  vector<vector<float>> convertedSamples(numChannels);
+  vector<vector<float>> resampledSamples(numChannels);
+  vector<UBYTE> pcmData;
+  // Converts numSamples input samples (nullptr: flush) and writes the result
+  auto convert=[&](const uint8_t** inData, int numSamples) {
+    int maxOutSamples=swr_get_out_samples(converter, numSamples);
+    if(maxOutSamples<=0)
+      return 0;
+    uint8_t* outData[2];
+    if(nativeResampler) {
+      for(int c=0;c<numChannels;c++) {
+        convertedSamples[c].resize(maxOutSamples);
+        outData[c]=(uint8_t*)convertedSamples[c].data();
+      }
+    } else {
+      pcmData.resize((size_t)maxOutSamples*numChannels);
+      outData[0]=pcmData.data();
+    }
+    int numOutSamples=swr_convert(converter, outData, maxOutSamples, inData, numSamples);
+    if(numOutSamples<0) {
+      throw AGAConvException(245, "libav: audio conversion failed ("+libavErrorString(numOutSamples)+").");
+    }
+    if(nativeResampler) {
+      for(int c=0;c<numChannels;c++) {
+        resamplers[c].process(convertedSamples[c].data(), numOutSamples, resampledSamples[c]);
+      }
+      AudioResampler::writeUnsignedPcm(pcmFile, resampledSamples);
+    } else {
+      pcmFile.write((const char*)pcmData.data(), (size_t)numOutSamples*numChannels);
+    }
+    return numOutSamples;
+  };
+  // Samples of the segment (same length as the audio data extracted by ffmpeg with -t)
+  int64_t remainingSamples=INT64_MAX;
+  if(_options.durationFrames()>0)
+    remainingSamples=std::llround((double)_options.durationFrames()/_options.fps*inFrequency);
+  bool isPlanar=av_sample_fmt_is_planar(audio->codec->sample_fmt);
+  int bytesPerSample=av_get_bytes_per_sample(audio->codec->sample_fmt);
+  int inChannels=audio->codec->ch_layout.nb_channels;
+  vector<const uint8_t*> inData(isPlanar?inChannels:1);
+  while(remainingSamples>0 && audio->receiveFrame()) {
+    AVFrame* frame=audio->frame;
+    // Samples before the start of the segment are skipped
+    int64_t skipSamples=0;
+    if(frame->best_effort_timestamp!=AV_NOPTS_VALUE) {
+      double time=frameTime(*audio, frame->best_effort_timestamp);
+      if(time<0.0)
+        skipSamples=std::llround(-time*inFrequency);
+    }
+    if(skipSamples>=frame->nb_samples)
+      continue;
+    int numSamples=(int)std::min<int64_t>(frame->nb_samples-skipSamples, remainingSamples);
+    size_t offset=(size_t)skipSamples*bytesPerSample*(isPlanar?1:inChannels);
+    for(size_t p=0;p<inData.size();p++) {
+      inData[p]=frame->extended_data[p]+offset;
+    }
+    convert(inData.data(), numSamples);
+    remainingSamples-=numSamples;
+  }
+  while(convert(nullptr, 0)>0) {
+  }
+  if(nativeResampler) {
+    for(int c=0;c<numChannels;c++) {
+      resamplers[c].flush(resampledSamples[c]);
+    }
+    AudioResampler::writeUnsignedPcm(pcmFile, resampledSamples);
+  }
+  if(!pcmFile) {
+    throw AGAConvException(244, "cannot write PCM file "+pcmFileName.string());
+  }
+  if(_options.verbose>=2) {
+    cout<<"Decoded audio data (libav, "<<inFrequency<<" Hz to "<<_options.frequency<<" Hz, sound mode:"<<_options.audioModeToString()<<")"<<endl;
+  }
+}
+
+bool LibavDecoder::decodeVideoFrame(vector<UBYTE>& rgbData, int64_t& frameSlot, int width, int height) {
+  while(_video->receiveFrame()) {
+    AVFrame* frame=_video->frame;
+    if(frame->best_effort_timestamp==AV_NOPTS_VALUE)
+      continue;
+    double time=frameTime(*_video, frame->best_effort_timestamp);
+    // Frames before the segment (decoded from the key frame before the start) are skipped
+    if(time<0.0)
+      continue;
+    frameSlot=std::llround(time*_options.fps);
+    // Same scaling algorithm as ffmpeg's scale filter (bicubic)
+    AVPixelFormat outFormat=_options.blackAndWhite?AV_PIX_FMT_GRAY8:AV_PIX_FMT_RGB24;
+    _scaler=sws_getCachedContext(_scaler, frame->width, frame->height, (AVPixelFormat)frame->format,
+                                 width, height, outFormat, SWS_BICUBIC, nullptr, nullptr, nullptr);
+    if(!_scaler) {
+      throw AGAConvException(242, "libav: cannot scale frames of "+_options.inFileName.string()+".");
+    }
+    rgbData.resize((size_t)width*height*3);
+    int outLineSize=_options.blackAndWhite?width:width*3;
+    uint8_t* outData[1]={rgbData.data()};
+    sws_scale(_scaler, frame->data, frame->linesize, 0, frame->height, outData, &outLineSize);
+    if(_options.blackAndWhite) {
+      // Gray values are expanded to RGB (in place, backwards)
+      for(size_t i=(size_t)width*height;i-->0;) {
+        rgbData[i*3]=rgbData[i*3+1]=rgbData[i*3+2]=rgbData[i];
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+unique_ptr<RawFrameLoader> LibavDecoder::nextFrame(int width, int height) {
+  uint32_t numFrames=_options.durationFrames();
+  while(numFrames==0 || _nextOutputFrame<numFrames) {
+    if(!_hasNextFrame && !_videoEnded) {
+      _hasNextFrame=decodeVideoFrame(_nextFrame, _nextFrameSlot, width, height);
+      _videoEnded=!_hasNextFrame;
+      continue;
+    }
+    if(_hasNextFrame && (!_hasCurrentFrame || _nextFrameSlot<=(int64_t)_nextOutputFrame)) {
+      // Frames that fall into the same slot replace each other (only the last one is output)
+      std::swap(_currentFrame, _nextFrame);
+      _hasCurrentFrame=true;
+      _currentFrameOutput=false;
+      _hasNextFrame=false;
+      continue;
+    }
+    // At the end of the video the last frame is output once
+    if(!_hasCurrentFrame || (_videoEnded && _currentFrameOutput))
+      return nullptr;
+    _nextOutputFrame++;
+    _currentFrameOutput=true;
+    auto frameLoader=std::make_unique<RawFrameLoader>(width, height, true);
+    frameLoader->setTruecolorFrame(_currentFrame.data(), width*3);
+    return frameLoader;
+  }
+  return nullptr;
+}
+
+} // namespace AGAConv
+
+#endif // AGACONV_LIBAV
@@ -0,0 +1,88 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIBAV_DECODER_HPP
+#define LIBAV_DECODER_HPP
+
+#ifdef AGACONV_LIBAV
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#include "Options.hpp"
+#include "RawFrameLoader.hpp"
+
+struct SwsContext;
+
+namespace AGAConv {
+
+/* Decodes the input video in-process with libavformat/libavcodec
+   (optional backend, built with 'make LIBAV=1'). Replaces the ffmpeg
+   processes of the piped conversion: frames are decoded, selected for
+   the frame rate of the CDXL video (same selection as ffmpeg's fps
+   filter), scaled and converted to RGB with libswscale, and handed to
+   the encoder as truecolor frames. The audio data of the converted
+   segment is decoded and resampled with libswresample (or with the
+   native resampler) and written to the PCM file in the tmp dir,
+   because the encoder requires the complete audio data before the
+   first frame. Audio and video are decoded in separate passes (each
+   with its own demuxer).
+ */
+class LibavDecoder {
+
+ public:
+  // Opens the video stream of the input file (throws if the input or the video codec cannot be opened)
+  LibavDecoder(const Options& options);
+  ~LibavDecoder();
+  void getVideoDimensions(uint32_t& width, uint32_t& height) const;
+  // Returns 0 if the number of frames cannot be determined
+  uint32_t expectedNumberOfFrames() const;
+  // Writes the audio data as unsigned 8 bit PCM file (interleaved channels, same layout as ffmpeg's u8 format)
+  void decodeAudio(const std::filesystem::path& pcmFileName);
+  // Returns the next frame scaled to width x height, or nullptr after the last frame of the converted segment
+  std::unique_ptr<RawFrameLoader> nextFrame(int width, int height);
+
+ private:
+  struct StreamDecoder;
+  // Returns nullptr if the input has no stream of the type
+  std::unique_ptr<StreamDecoder> openStream(int mediaType);
+  // Time of a decoded frame (in seconds, relative to the start of the converted segment)
+  double frameTime(const StreamDecoder& decoder, int64_t timestamp) const;
+  // Decodes the next frame of the segment into rgbData and determines its frame slot. Returns false at the end of the video.
+  bool decodeVideoFrame(std::vector<UBYTE>& rgbData, int64_t& frameSlot, int width, int height);
+  const Options& _options;
+  double _segmentStart;
+  std::unique_ptr<StreamDecoder> _video;
+  SwsContext* _scaler=nullptr;
+  // Frame selection (fps filter): the current frame is output for all frame slots before the slot of the next frame
+  std::vector<UBYTE> _currentFrame;
+  std::vector<UBYTE> _nextFrame;
+  int64_t _nextFrameSlot=0;
+  bool _hasCurrentFrame=false;
+  bool _currentFrameOutput=false;
+  bool _hasNextFrame=false;
+  bool _videoEnded=false;
+  uint32_t _nextOutputFrame=0;
+};
+
+} // namespace AGAConv
+
+#endif // AGACONV_LIBAV
+#endif
@@ -0,0 +1,190 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "NearestColorIndex.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <limits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define AGACONV_NEAREST_COLOR_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace AGAConv {
+
+NearestColorIndex::NearestColorIndex(const vector<RGBColor>& palette):
+  _palette(palette),
+  _fullSearch(palette.size()<=maxColorsOfFullSearch),
+  _useAVX2(isAVX2Supported()) {
+  assert(palette.size()>=1 && palette.size()<=256);
+  for(RGBColor color : palette) {
+    _red.push_back(color.getRed());
+    _green.push_back(color.getGreen());
+    _blue.push_back(color.getBlue());
+  }
+  // Padding with the first color never changes the result, because the lowest index wins on ties
+  while(_red.size()%8!=0) {
+    _red.push_back(_red[0]);
+    _green.push_back(_green[0]);
+    _blue.push_back(_blue[0]);
+  }
+  if(!_fullSearch)
+    _cells.reset(new Cell[cellsPerChannel*cellsPerChannel*cellsPerChannel]);
+}
+
+bool NearestColorIndex::isAVX2Supported() {
+#if defined(AGACONV_NEAREST_COLOR_AVX2)
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+int NearestColorIndex::getNumColors() const {
+  return (int)_palette.size();
+}
+
+int NearestColorIndex::getRed(int index) const {
+  return _red[index];
+}
+
+int NearestColorIndex::getGreen(int index) const {
+  return _green[index];
+}
+
+int NearestColorIndex::getBlue(int index) const {
+  return _blue[index];
+}
+
+const vector<RGBColor>& NearestColorIndex::getPalette() const {
+  return _palette;
+}
+
+int NearestColorIndex::nearestColorIndex(int r, int g, int b) const {
+  if(_fullSearch) {
+    if(_useAVX2)
+      return nearestColorIndexAVX2(r, g, b);
+    return nearestColorIndexExhaustive(r, g, b);
+  }
+  int cellRed=r>>(8-cellBits), cellGreen=g>>(8-cellBits), cellBlue=b>>(8-cellBits);
+  Cell& cell=_cells[(cellRed*cellsPerChannel+cellGreen)*cellsPerChannel+cellBlue];
+  int state=cell.state.load(std::memory_order_acquire);
+  if(state!=CELL_READY) {
+    // The first thread that needs the cell builds it, other threads search exhaustively in the meantime
+    if(state==CELL_EMPTY && cell.state.compare_exchange_strong(state, CELL_BUILDING, std::memory_order_acquire)) {
+      buildCell(cellRed, cellGreen, cellBlue, cell);
+      cell.state.store(CELL_READY, std::memory_order_release);
+    } else {
+      return nearestColorIndexExhaustive(r, g, b);
+    }
+  }
+  int nearestIndex=0;
+  int nearestDistance=std::numeric_limits<int>::max();
+  for(UBYTE i : cell.candidates) {
+    int dr=r-_red[i];
+    int dg=g-_green[i];
+    int db=b-_blue[i];
+    int distance=dr*dr+dg*dg+db*db;
+    if(distance<nearestDistance) {
+      nearestDistance=distance;
+      nearestIndex=i;
+    }
+  }
+  return nearestIndex;
+}
+
+int NearestColorIndex::nearestColorIndexExhaustive(int r, int g, int b) const {
+  // The lowest index wins on ties
+  int nearestIndex=0;
+  int nearestDistance=std::numeric_limits<int>::max();
+  for(size_t i=0;i<_palette.size();i++) {
+    int dr=r-_red[i];
+    int dg=g-_green[i];
+    int db=b-_blue[i];
+    int distance=dr*dr+dg*dg+db*db;
+    if(distance<nearestDistance) {
+      nearestDistance=distance;
+      nearestIndex=(int)i;
+    }
+  }
+  return nearestIndex;
+}
+
+#if defined(AGACONV_NEAREST_COLOR_AVX2)
+__attribute__((target("avx2")))
+#endif
+int NearestColorIndex::nearestColorIndexAVX2(int r, int g, int b) const {
+#if defined(AGACONV_NEAREST_COLOR_AVX2)
+  // Distance (at most 3*255*255, 18 bits) and index are combined in one key,
+  // the smallest key is the nearest color with the lowest index
+  const __m256i red=_mm256_set1_epi32(r), green=_mm256_set1_epi32(g), blue=_mm256_set1_epi32(b);
+  const __m256i step=_mm256_set1_epi32(8);
+  __m256i indexes=_mm256_setr_epi32(0,1,2,3,4,5,6,7);
+  __m256i nearestKeys=_mm256_set1_epi32(std::numeric_limits<int>::max());
+  for(size_t i=0;i<_red.size();i+=8) {
+    __m256i dr=_mm256_sub_epi32(red, _mm256_loadu_si256((const __m256i*)&_red[i]));
+    __m256i dg=_mm256_sub_epi32(green, _mm256_loadu_si256((const __m256i*)&_green[i]));
+    __m256i db=_mm256_sub_epi32(blue, _mm256_loadu_si256((const __m256i*)&_blue[i]));
+    __m256i distances=_mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dr, dr), _mm256_mullo_epi32(dg, dg)), _mm256_mullo_epi32(db, db));
+    nearestKeys=_mm256_min_epi32(nearestKeys, _mm256_or_si256(_mm256_slli_epi32(distances, 8), indexes));
+    indexes=_mm256_add_epi32(indexes, step);
+  }
+  __m128i keys=_mm_min_epi32(_mm256_castsi256_si128(nearestKeys), _mm256_extracti128_si256(nearestKeys, 1));
+  keys=_mm_min_epi32(keys, _mm_shuffle_epi32(keys, 0x4E));
+  keys=_mm_min_epi32(keys, _mm_shuffle_epi32(keys, 0xB1));
+  return _mm_cvtsi128_si32(keys)&0xFF;
+#else
+  return nearestColorIndexExhaustive(r, g, b);
+#endif
+}
+
+// Minimum and maximum distance of a color component to the range [low,high]
+static void componentDistances(int value, int low, int high, int& minDistance, int& maxDistance) {
+  if(value<low)
+    minDistance=low-value;
+  else if(value>high)
+    minDistance=value-high;
+  else
+    minDistance=0;
+  maxDistance=std::max(std::abs(value-low),std::abs(value-high));
+}
+
+void NearestColorIndex::buildCell(int cellRed, int cellGreen, int cellBlue, Cell& cell) const {
+  int lowRed=cellRed*cellSize, lowGreen=cellGreen*cellSize, lowBlue=cellBlue*cellSize;
+  size_t numColors=_palette.size();
+  vector<int> minDistances(numColors);
+  int smallestMaxDistance=std::numeric_limits<int>::max();
+  for(size_t i=0;i<numColors;i++) {
+    int minRed, maxRed, minGreen, maxGreen, minBlue, maxBlue;
+    componentDistances(_red[i], lowRed, lowRed+cellSize-1, minRed, maxRed);
+    componentDistances(_green[i], lowGreen, lowGreen+cellSize-1, minGreen, maxGreen);
+    componentDistances(_blue[i], lowBlue, lowBlue+cellSize-1, minBlue, maxBlue);
+    minDistances[i]=minRed*minRed+minGreen*minGreen+minBlue*minBlue;
+    smallestMaxDistance=std::min(smallestMaxDistance, maxRed*maxRed+maxGreen*maxGreen+maxBlue*maxBlue);
+  }
+  for(size_t i=0;i<numColors;i++) {
+    if(minDistances[i]<=smallestMaxDistance)
+      cell.candidates.push_back((UBYTE)i);
+  }
+}
+
+} // namespace AGAConv
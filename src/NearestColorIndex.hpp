@@ -0,0 +1,85 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef NEAREST_COLOR_INDEX_HPP
+#define NEAREST_COLOR_INDEX_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "AmigaTypeDefs.hpp"
+#include "RGBColor.hpp"
+
+namespace AGAConv {
+
+/* Index for finding the nearest palette color (Euclidean distance in
+   RGB space) of arbitrary 24 bit colors. The RGB cube is divided into
+   cells with 5 bits per color channel. For each cell the list of
+   palette colors that can be nearest to any color in the cell is
+   computed on first use (a palette color is a candidate if its
+   minimum distance to the cell is not larger than the maximum
+   distance of any other palette color to the cell). A lookup then
+   only compares the candidates of one cell. The result is exactly the
+   same as of an exhaustive search, including ties (the lowest index
+   wins).
+   Small palettes (up to 64 colors) are not divided into cells, all
+   colors are compared (8 at a time with AVX2, if the CPU supports it).
+   This is faster than the cell lookup for images with many different
+   colors, where most cells are built and used only a few times.
+   An index is built once per palette and can be used by several
+   threads at the same time.
+ */
+class NearestColorIndex {
+
+ public:
+  NearestColorIndex(const std::vector<RGBColor>& palette);
+  int nearestColorIndex(int r, int g, int b) const;
+  // Exhaustive search over all palette colors (reference implementation)
+  int nearestColorIndexExhaustive(int r, int g, int b) const;
+  int getNumColors() const;
+  int getRed(int index) const;
+  int getGreen(int index) const;
+  int getBlue(int index) const;
+  const std::vector<RGBColor>& getPalette() const;
+
+ private:
+  static const std::size_t maxColorsOfFullSearch=64;
+  static const int cellBits=5;
+  static const int cellsPerChannel=1<<cellBits;
+  static const int cellSize=256/cellsPerChannel;
+  enum CellState { CELL_EMPTY, CELL_BUILDING, CELL_READY };
+  struct Cell {
+    std::atomic<int> state{CELL_EMPTY};
+    std::vector<UBYTE> candidates;
+  };
+  void buildCell(int cellRed, int cellGreen, int cellBlue, Cell& cell) const;
+  static bool isAVX2Supported();
+  // Search over all colors (the color components are padded to a multiple of 8)
+  int nearestColorIndexAVX2(int r, int g, int b) const;
+  std::vector<RGBColor> _palette;
+  std::vector<int> _red, _green, _blue;
+  bool _fullSearch;
+  bool _useAVX2;
+  std::unique_ptr<Cell[]> _cells;
+};
+
+} // namespace AGAConv
+
+#endif
@@ -4,6 +4,12 @@
 #include "OSLayerLinux.hpp"
 #include "OSLayerMacOs.hpp"
 
+#if defined(__linux__) || defined(__MACH__)
+#include <cstdlib>
+#include <sstream>
+#include <unistd.h>
+#endif
+
 namespace AGAConv {
 
 OSLayer* OSLayer::createOSLayer() {
@@ -16,4 +22,23 @@ OSLayer* OSLayer::createOSLayer() {
 #endif
 }
 
+#if defined(__linux__) || defined(__MACH__)
+bool OSLayer::isInstalledToolInSearchPath(const std::string& toolName) {
+  // Same lookup as performed when the tool is started (without running 'which' in a shell)
+  if(toolName.find('/')!=std::string::npos)
+    return access(toolName.c_str(), X_OK)==0;
+  const char* searchPath=getenv("PATH");
+  if(!searchPath)
+    return false;
+  std::stringstream searchPathStream(searchPath);
+  std::string dir;
+  while(std::getline(searchPathStream, dir, ':')) {
+    std::filesystem::path toolPath=(dir.empty()?std::filesystem::path("."):std::filesystem::path(dir))/toolName;
+    if(access(toolPath.c_str(), X_OK)==0 && !std::filesystem::is_directory(toolPath))
+      return true;
+  }
+  return false;
+}
+#endif
+
 } // namespace AGAConv
@@ -16,12 +16,21 @@ public:
   virtual std::string redirectOutputToNullDevice()=0;
   // Checks if tool is installed.
   virtual bool isInstalledTool(const std::string& toolName)=0;
+  // True if standard output is a terminal (allows to update a progress line in place)
+  virtual bool isTerminalOutput()=0;
   // Used to make tmp dir unique for parallel instances of agaconv
   virtual std::string getPidString()=0;
   // Used for determinig location of default config file
   virtual std::string getHomeDirString()=0;
   virtual std::filesystem::path getDefaultConfigFileName()=0;
+  // Directory for cached data of agaconv (e.g. extracted frames). Empty path if not available.
+  virtual std::filesystem::path getDefaultCacheDir()=0;
+  // Directory of a RAM based file system for temporary files. Empty path if not available.
+  virtual std::filesystem::path getRamDiskDir()=0;
   virtual ~OSLayer() = default;
+protected:
+  // Searches tool in the directories of the PATH environment variable (POSIX systems only)
+  static bool isInstalledToolInSearchPath(const std::string& toolName);
 private:
 };
 
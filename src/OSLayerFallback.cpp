@@ -24,6 +24,11 @@ bool OSLayerFallback::isInstalledTool(const std::string& toolName) {
   return true;
 }
 
+bool OSLayerFallback::isTerminalOutput() {
+  // Progress is not shown (no assumptions about the terminal)
+  return false;
+}
+
 string OSLayerFallback::getPidString() {
   // Return "0" string, not guaranteed to be unique, but agaconv still uses some properties of the video such as
   // filename, colormode, width, to name the tmp dir.
@@ -35,6 +40,16 @@ std::filesystem::path OSLayerFallback::getDefaultConfigFileName() {
   return "";
 }
 
+std::filesystem::path OSLayerFallback::getDefaultCacheDir() {
+  // Unknown OS, no cache
+  return "";
+}
+
+std::filesystem::path OSLayerFallback::getRamDiskDir() {
+  // Unknown OS, temporary files are always stored on disk
+  return "";
+}
+
 string OSLayerFallback::getHomeDirString() {
   // Return empty string, supposed to be used by getDefaultConfigFileName.
   return "";
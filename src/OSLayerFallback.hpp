@@ -11,8 +11,11 @@ public:
   bool isSupported() override;
   std::string redirectOutputToNullDevice() override;
   bool isInstalledTool(const std::string& toolName) override;
+  bool isTerminalOutput() override;
   std::string getPidString() override;
   std::filesystem::path getDefaultConfigFileName() override;
+  std::filesystem::path getDefaultCacheDir() override;
+  std::filesystem::path getRamDiskDir() override;
   ~OSLayerFallback();
 protected:
   std::string getHomeDirString() override;
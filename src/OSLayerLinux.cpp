@@ -20,8 +20,11 @@ std::string OSLayerLinux::redirectOutputToNullDevice() {
 }
 
 bool OSLayerLinux::isInstalledTool(const std::string& toolName) {
-   std::string testCommand="which "+toolName+" > /dev/null 2>&1";
-   return std::system(testCommand.c_str())==0;
+  return isInstalledToolInSearchPath(toolName);
+}
+
+bool OSLayerLinux::isTerminalOutput() {
+  return isatty(STDOUT_FILENO);
 }
 
 string OSLayerLinux::getPidString() {
@@ -45,6 +48,30 @@ path OSLayerLinux::getDefaultConfigFileName() {
   return filePath;
 }
 
+path OSLayerLinux::getDefaultCacheDir() {
+  // XDG base directory specification
+  path cacheDir;
+  const char* xdgCacheHome=getenv("XDG_CACHE_HOME");
+  if(xdgCacheHome && xdgCacheHome[0]=='/') {
+    cacheDir=xdgCacheHome;
+  } else {
+    path homePath=getHomeDirString();
+    if(homePath.empty())
+      return path();
+    cacheDir=homePath/".cache";
+  }
+  return cacheDir/defaultConfigAgaConvDir;
+}
+
+path OSLayerLinux::getRamDiskDir() {
+  // tmpfs, available on all common Linux distributions
+  path ramDiskDir("/dev/shm");
+  std::error_code ec;
+  if(std::filesystem::is_directory(ramDiskDir,ec))
+    return ramDiskDir;
+  return path();
+}
+
 }
 
 #endif  // __linux__
@@ -20,8 +20,11 @@ std::string OSLayerMacOs::redirectOutputToNullDevice() {
 }
 
 bool OSLayerMacOs::isInstalledTool(const std::string& toolName) {
-   std::string testCommand="which "+toolName+" > /dev/null 2>&1";
-   return std::system(testCommand.c_str())==0;
+  return isInstalledToolInSearchPath(toolName);
+}
+
+bool OSLayerMacOs::isTerminalOutput() {
+  return isatty(STDOUT_FILENO);
 }
 
 string OSLayerMacOs::getPidString() {
@@ -44,6 +47,18 @@ path OSLayerMacOs::getDefaultConfigFileName() {
   return filePath;
 }
 
+path OSLayerMacOs::getDefaultCacheDir() {
+  path homePath=getHomeDirString();
+  if(homePath.empty())
+    return path();
+  return homePath/"Library"/"Caches"/"agaconv";
+}
+
+path OSLayerMacOs::getRamDiskDir() {
+  // MacOS has no RAM disk by default
+  return path();
+}
+
 }
 
 #endif  // __MACH__
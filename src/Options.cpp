@@ -20,9 +20,13 @@
 
 #include <vector>
 #include <cassert>
+#include <cctype>
+#include <cmath>
+#include <regex>
 #include <unordered_map>
 
 #include "AGAConvException.hpp"
+#include "FrameDitherer.hpp"
 #include "Util.hpp"
 
 using namespace std;
@@ -131,6 +135,10 @@ std::filesystem::path Options::getTmpDirSndFileName() const {
   return getTmpDirName()/sndFileName;
 }
 
+std::filesystem::path Options::getTmpDirWavFileName() const {
+  return getTmpDirName()/"audio_track.wav";
+}
+
 void Options::valueConsistencyChecks() {
   if(colorMode=="auto"||fps==autoValue||frequency==autoValue||hcHamQuality==autoValue) {
     throw AGAConvException(55, "color_mode, fps, frequency, or hc_ham_quality is set to 'auto'. Not supported.");
@@ -333,11 +341,11 @@ void Options::checkAndSetColorMode() {
           if(numPlanes==6) {
             foundValidConfig=true;
             colorModeEnum=config.colorModeEnum;
-            conversionTool="ham_convert"; // HAM can only be converted with ham_convert
+            conversionTool=hamConversionTool();
           } else if(numPlanes==8) {
             foundValidConfig=true;
             colorModeEnum=config.colorModeEnum;
-            conversionTool="ham_convert"; // HAM can only be converted with ham_convert
+            conversionTool=hamConversionTool();
           } else {
             foundValidConfig=false;
           }
@@ -350,8 +358,7 @@ void Options::checkAndSetColorMode() {
     foundValidConfig=true;
     numPlanes=6;
     colorModeEnum=CM_EHB;
-    // EHB can only be converted with ham_convert
-    conversionTool="ham_convert";
+    conversionTool=hamConversionTool();
   }
   if(numPlanes==0) {
     throw AGAConvException(57, "wrong number of planes requested in color mode "+colorMode+".");
@@ -412,6 +419,191 @@ void Options::checkAndAdjustFrequencyFor32BitAlignedAudioChunk() {
   }
 }
 
+uint64_t Options::hcJvmHeapSizeInBytes() const {
+  // Same format as java -Xmx: NUMBER with optional unit k|m|g (checked in checkHcJvmHeap)
+  std::smatch match;
+  if(!std::regex_match(hcJvmHeap, match, std::regex("([0-9]+)([kKmMgG]?)")))
+    return 0;
+  uint64_t size=std::stoull(match[1]);
+  switch(std::tolower(match.str(2).empty()?' ':match.str(2)[0])) {
+  case 'k': return size<<10;
+  case 'm': return size<<20;
+  case 'g': return size<<30;
+  default: return size;
+  }
+}
+
+void Options::checkHcJvmHeap() {
+  if(hcJvmHeapSizeInBytes()==0) {
+    throw AGAConvException(204, "hc_jvm_heap: invalid heap size "+hcJvmHeap+" (expected NUMBER with optional unit k, m, or g).");
+  }
+}
+
+void Options::checkTmpStorage() {
+  if(tmpStorage!="disk" && tmpStorage!="ram") {
+    throw AGAConvException(205,"unknown tmp storage: "+tmpStorage+" (expected disk or ram).");
+  }
+}
+
+void Options::checkAndSetFrameTransfer() {
+  // Frames can only be streamed when ffmpeg generates the final paletted frames or frames are converted in-process
+  if(pipeFrames && conversionTool!="ffmpeg" && conversionTool!="native") {
+    pipeFrames=false;
+    if(verbose>=1)
+      cout<<"Note: frames cannot be streamed to "<<conversionTool<<". Using PNG files in tmp dir."<<endl;
+  }
+  // Other conversion tools process all frames at once (batch), streamed frames are always encoded during extraction
+  if(overlapEncoding && ((conversionTool!="ffmpeg" && conversionTool!="native") || pipeFrames)) {
+    overlapEncoding=false;
+  }
+  // A stream of frames is produced by one ffmpeg process
+  if(extractJobs>1 && pipeFrames) {
+    extractJobs=1;
+    if(verbose>=1)
+      cout<<"Note: frames streamed through a pipe are extracted with one ffmpeg process."<<endl;
+  }
+  // Output variants share the PNG files of one ffmpeg process
+  if(variantSpecs.size()>0 && (pipeFrames || overlapEncoding || extractionCache)) {
+    pipeFrames=false;
+    overlapEncoding=false;
+    extractionCache=false;
+    if(verbose>=1)
+      cout<<"Note: output variants are generated from PNG files in tmp dir (no streaming, overlapped encoding, or extraction cache)."<<endl;
+  }
+  // Streamed frames are not stored as files
+  if(extractionCache && pipeFrames) {
+    extractionCache=false;
+    if(verbose>=1)
+      cout<<"Note: extraction cache is not used for frames streamed through a pipe."<<endl;
+  }
+}
+
+uint32_t Options::startFrame() const {
+  return (uint32_t)std::lround(start*fps);
+}
+
+uint32_t Options::durationFrames() const {
+  return (uint32_t)std::lround(duration*fps);
+}
+
+void Options::checkStartAndDuration() {
+  if(start<0.0) {
+    throw AGAConvException(206,"start time must not be negative.");
+  }
+  if(duration<0.0) {
+    throw AGAConvException(207,"duration must not be negative.");
+  }
+  if(duration>0.0 && durationFrames()==0) {
+    throw AGAConvException(208,"duration is shorter than one frame (1/"+std::to_string(fps)+" seconds).");
+  }
+}
+
+std::string Options::hamConversionTool() const {
+  // ham_convert is only used if it is available and the native encoder is not requested
+  if(quantizer=="native" || hcPath=="")
+    return "native";
+  return "ham_convert";
+}
+
+bool Options::nativeQuantizer() const {
+  // Other conversion tools generate their own palettes
+  return (quantizer=="native" && conversionTool=="ffmpeg") || conversionTool=="native";
+}
+
+bool Options::nativeScaler() const {
+  // Frames are scaled before they are quantized
+  return scaler!="ffmpeg" && nativeQuantizer();
+}
+
+void Options::checkScaler() {
+  if(scaler!="ffmpeg" && scaler!="lanczos" && scaler!="bicubic") {
+    throw AGAConvException(223,"unknown scaler: "+scaler+" (expected ffmpeg, lanczos, or bicubic).");
+  }
+  if(scaler!="ffmpeg" && !nativeQuantizer()) {
+    throw AGAConvException(224,"scaler "+scaler+" requires --quantizer=native (or a native HAM or EHB conversion).");
+  }
+}
+
+bool Options::nativeResampler() const {
+  return resampler=="native";
+}
+
+void Options::checkResampler() {
+  if(resampler!="ffmpeg" && resampler!="native") {
+    throw AGAConvException(225,"unknown resampler: "+resampler+" (expected ffmpeg or native).");
+  }
+}
+
+bool Options::libavDecoder() const {
+#ifdef AGACONV_LIBAV
+  // Only used when requested (auto selects the ffmpeg tool until the libav decoder has been tested with FFmpeg installations).
+  // The libav decoder provides truecolor frames only (checked in checkDecoder)
+  return decoder=="libav" && nativeQuantizer();
+#else
+  return false;
+#endif
+}
+
+void Options::checkDecoder() {
+  if(decoder!="auto" && decoder!="cli" && decoder!="libav") {
+    throw AGAConvException(226,"unknown decoder: "+decoder+" (expected auto, cli, or libav).");
+  }
+#ifndef AGACONV_LIBAV
+  if(decoder=="libav") {
+    throw AGAConvException(227,"decoder libav is not available (agaconv was built without libav support, see 'make LIBAV=1').");
+  }
+#endif
+  if(decoder=="libav" && !nativeQuantizer()) {
+    throw AGAConvException(228,"decoder libav requires --quantizer=native (or a native HAM or EHB conversion).");
+  }
+}
+
+uint32_t Options::autoHeightDivisor() const {
+  if(resMode==GFX_UNSPECIFIED || screenModeLace)
+    return 1;
+  assert(resMode!=GFX_AUTO);
+  if(resMode==GFX_SUPERHIRES)
+    return 4;
+  else if(resMode==GFX_HIRES)
+    return 2;
+  else
+    return 1;
+}
+
+uint32_t Options::scaledHeight(uint32_t inWidth, uint32_t inHeight) const {
+  if(height!=autoValue)
+    return height;
+  // Same computation as ffmpeg performs for the height expression of ExternalToolDriver::ffmpegHeightExpression
+  // (the expression is evaluated as double and truncated by ffmpeg's scale filter)
+  double yScale=std::stod(std::to_string(yScaleFactor)); // Same precision as in expression
+  double scaledHeight=((double)inHeight/autoHeightDivisor())/((double)inWidth/width)*yScale;
+  if(scaledHeight<1.0) {
+    throw AGAConvException(81, "computed video height of "+std::to_string(scaledHeight)+" is too small.");
+  }
+  return (uint32_t)scaledHeight;
+}
+
+bool Options::scenePalettes() const {
+  return paletteMode=="scene" && nativeQuantizer() && conversionTool=="ffmpeg";
+}
+
+void Options::checkQuantizer() {
+  if(quantizer!="ffmpeg" && quantizer!="native") {
+    throw AGAConvException(209,"unknown quantizer: "+quantizer+" (expected ffmpeg or native).");
+  }
+  FrameDitherer::DitherMethod ditherMethod;
+  uint32_t bayerScale;
+  if(nativeQuantizer() && colorModeEnum!=CM_HAM && !FrameDitherer::parseDitherMode(ditherMode, ffBayerScale, ditherMethod, bayerScale)) {
+    throw AGAConvException(220,"dither mode "+ditherMode+" is not supported by the native quantizer (supported: none|floyd_steinberg|sierra2|sierra2_4a|bayer|bayer:bayer_scale=0..5).");
+  }
+  if(paletteMode!="frame" && paletteMode!="scene") {
+    throw AGAConvException(221,"unknown palette mode: "+paletteMode+" (expected frame or scene).");
+  }
+  if(paletteMode=="scene" && !scenePalettes()) {
+    throw AGAConvException(222,"palette mode scene requires --quantizer=native and an AGA or OCS color mode.");
+  }
+}
+
 bool Options::isStdCdxl() const {
   return fixedFrames
     ||(getPaddingMode()==PAD_UNSPECIFIED)
@@ -495,6 +687,14 @@ void Options::checkAndSetOptions() {
   checkAndSetScreenMode();
   checkVideoDimensionStride();
   checkAndSetAdjustAspect();
+  checkAndSetFrameTransfer(); // requires checkAndSetColorMode
+  checkHcJvmHeap();
+  checkTmpStorage();
+  checkStartAndDuration();
+  checkQuantizer();
+  checkScaler();
+  checkResampler();
+  checkDecoder();
 
   // Handle audio
   checkAndSetAudioDataType();
@@ -24,6 +24,7 @@
 #include <iostream>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "Util.hpp"
 
@@ -65,6 +66,10 @@ struct Options {
   uint32_t width=320;
   uint32_t height=autoValue;
   double yScaleFactor=1.0;
+  // Lores pixels are the reference, hires pixels are half and superhires pixels are a quarter as wide (not for lace)
+  uint32_t autoHeightDivisor() const;
+  // Height of the frames scaled from an input video of the given dimensions (height 'auto' mode: keeps the aspect ratio)
+  uint32_t scaledHeight(uint32_t inWidth, uint32_t inHeight) const;
   uint8_t numPlanes=0; // Internal, set by colorMode
   std::string formatName="std-opt"; // default
   enum FORMAT { FMT_UNSPECIFIED, FMT_CTM_OPT, FMT_STD_OPT, FMT_STD_FIXED };
@@ -78,11 +83,31 @@ struct Options {
   
   // Generate standard CDXL file with 24-bit RGB888 color palette and fixed frame size
   uint32_t ffBayerScale=4; // --ff-bayer-scale=NUMBER] 0..5 (default:4)
+  std::string quantizer="ffmpeg"; // ffmpeg|native (palette generation with ffmpeg or in-process, HAM and EHB encoding with ham_convert or in-process)
+  uint32_t quantizerKMeans=0; // Number of k-means iterations refining the palette of the native quantizer
+  bool nativeQuantizer() const;
+  std::string scaler="ffmpeg"; // ffmpeg|lanczos|bicubic (scaling with ffmpeg or in-process, requires the native quantizer)
+  bool nativeScaler() const;
+  std::string resampler="ffmpeg"; // ffmpeg|native (resampling of the audio data with ffmpeg or in-process)
+  bool nativeResampler() const;
+  std::string decoder="auto"; // auto|cli|libav (decoding with the ffmpeg tool or in-process with libav, if built with libav; auto: cli)
+  // True if the input video is decoded in-process with libav
+  bool libavDecoder() const;
+  std::string paletteMode="frame"; // frame|scene (one palette per frame or one palette per scene with the native quantizer)
+  uint32_t sceneThreshold=30; // Difference of color histograms (in percent) of consecutive frames detected as scene cut
+  uint32_t sceneMaxFrames=48; // Maximum number of frames sharing one palette (frames of a scene are kept in memory)
+  bool scenePalettes() const;
   std::string extractionTool="ffmpeg";
-  std::string conversionTool="ffmpeg"; // + ham_convert
+  std::string conversionTool="ffmpeg"; // + ham_convert, native (frames extracted with ffmpeg, converted in-process)
+  std::string hamConversionTool() const;
   uint32_t fixedFrameDigits=4; // Used with ffmpeg
   std::filesystem::path tmpDir=std::string("tmp-agaconv");
+  std::string tmpStorage="disk"; // disk|ram (RAM disk if enough space is available, disk otherwise)
   std::string hamConvertBatchFileName="ham_convert_batch_file.txt";
+  bool extractionCache=false; // Reuse extracted frames and audio of previous runs
+  std::filesystem::path cacheDir=""; // Empty: OS specific default cache dir
+  std::filesystem::path cacheDirResolved="";
+  uint32_t cacheSize=4096; // Maximum size of the extraction cache in MB
 
   // ham_convert options
   std::filesystem::path hcPath="";
@@ -92,6 +117,9 @@ struct Options {
   uint32_t hcPropagation=autoValue;
   uint32_t hcDiversity=autoValue;
   std::string hcQuant="auto"; // "wu"
+  uint32_t hcJobs=1; // Number of JVMs converting frames in parallel
+  std::string hcJvmHeap="2g"; // Maximum heap size of each JVM (java -Xmx)
+  uint64_t hcJvmHeapSizeInBytes() const;
   
   ///////////////////////////////////
   // Original agaconv-encode options
@@ -116,6 +144,11 @@ struct Options {
   uint32_t colorDepthBits=autoValue;
   enum COLOR_DEPTH { COL_12BIT, COL_24BIT } colorDepth=COL_24BIT;
   uint32_t fps=24;
+  double start=0.0; // Start of converted segment of the input video in seconds
+  double duration=0.0; // Duration of converted segment in seconds (0: until end of input video)
+  // Start and duration in number of frames (start and duration are rounded to the frame grid)
+  uint32_t startFrame() const;
+  uint32_t durationFrames() const;
   // Default, irrelevant for CDXL, only relevant for ANIM
   uint32_t playRate=162;
   bool installDefaultConfigFile=false;
@@ -153,6 +186,8 @@ struct Options {
   bool debug=false;
   // Eliminates empty bitplanes, remaps colors. Must also be on for fixedPlanesFlag (which are filled after all empty ones are removed)
   bool optimizePngPalette=true;
+  // Merges palette colors that become identical in 12 bit color depth (requires optimizePngPalette)
+  bool merge12BitColors=true;
 
   // Control flags for CDXL type (STD, STD+ or CTM)
   /* fixedFrames optimize Mode
@@ -183,8 +218,22 @@ struct Options {
   std::filesystem::path getTmpDirName() const;
   void setTmpDirName(std::filesystem::path name);
   std::filesystem::path getTmpDirSndFileName() const;
+  // Audio data extracted at the original frequency (native resampler)
+  std::filesystem::path getTmpDirWavFileName() const;
   void checkAndSetOptions();
   bool keepTmpFiles=false;
+  // Stream frames from ffmpeg through a pipe instead of writing PNG files into the tmp dir
+  bool pipeFrames=false;
+  // Encode PNG frames while ffmpeg is still writing frames into the tmp dir
+  bool overlapEncoding=false;
+  // Number of ffmpeg processes extracting frames of consecutive time ranges in parallel
+  uint32_t extractJobs=1;
+  // Number of frames loaded and converted in parallel ahead of the encoded frame (0: number of CPU cores)
+  uint32_t jobs=0;
+  // Additional output files (FILE[:OPTION=VALUE,...]) generated from the same extracted frames
+  std::vector<std::string> variantSpecs;
+  // Options of the output variants (resolved from variantSpecs by the command line parser)
+  std::vector<Options> variants;
   bool blackAndWhite=false;
   std::string adjustAspectSelectorName1="hdstretched";
   double adjustAspectSelectorValue1=1.35;
@@ -207,6 +256,14 @@ private:
   void handleAutoScreenMode();
   void checkAndAdjustFrequencyFor32BitAlignedAudioChunk();
   void checkAndSetFixedPlanes();
+  void checkAndSetFrameTransfer();
+  void checkHcJvmHeap();
+  void checkTmpStorage();
+  void checkStartAndDuration();
+  void checkQuantizer();
+  void checkScaler();
+  void checkResampler();
+  void checkDecoder();
   void checkImpossibleCombinations();
 };
 
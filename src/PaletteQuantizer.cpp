@@ -0,0 +1,393 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "PaletteQuantizer.hpp"
+
+#include <cassert>
+#include <limits>
+
+using namespace std;
+
+namespace AGAConv {
+
+PaletteQuantizer::PaletteQuantizer(uint32_t maxColors, uint32_t kmeansIterations, bool colors12Bit):
+  _maxColors(maxColors),
+  _kmeansIterations(kmeansIterations),
+  _colors12Bit(colors12Bit) {
+  assert(maxColors>=1 && maxColors<=256);
+}
+
+int PaletteQuantizer::cellIndex(int r, int g, int b) {
+  return (r*histogramSize+g)*histogramSize+b;
+}
+
+void PaletteQuantizer::quantize(UBYTE** rows, int width, int height, int bytesPerPixel, std::vector<RGBColor>& palette, UBYTE** indexRows) {
+  computePalette(rows, width, height, bytesPerPixel, palette);
+  mapToPalette(rows, width, height, bytesPerPixel, indexRows);
+}
+
+void PaletteQuantizer::computePalette(UBYTE** rows, int width, int height, int bytesPerPixel, std::vector<RGBColor>& palette) {
+  clearHistogram();
+  addToHistogram(rows, width, height, bytesPerPixel);
+  computePalette(palette);
+}
+
+void PaletteQuantizer::computePalette(std::vector<RGBColor>& palette) {
+  computeCumulativeMoments();
+  palette.clear();
+  partition(palette);
+  if(_kmeansIterations>0)
+    refineWithKMeans(palette);
+  if(_colors12Bit) {
+    // Box means are reduced to the colors stored in the 12 bit palette
+    for(auto& color : palette) {
+      color=RGBColor(RGBColor::convert4BitTo8Bit(RGBColor::convert8BitTo4Bit(color.getRed())),
+                     RGBColor::convert4BitTo8Bit(RGBColor::convert8BitTo4Bit(color.getGreen())),
+                     RGBColor::convert4BitTo8Bit(RGBColor::convert8BitTo4Bit(color.getBlue())));
+    }
+  }
+}
+
+void PaletteQuantizer::mapToPalette(UBYTE** rows, int width, int height, int bytesPerPixel, UBYTE** indexRows) {
+  for(int y=0;y<height;y++) {
+    UBYTE* pixel=rows[y];
+    UBYTE* index=indexRows[y];
+    for(int x=0;x<width;x++) {
+      index[x]=_cellPaletteIndex[cellIndex((pixel[0]>>3)+1, (pixel[1]>>3)+1, (pixel[2]>>3)+1)];
+      pixel+=bytesPerPixel;
+    }
+  }
+}
+
+void PaletteQuantizer::clearHistogram() {
+  _cellWeight.assign(histogramCells, 0);
+  _cellRed.assign(histogramCells, 0);
+  _cellGreen.assign(histogramCells, 0);
+  _cellBlue.assign(histogramCells, 0);
+  _cellSquares.assign(histogramCells, 0.0);
+}
+
+void PaletteQuantizer::addToHistogram(UBYTE** rows, int width, int height, int bytesPerPixel) {
+  assert(bytesPerPixel==3 || bytesPerPixel==4);
+  assert(_cellWeight.size()==histogramCells);
+  for(int y=0;y<height;y++) {
+    UBYTE* pixel=rows[y];
+    for(int x=0;x<width;x++) {
+      int r=pixel[0], g=pixel[1], b=pixel[2];
+      if(_colors12Bit) {
+        // 12 bit colors are in distinct histogram cells (c*17>>3)
+        r=RGBColor::convert4BitTo8Bit(RGBColor::convert8BitTo4Bit((UBYTE)r));
+        g=RGBColor::convert4BitTo8Bit(RGBColor::convert8BitTo4Bit((UBYTE)g));
+        b=RGBColor::convert4BitTo8Bit(RGBColor::convert8BitTo4Bit((UBYTE)b));
+      }
+      int index=cellIndex((r>>3)+1, (g>>3)+1, (b>>3)+1);
+      _cellWeight[index]++;
+      _cellRed[index]+=r;
+      _cellGreen[index]+=g;
+      _cellBlue[index]+=b;
+      _cellSquares[index]+=(double)(r*r+g*g+b*b);
+      pixel+=bytesPerPixel;
+    }
+  }
+}
+
+void PaletteQuantizer::computeCumulativeMoments() {
+  _weight=_cellWeight;
+  _sumRed=_cellRed;
+  _sumGreen=_cellGreen;
+  _sumBlue=_cellBlue;
+  _sumSquares=_cellSquares;
+  // After this step each cell contains the moments of the box from (0,0,0) to the cell (inclusive)
+  for(int r=1;r<histogramSize;r++) {
+    int64_t area[histogramSize]={}, areaRed[histogramSize]={}, areaGreen[histogramSize]={}, areaBlue[histogramSize]={};
+    double areaSquares[histogramSize]={};
+    for(int g=1;g<histogramSize;g++) {
+      int64_t line=0, lineRed=0, lineGreen=0, lineBlue=0;
+      double lineSquares=0.0;
+      for(int b=1;b<histogramSize;b++) {
+        int index=cellIndex(r,g,b);
+        line+=_weight[index];
+        lineRed+=_sumRed[index];
+        lineGreen+=_sumGreen[index];
+        lineBlue+=_sumBlue[index];
+        lineSquares+=_sumSquares[index];
+        area[b]+=line;
+        areaRed[b]+=lineRed;
+        areaGreen[b]+=lineGreen;
+        areaBlue[b]+=lineBlue;
+        areaSquares[b]+=lineSquares;
+        int previous=cellIndex(r-1,g,b);
+        _weight[index]=_weight[previous]+area[b];
+        _sumRed[index]=_sumRed[previous]+areaRed[b];
+        _sumGreen[index]=_sumGreen[previous]+areaGreen[b];
+        _sumBlue[index]=_sumBlue[previous]+areaBlue[b];
+        _sumSquares[index]=_sumSquares[previous]+areaSquares[b];
+      }
+    }
+  }
+}
+
+template<typename T> T PaletteQuantizer::volume(const Box& box, const std::vector<T>& moment) const {
+  return moment[cellIndex(box.r1,box.g1,box.b1)]
+    -moment[cellIndex(box.r1,box.g1,box.b0)]
+    -moment[cellIndex(box.r1,box.g0,box.b1)]
+    +moment[cellIndex(box.r1,box.g0,box.b0)]
+    -moment[cellIndex(box.r0,box.g1,box.b1)]
+    +moment[cellIndex(box.r0,box.g1,box.b0)]
+    +moment[cellIndex(box.r0,box.g0,box.b1)]
+    -moment[cellIndex(box.r0,box.g0,box.b0)];
+}
+
+// Part of the volume that does not depend on the cut position in direction dir
+template<typename T> T PaletteQuantizer::bottom(const Box& box, Direction dir, const std::vector<T>& moment) const {
+  switch(dir) {
+  case DIR_RED:
+    return -moment[cellIndex(box.r0,box.g1,box.b1)]
+      +moment[cellIndex(box.r0,box.g1,box.b0)]
+      +moment[cellIndex(box.r0,box.g0,box.b1)]
+      -moment[cellIndex(box.r0,box.g0,box.b0)];
+  case DIR_GREEN:
+    return -moment[cellIndex(box.r1,box.g0,box.b1)]
+      +moment[cellIndex(box.r1,box.g0,box.b0)]
+      +moment[cellIndex(box.r0,box.g0,box.b1)]
+      -moment[cellIndex(box.r0,box.g0,box.b0)];
+  case DIR_BLUE:
+    return -moment[cellIndex(box.r1,box.g1,box.b0)]
+      +moment[cellIndex(box.r1,box.g0,box.b0)]
+      +moment[cellIndex(box.r0,box.g1,box.b0)]
+      -moment[cellIndex(box.r0,box.g0,box.b0)];
+  }
+  assert(false);
+  return 0;
+}
+
+// Part of the volume of the lower half that depends on the cut position pos in direction dir
+template<typename T> T PaletteQuantizer::top(const Box& box, Direction dir, int pos, const std::vector<T>& moment) const {
+  switch(dir) {
+  case DIR_RED:
+    return moment[cellIndex(pos,box.g1,box.b1)]
+      -moment[cellIndex(pos,box.g1,box.b0)]
+      -moment[cellIndex(pos,box.g0,box.b1)]
+      +moment[cellIndex(pos,box.g0,box.b0)];
+  case DIR_GREEN:
+    return moment[cellIndex(box.r1,pos,box.b1)]
+      -moment[cellIndex(box.r1,pos,box.b0)]
+      -moment[cellIndex(box.r0,pos,box.b1)]
+      +moment[cellIndex(box.r0,pos,box.b0)];
+  case DIR_BLUE:
+    return moment[cellIndex(box.r1,box.g1,pos)]
+      -moment[cellIndex(box.r1,box.g0,pos)]
+      -moment[cellIndex(box.r0,box.g1,pos)]
+      +moment[cellIndex(box.r0,box.g0,pos)];
+  }
+  assert(false);
+  return 0;
+}
+
+double PaletteQuantizer::variance(const Box& box) const {
+  double dr=(double)volume(box,_sumRed);
+  double dg=(double)volume(box,_sumGreen);
+  double db=(double)volume(box,_sumBlue);
+  double squares=volume(box,_sumSquares);
+  return squares-(dr*dr+dg*dg+db*db)/(double)volume(box,_weight);
+}
+
+// Returns the maximum of the sum of the squared means of both halves (weighted) and the position of the cut (-1 if no cut exists)
+double PaletteQuantizer::maximize(const Box& box, Direction dir, int first, int last, int& cutPos, int64_t wholeR, int64_t wholeG, int64_t wholeB, int64_t wholeW) const {
+  int64_t baseR=bottom(box,dir,_sumRed);
+  int64_t baseG=bottom(box,dir,_sumGreen);
+  int64_t baseB=bottom(box,dir,_sumBlue);
+  int64_t baseW=bottom(box,dir,_weight);
+  double max=0.0;
+  cutPos=-1;
+  for(int i=first;i<last;i++) {
+    int64_t halfR=baseR+top(box,dir,i,_sumRed);
+    int64_t halfG=baseG+top(box,dir,i,_sumGreen);
+    int64_t halfB=baseB+top(box,dir,i,_sumBlue);
+    int64_t halfW=baseW+top(box,dir,i,_weight);
+    // The lower half is never empty after a cut
+    if(halfW==0)
+      continue;
+    double temp=((double)halfR*halfR+(double)halfG*halfG+(double)halfB*halfB)/halfW;
+    halfR=wholeR-halfR;
+    halfG=wholeG-halfG;
+    halfB=wholeB-halfB;
+    halfW=wholeW-halfW;
+    // Neither is the upper half
+    if(halfW==0)
+      continue;
+    temp+=((double)halfR*halfR+(double)halfG*halfG+(double)halfB*halfB)/halfW;
+    if(temp>max) {
+      max=temp;
+      cutPos=i;
+    }
+  }
+  return max;
+}
+
+bool PaletteQuantizer::cut(Box& box1, Box& box2) const {
+  int64_t wholeR=volume(box1,_sumRed);
+  int64_t wholeG=volume(box1,_sumGreen);
+  int64_t wholeB=volume(box1,_sumBlue);
+  int64_t wholeW=volume(box1,_weight);
+  int cutR, cutG, cutB;
+  double maxR=maximize(box1,DIR_RED,box1.r0+1,box1.r1,cutR,wholeR,wholeG,wholeB,wholeW);
+  double maxG=maximize(box1,DIR_GREEN,box1.g0+1,box1.g1,cutG,wholeR,wholeG,wholeB,wholeW);
+  double maxB=maximize(box1,DIR_BLUE,box1.b0+1,box1.b1,cutB,wholeR,wholeG,wholeB,wholeW);
+  Direction dir;
+  if(maxR>=maxG && maxR>=maxB) {
+    dir=DIR_RED;
+    // Box cannot be split
+    if(cutR<0)
+      return false;
+  } else if(maxG>=maxR && maxG>=maxB) {
+    dir=DIR_GREEN;
+  } else {
+    dir=DIR_BLUE;
+  }
+  box2.r1=box1.r1;
+  box2.g1=box1.g1;
+  box2.b1=box1.b1;
+  switch(dir) {
+  case DIR_RED:
+    box2.r0=box1.r1=cutR;
+    box2.g0=box1.g0;
+    box2.b0=box1.b0;
+    break;
+  case DIR_GREEN:
+    box2.g0=box1.g1=cutG;
+    box2.r0=box1.r0;
+    box2.b0=box1.b0;
+    break;
+  case DIR_BLUE:
+    box2.b0=box1.b1=cutB;
+    box2.r0=box1.r0;
+    box2.g0=box1.g0;
+    break;
+  }
+  box1.volume=(box1.r1-box1.r0)*(box1.g1-box1.g0)*(box1.b1-box1.b0);
+  box2.volume=(box2.r1-box2.r0)*(box2.g1-box2.g0)*(box2.b1-box2.b0);
+  return true;
+}
+
+void PaletteQuantizer::partition(std::vector<RGBColor>& palette) {
+  vector<Box> boxes(_maxColors);
+  vector<double> boxVariance(_maxColors, 0.0);
+  boxes[0]={0,histogramSize-1,0,histogramSize-1,0,histogramSize-1,0};
+  uint32_t numBoxes=1;
+  uint32_t next=0;
+  // Always split the box with the largest variance
+  for(uint32_t i=1;i<_maxColors;i++) {
+    if(cut(boxes[next],boxes[i])) {
+      boxVariance[next]=(boxes[next].volume>1)?variance(boxes[next]):0.0;
+      boxVariance[i]=(boxes[i].volume>1)?variance(boxes[i]):0.0;
+      numBoxes=i+1;
+    } else {
+      boxVariance[next]=0.0;
+      i--;
+    }
+    next=0;
+    double maxVariance=boxVariance[0];
+    for(uint32_t k=1;k<=i;k++) {
+      if(boxVariance[k]>maxVariance) {
+        maxVariance=boxVariance[k];
+        next=k;
+      }
+    }
+    if(maxVariance<=0.0)
+      break;
+  }
+  _cellPaletteIndex.assign(histogramCells, 0);
+  for(uint32_t k=0;k<numBoxes;k++) {
+    const Box& box=boxes[k];
+    for(int r=box.r0+1;r<=box.r1;r++)
+      for(int g=box.g0+1;g<=box.g1;g++)
+        for(int b=box.b0+1;b<=box.b1;b++)
+          _cellPaletteIndex[cellIndex(r,g,b)]=(UBYTE)k;
+    int64_t weight=volume(box,_weight);
+    if(weight>0) {
+      palette.push_back(RGBColor((UBYTE)((volume(box,_sumRed)+weight/2)/weight),
+                                 (UBYTE)((volume(box,_sumGreen)+weight/2)/weight),
+                                 (UBYTE)((volume(box,_sumBlue)+weight/2)/weight)));
+    } else {
+      // Only possible for an empty frame
+      palette.push_back(RGBColor(0,0,0));
+    }
+  }
+}
+
+void PaletteQuantizer::refineWithKMeans(std::vector<RGBColor>& palette) {
+  // Cells are clustered by their mean color, weighted by their number of pixels
+  struct Cell {
+    int index;
+    double red, green, blue;
+    int64_t weight;
+  };
+  vector<Cell> cells;
+  for(int i=0;i<histogramCells;i++) {
+    if(_cellWeight[i]>0) {
+      double w=(double)_cellWeight[i];
+      cells.push_back(Cell{i,_cellRed[i]/w,_cellGreen[i]/w,_cellBlue[i]/w,_cellWeight[i]});
+    }
+  }
+  size_t k=palette.size();
+  vector<double> centerRed(k), centerGreen(k), centerBlue(k);
+  for(size_t j=0;j<k;j++) {
+    centerRed[j]=palette[j].getRed();
+    centerGreen[j]=palette[j].getGreen();
+    centerBlue[j]=palette[j].getBlue();
+  }
+  for(uint32_t iteration=0;iteration<_kmeansIterations;iteration++) {
+    vector<double> sumRed(k,0.0), sumGreen(k,0.0), sumBlue(k,0.0), sumWeight(k,0.0);
+    bool changed=false;
+    for(auto& cell : cells) {
+      double minDistance=std::numeric_limits<double>::max();
+      size_t nearest=0;
+      for(size_t j=0;j<k;j++) {
+        double dr=cell.red-centerRed[j], dg=cell.green-centerGreen[j], db=cell.blue-centerBlue[j];
+        double distance=dr*dr+dg*dg+db*db;
+        if(distance<minDistance) {
+          minDistance=distance;
+          nearest=j;
+        }
+      }
+      if(_cellPaletteIndex[cell.index]!=nearest) {
+        _cellPaletteIndex[cell.index]=(UBYTE)nearest;
+        changed=true;
+      }
+      sumRed[nearest]+=cell.red*cell.weight;
+      sumGreen[nearest]+=cell.green*cell.weight;
+      sumBlue[nearest]+=cell.blue*cell.weight;
+      sumWeight[nearest]+=cell.weight;
+    }
+    // Empty clusters keep their color
+    for(size_t j=0;j<k;j++) {
+      if(sumWeight[j]>0.0) {
+        centerRed[j]=sumRed[j]/sumWeight[j];
+        centerGreen[j]=sumGreen[j]/sumWeight[j];
+        centerBlue[j]=sumBlue[j]/sumWeight[j];
+      }
+    }
+    if(!changed && iteration>0)
+      break;
+  }
+  for(size_t j=0;j<k;j++) {
+    palette[j]=RGBColor((UBYTE)(centerRed[j]+0.5),(UBYTE)(centerGreen[j]+0.5),(UBYTE)(centerBlue[j]+0.5));
+  }
+}
+
+} // namespace AGAConv
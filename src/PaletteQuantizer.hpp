@@ -0,0 +1,95 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef PALETTE_QUANTIZER_HPP
+#define PALETTE_QUANTIZER_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "AmigaTypeDefs.hpp"
+#include "RGBColor.hpp"
+
+namespace AGAConv {
+
+/* Reduces the colors of a truecolor frame to a palette of at most
+   maxColors colors (in-process replacement of ffmpeg's palettegen
+   and paletteuse without dithering). The palette is computed with
+   Wu's variance minimizing quantizer (X. Wu, "Efficient Statistical
+   Computations for Optimal Color Quantization", Graphics Gems II) on
+   a histogram with 5 bits per color channel. Optionally, the palette
+   is refined with k-means iterations on the histogram. Without
+   dithering, each pixel is mapped to the palette color of its
+   histogram cell (see FrameDitherer for mapping with dithering).
+   A quantizer object can be used for one frame at a time, frames are
+   quantized in parallel with one quantizer per frame.
+ */
+class PaletteQuantizer {
+
+ public:
+  // With colors12Bit the palette is computed from the pixel colors reduced to 12 bit color depth and consists of 12 bit colors
+  PaletteQuantizer(uint32_t maxColors, uint32_t kmeansIterations, bool colors12Bit=false);
+  // Pixel data is given as rows of bytesPerPixel bytes per pixel (RGB, followed by an ignored byte if bytesPerPixel is 4).
+  // Writes one palette index per pixel into indexRows and the palette colors into palette.
+  void quantize(UBYTE** rows, int width, int height, int bytesPerPixel, std::vector<RGBColor>& palette, UBYTE** indexRows);
+  // Palette computation and mapping of the pixels as separate steps (mapToPalette requires computePalette for the same frame)
+  void computePalette(UBYTE** rows, int width, int height, int bytesPerPixel, std::vector<RGBColor>& palette);
+  // Palette of several frames (e.g. of a scene): the histogram is accumulated with addToHistogram for each frame
+  void clearHistogram();
+  void addToHistogram(UBYTE** rows, int width, int height, int bytesPerPixel);
+  void computePalette(std::vector<RGBColor>& palette);
+  void mapToPalette(UBYTE** rows, int width, int height, int bytesPerPixel, UBYTE** indexRows);
+
+ private:
+  // Histogram cells per color channel (32 levels plus one for the zero border of the cumulative moments)
+  static const int histogramSize=33;
+  static const int histogramCells=histogramSize*histogramSize*histogramSize;
+  enum Direction { DIR_RED, DIR_GREEN, DIR_BLUE };
+  // Box in histogram space (exclusive lower bounds, inclusive upper bounds)
+  struct Box {
+    int r0, r1;
+    int g0, g1;
+    int b0, b1;
+    int volume;
+  };
+  static int cellIndex(int r, int g, int b);
+  void computeCumulativeMoments();
+  template<typename T> T volume(const Box& box, const std::vector<T>& moment) const;
+  template<typename T> T bottom(const Box& box, Direction dir, const std::vector<T>& moment) const;
+  template<typename T> T top(const Box& box, Direction dir, int pos, const std::vector<T>& moment) const;
+  double variance(const Box& box) const;
+  double maximize(const Box& box, Direction dir, int first, int last, int& cut, int64_t wholeR, int64_t wholeG, int64_t wholeB, int64_t wholeW) const;
+  bool cut(Box& box1, Box& box2) const;
+  // Splits the color space into at most _maxColors boxes, sets the palette index of each histogram cell
+  void partition(std::vector<RGBColor>& palette);
+  void refineWithKMeans(std::vector<RGBColor>& palette);
+  uint32_t _maxColors;
+  uint32_t _kmeansIterations;
+  bool _colors12Bit;
+  // Histogram (per cell: number of pixels, sum of each color component, sum of squares of all color components)
+  std::vector<int64_t> _cellWeight, _cellRed, _cellGreen, _cellBlue;
+  std::vector<double> _cellSquares;
+  // Cumulative moments of the histogram
+  std::vector<int64_t> _weight, _sumRed, _sumGreen, _sumBlue;
+  std::vector<double> _sumSquares;
+  // Palette index of each histogram cell
+  std::vector<UBYTE> _cellPaletteIndex;
+};
+
+} // namespace AGAConv
+
+#endif
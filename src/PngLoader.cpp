@@ -28,7 +28,13 @@
 #include <string>
 
 #include "AGAConvException.hpp"
+#include "ChunkyToPlanar.hpp"
+#include "EhbPaletteQuantizer.hpp"
+#include "FrameDitherer.hpp"
+#include "HamEncoder.hpp"
+#include "NearestColorIndex.hpp"
 #include "Options.hpp"
+#include "PaletteQuantizer.hpp"
 #include "Util.hpp"
 
 using namespace std;
@@ -119,10 +125,7 @@ void PngLoader::readPngFile(char *filename) {
 #endif
 
   assert(_pngImageData==0);
-  _pngImageData = (png_bytep*)malloc(sizeof(png_bytep) * _height);
-  for(int y = 0; y < _height; y++) {
-    _pngImageData[y] = (png_byte*)malloc(png_get_rowbytes(png,info));
-  }
+  setImageBuffer(ImageBuffer::acquire((int)png_get_rowbytes(png,info), _height));
 
   png_read_image(png, _pngImageData);
 
@@ -148,32 +151,36 @@ void PngLoader::readPngFile(char *filename) {
   png_destroy_read_struct(&png, &info, NULL);
 }
 
-int PngLoader::getByteWidth() {
-  return (_width + 7) / 8;
+int PngLoader::getWidth() {
+  return _width;
 }
 
-void PngLoader::allocateIntermediateBitplanes(char**& bitplanes, int numBitPlanes) {
-  bitplanes = (char**)malloc(sizeof(void*)*numBitPlanes);
-  for (int i = 0; i < numBitPlanes; i++) {
-    bitplanes[i] = (char*)calloc(getByteWidth()*_height, 1);
-  }
+int PngLoader::getHeight() {
+  return _height;
 }
 
-void PngLoader::freeIntermediateBitplanes(char** bitplanes, int num) {
-  for (int i = 0; i < num; i++) {
-    free(bitplanes[i]);
-  }
-  free(bitplanes);
+png_bytep* PngLoader::getImageData() {
+  applyIndexMap();
+  return _pngImageData;
+}
+
+int PngLoader::getByteWidth() {
+  return (_width + 7) / 8;
 }
 
 void PngLoader::freePngImageData() {
-  for(int y = 0; y < _height; y++) {
-    free(_pngImageData[y]);
-  }
-  free(_pngImageData);
+  ImageBuffer::release(std::move(_imageBuffer));
   _pngImageData=0;
 }
 
+void PngLoader::setImageBuffer(std::unique_ptr<ImageBuffer> imageBuffer) {
+  if(_pngImageData)
+    freePngImageData();
+  _imageBuffer=std::move(imageBuffer);
+  _pngImageData=_imageBuffer->rows();
+  _indexMapPending=false;
+}
+
 IffCMAPChunk* PngLoader::createIffCMAPChunk() {
   IffCMAPChunk* iffCMAPChunk=new IffCMAPChunk();
   for(auto rgbColor : rgbPalette) {
@@ -216,6 +223,10 @@ IffCAMGChunk* PngLoader::createIffCAMGChunk(IffBMHDChunk* bmhdChunk, Options& op
   default:
     throw AGAConvException(130, "Unsupported graphics mode provided in options (PngLoader).");
   }
+  if(_hamPlanes)
+    camgChunk->setHam();
+  if(_halfBrite)
+    camgChunk->setHalfBrite();
   return camgChunk;
 }
 
@@ -226,6 +237,10 @@ IffBMHDChunk* PngLoader::createIffBMHDChunk() {
 }
 
 UBYTE PngLoader::getOptimizedBitDepth() {
+  if(_hamPlanes)
+    return _hamPlanes;
+  if(_halfBrite)
+    return 6;
   ULONG paletteSize=(ULONG)rgbPalette.size();
   if(paletteSize==0)
     return 0;
@@ -244,23 +259,25 @@ UBYTE PngLoader::getOptimizedBitDepth() {
 // This routine determines the used colors, and remaps the color indexes to the new color scheme.
 // This can leave some bitplanes unused which can later be ignored if fixed number of bitplanes is requested
 // #newNumColors <= numColors
+// Only the histogram reads all pixels. The remapping of the pixels is deferred (index map) and
+// done line by line in the chunky-to-planar conversion.
 void PngLoader::optimizePngPalette(Options& options) {
+  applyIndexMap();
   const uint32_t colorOffset=(options.reserveBlackBackgroundColor?1:0); // Offset to reserve background color)
   // Max colors is 256
   uint32_t const maxCol=256;
-  uint32_t colorNrCount[maxCol]={}; // Only those color indexes are mapped that have more than 0 uses
+  uint32_t colorNrCount[maxCol]; // Only those color indexes are mapped that have more than 0 uses
   UBYTE colorNrNewIndex[maxCol]={}; // Defines which color-index should be mapped to which new color_index 
+  countColorNrs(colorNrCount);
+  // Color indexes with the same 12 bit color are mapped to the first of them
+  UBYTE colorNrMergedIndex[maxCol];
   for(uint32_t i=0;i<maxCol;i++)
-    colorNrNewIndex[i]=0;
-  for (int y = 0; y < _height; y++) {
-    for (int x = 0; x < _width; x++) {
-      UBYTE palette_index = *(UBYTE*)((_pngImageData[y])+x);
-      assert(palette_index>=0 && (((int)palette_index)<maxCol)); // Note: UBYTE 0-255
-      colorNrCount[palette_index]++;
-    }
+    colorNrMergedIndex[i]=(UBYTE)i;
+  if(options.colorDepth==Options::COL_12BIT && options.merge12BitColors) {
+    mergeDuplicate12BitColors(options, colorNrCount, colorNrMergedIndex);
   }
   int numUsedCol=0;
-  int checkSum=0;
+  uint64_t checkSum=0;
   if(options.debug) cout<<"Color counts:";
   for(uint32_t i=0;i<maxCol;i++) {
     if(options.debug) cout<<+colorNrCount[i]<<" ";
@@ -269,7 +286,7 @@ void PngLoader::optimizePngPalette(Options& options) {
       numUsedCol++;
     }
   }
-  assert(checkSum==_width*_height);
+  assert(checkSum==(uint64_t)_width*_height);
   if(options.debug) cout<<"Number of used colors: "<<numUsedCol<<endl;
   uint32_t newColLastCol=colorOffset;
   for(uint32_t i=0;i<maxCol;i++) {
@@ -299,14 +316,11 @@ void PngLoader::optimizePngPalette(Options& options) {
     cout<<endl;
   }
   
-  // Perform remapping
-  // Remap all body data: iterate over all pixels and remap color index
-  for (int y = 0; y < _height; y++) {
-    for (int x = 0; x < _width; x++) {
-      UBYTE palette_index = *((_pngImageData[y])+x);
-      *((_pngImageData[y])+x)=colorNrNewIndex[palette_index];
-    }
+  // Remapping of all pixels (merged 12 bit colors and new color indexes)
+  for(uint32_t i=0;i<maxCol;i++) {
+    _indexMap[i]=colorNrNewIndex[colorNrMergedIndex[i]];
   }
+  _indexMapPending=true;
   // Rewrite colormap
   // Create copy of colormap (required because mapping can move colors in both directions in color map when reserving colors)
   std::vector<RGBColor> rgbPaletteCopy(rgbPalette);
@@ -324,17 +338,203 @@ void PngLoader::optimizePngPalette(Options& options) {
   rgbPalette.resize(colorOffset+numUsedCol);
   if(options.debug) cout<<"Resized color palette colors: "<<rgbPalette.size()<<endl;
 
-  // Consistency check: ensure that all new color index are within the new color palette
-  int totalCheckCount=0;
+  if(options.debug) {
+    verifyColorNrs(checkSum);
+  }
+}
+
+// Histogram of the palette indexes. Consecutive pixels are counted in
+// separate histograms, such that runs of the same index do not stall on
+// the increment of the same counter.
+void PngLoader::countColorNrs(uint32_t colorNrCount[256]) {
+  const int numHistograms=4;
+  uint32_t histograms[numHistograms][256]={};
+  uint32_t* h0=histograms[0];
+  uint32_t* h1=histograms[1];
+  uint32_t* h2=histograms[2];
+  uint32_t* h3=histograms[3];
+  for (int y = 0; y < _height; y++) {
+    const UBYTE* line=_pngImageData[y];
+    int x=0;
+    for (; x+numHistograms <= _width; x+=numHistograms) {
+      h0[line[x]]++;
+      h1[line[x+1]]++;
+      h2[line[x+2]]++;
+      h3[line[x+3]]++;
+    }
+    for (; x < _width; x++) {
+      h0[line[x]]++;
+    }
+  }
+  for(int i=0;i<256;i++) {
+    colorNrCount[i]=h0[i]+h1[i]+h2[i]+h3[i];
+  }
+}
+
+// Consistency check (debug mode): ensure that all new color index are within the new color palette
+void PngLoader::verifyColorNrs(uint64_t numPixels) {
+  applyIndexMap();
+  uint64_t totalCheckCount=0;
   size_t newColNum=rgbPalette.size();
   for (int y = 0; y < _height; y++) {
     for (int x = 0; x < _width; x++) {
-      UBYTE palette_index = *(UBYTE*)((_pngImageData[y])+x);
-      assert(palette_index<newColNum);
+      if(_pngImageData[y][x]>=newColNum) {
+        throw AGAConvException(316, "Internal: color index "+std::to_string(_pngImageData[y][x])+" of pixel "+std::to_string(x)+","+std::to_string(y)+" is not in the optimized palette of "+std::to_string(newColNum)+" colors.");
+      }
       totalCheckCount++;
     }
   }
-  assert(totalCheckCount==checkSum);
+  if(totalCheckCount!=numPixels) {
+    throw AGAConvException(316, "Internal: optimized palette was computed for "+std::to_string(numPixels)+" pixels, image has "+std::to_string(totalCheckCount)+" pixels.");
+  }
+}
+
+// Different 24 bit colors of the palette can be the same color in a 12 bit palette (see RGBColor::get12BitColor).
+// This routine maps all color indexes of such colors to the first palette entry with the same 12 bit color (and
+// adds their counts to it). The unused entries are then eliminated by optimizePngPalette, which can reduce the
+// number of bitplanes.
+void PngLoader::mergeDuplicate12BitColors(Options& options, uint32_t colorNrCount[256], UBYTE colorNrNewIndex[256]) {
+  std::vector<int> firstColorNrOf12BitColor(4096,-1);
+  int numMergedCol=0;
+  for(size_t i=0;i<rgbPalette.size();i++) {
+    UWORD color12Bit=rgbPalette[i].get12BitColor();
+    if(firstColorNrOf12BitColor[color12Bit]==-1) {
+      firstColorNrOf12BitColor[color12Bit]=(int)i;
+    } else {
+      numMergedCol++;
+      colorNrNewIndex[i]=(UBYTE)firstColorNrOf12BitColor[color12Bit];
+      colorNrCount[colorNrNewIndex[i]]+=colorNrCount[i];
+      colorNrCount[i]=0;
+    }
+  }
+  if(options.debug) cout<<"Merged 12 bit colors: "<<numMergedCol<<endl;
+}
+
+void PngLoader::applyIndexMap() {
+  if(!_indexMapPending)
+    return;
+  for (int y = 0; y < _height; y++) {
+    UBYTE* line=_pngImageData[y];
+    for (int x = 0; x < _width; x++) {
+      line[x]=_indexMap[line[x]];
+    }
+  }
+  _indexMapPending=false;
+}
+
+const UBYTE* PngLoader::mappedLine(int y, std::vector<UBYTE>& lineBuffer) {
+  if(!_indexMapPending)
+    return _pngImageData[y];
+  const UBYTE* line=_pngImageData[y];
+  lineBuffer.resize(_width);
+  for (int x = 0; x < _width; x++) {
+    lineBuffer[x]=_indexMap[line[x]];
+  }
+  return lineBuffer.data();
+}
+
+bool PngLoader::isTruecolorImage() {
+  return _colorType!=PNG_COLOR_TYPE_PALETTE;
+}
+
+void PngLoader::quantizeTruecolorImage(Options& options, unsigned ditherThreads) {
+  assert(isTruecolorImage());
+  assert(_pngImageData);
+  PaletteQuantizer quantizer(options.maxColorsCorrected(), options.quantizerKMeans, options.colorDepth==Options::COL_12BIT);
+  std::vector<RGBColor> palette;
+  // All truecolor color types are read with 4 bytes per pixel (see readPngFile)
+  quantizer.computePalette(_pngImageData, _width, _height, 4, palette);
+  if(options.ditherMode=="none" && options.colorDepth==Options::COL_24BIT) {
+    // Fast path: pixels are mapped to the palette color of their histogram cell
+    std::unique_ptr<ImageBuffer> indexData=allocateIndexData();
+    quantizer.mapToPalette(_pngImageData, _width, _height, 4, indexData->rows());
+    rgbPalette=palette;
+    setIndexData(std::move(indexData));
+  } else {
+    NearestColorIndex paletteIndex(palette);
+    remapTruecolorImage(options, paletteIndex, ditherThreads);
+  }
+}
+
+void PngLoader::remapTruecolorImage(Options& options, const NearestColorIndex& paletteIndex, unsigned ditherThreads) {
+  assert(isTruecolorImage());
+  assert(_pngImageData);
+  FrameDitherer::DitherMethod ditherMethod;
+  uint32_t bayerScale;
+  bool supportedDitherMode=FrameDitherer::parseDitherMode(options.ditherMode, options.ffBayerScale, ditherMethod, bayerScale);
+  assert(supportedDitherMode); // checked in Options::checkQuantizer
+  (void)supportedDitherMode;
+  std::unique_ptr<ImageBuffer> indexData=allocateIndexData();
+  FrameDitherer ditherer(paletteIndex, ditherMethod, bayerScale);
+  ditherer.dither(_pngImageData, _width, _height, 4, indexData->rows(), ditherThreads);
+  rgbPalette=paletteIndex.getPalette();
+  setIndexData(std::move(indexData));
+}
+
+void PngLoader::scaleTruecolorImage(const FrameScaler& scaler, unsigned threads) {
+  assert(isTruecolorImage());
+  assert(_pngImageData);
+  assert(scaler.hasInputSize(_width, _height));
+  std::unique_ptr<ImageBuffer> scaledData=ImageBuffer::acquire(scaler.getOutWidth()*4, scaler.getOutHeight());
+  scaler.scale(_pngImageData, scaledData->rows(), threads);
+  setImageBuffer(std::move(scaledData));
+  _width=scaler.getOutWidth();
+  _height=scaler.getOutHeight();
+}
+
+void PngLoader::convertTruecolorImage(Options& options, unsigned threads) {
+  if(options.colorModeEnum==CM_HAM) {
+    encodeHamImage(options, threads);
+  } else if(options.colorModeEnum==CM_EHB) {
+    encodeEhbImage(options, threads);
+  } else {
+    quantizeTruecolorImage(options, threads);
+  }
+}
+
+void PngLoader::encodeHamImage(Options& options, unsigned threads) {
+  assert(isTruecolorImage());
+  assert(_pngImageData);
+  HamEncoder encoder(options.numPlanes, options.hcHamQuality, options.quantizerKMeans, options.colorDepth==Options::COL_12BIT, options.reserveBlackBackgroundColor);
+  std::unique_ptr<ImageBuffer> codeData=allocateIndexData();
+  std::vector<RGBColor> basePalette;
+  encoder.encode(_pngImageData, _width, _height, 4, basePalette, codeData->rows(), threads);
+  rgbPalette=basePalette;
+  setIndexData(std::move(codeData));
+  _hamPlanes=(UBYTE)options.numPlanes;
+}
+
+bool PngLoader::isHamImage() {
+  return _hamPlanes!=0;
+}
+
+void PngLoader::encodeEhbImage(Options& options, unsigned ditherThreads) {
+  assert(isTruecolorImage());
+  assert(_pngImageData);
+  EhbPaletteQuantizer quantizer(options.colorDepth==Options::COL_12BIT, options.reserveBlackBackgroundColor);
+  std::vector<RGBColor> basePalette;
+  quantizer.computePalette(_pngImageData, _width, _height, 4, basePalette);
+  // Pixels are mapped to the 64 displayed colors, the CMAP only contains the base colors
+  NearestColorIndex paletteIndex(quantizer.fullPalette(basePalette));
+  remapTruecolorImage(options, paletteIndex, ditherThreads);
+  rgbPalette=basePalette;
+  _numPaletteEntries=(int)rgbPalette.size();
+  _halfBrite=true;
+}
+
+bool PngLoader::isEhbImage() {
+  return _halfBrite;
+}
+
+std::unique_ptr<ImageBuffer> PngLoader::allocateIndexData() {
+  return ImageBuffer::acquire(_width, _height);
+}
+
+void PngLoader::setIndexData(std::unique_ptr<ImageBuffer> indexData) {
+  setImageBuffer(std::move(indexData));
+  _colorType=PNG_COLOR_TYPE_PALETTE;
+  _bitDepth=8;
+  _numPaletteEntries=(int)rgbPalette.size();
 }
 
 IffBODYChunk* PngLoader::createIffBODYChunk() {
@@ -342,41 +542,42 @@ IffBODYChunk* PngLoader::createIffBODYChunk() {
     throw AGAConvException(132, "PngLoader: video width = "+std::to_string(_width)+" is not a multiple of 8. Not supported.");
   }
   IffBODYChunk* bodyChunk=new IffBODYChunk();
-  int numBitPlanes=_bitDepth;
-  char** bitplanes;
-  allocateIntermediateBitplanes(bitplanes,numBitPlanes);
-  // Create (uncompressed) ILBM bitlines from PNG chunky data
-  for (int y = 0, writeIndex = 0; y < _height; y++) {
-    for (int byte = 0;byte < getByteWidth(); byte++) {
-      for (int bit = 0; bit < 8; bit++) {	
-        int x = byte * 8 + 7 - bit;
-        // Offset in paletted chunky image 
-        int palette_index = *((_pngImageData[y])+x);
-        for (int plane_index = 0; plane_index < numBitPlanes; plane_index++) {
-          char* plane = bitplanes[plane_index];
-          plane[writeIndex] |= ((palette_index >> plane_index) & 1) << bit;
-        }
-      }
-      writeIndex++;
-    }
+  // Create (uncompressed) ILBM bitlines from PNG chunky data (plane 0 .. n of each line)
+  int numConvertedBitPlanes=getOptimizedBitDepth();
+  // Each bitplane line is aligned to 16 bit (ilbm padding byte)
+  int lineBytes=getByteWidth()+getByteWidth()%2;
+  vector<UBYTE> bitplaneLines((size_t)numConvertedBitPlanes*lineBytes, 0);
+  UBYTE* planes[8];
+  for (int plane_index = 0; plane_index < numConvertedBitPlanes; plane_index++) {
+    planes[plane_index]=&bitplaneLines[(size_t)plane_index*lineBytes];
   }
+  vector<UBYTE> mappedLineBuffer;
+  for (int y = 0; y < _height; y++) {
+    ChunkyToPlanar::convertLine(mappedLine(y, mappedLineBuffer), _width, numConvertedBitPlanes, planes);
+    bodyChunk->add(bitplaneLines.data(), bitplaneLines.size());
+  }
+  return bodyChunk;
+}
 
-  // Add bitplanes to bodyChunk (plane 0 .. n), note: converting to ILBM bitlines
+void PngLoader::createBitPlanarVideo(ByteSequence& video) {
+  if(_width % 8 !=0) {
+    throw AGAConvException(132, "PngLoader: video width = "+std::to_string(_width)+" is not a multiple of 8. Not supported.");
+  }
   int numConvertedBitPlanes=getOptimizedBitDepth();
+  // Same line length as in ILBM bitlines (including the padding byte)
+  ULONG lineBytes=Util::wordAlignedLengthInBytes((UWORD)_width);
+  ULONG planeSize=lineBytes*(ULONG)_height;
+  video.resetData(planeSize*numConvertedBitPlanes);
+  if(planeSize==0)
+    return;
+  UBYTE* planes[8];
+  vector<UBYTE> mappedLineBuffer;
   for (int y = 0; y < _height; y++) {
     for (int plane_index = 0; plane_index < numConvertedBitPlanes; plane_index++) {
-      char* plane = bitplanes[plane_index];
-      for(int i=0;i<getByteWidth();i++) {
-        bodyChunk->add(plane[y*getByteWidth()+i]);
-      }
-      // Align to 16 bit in each bitplane line (ilbm padding byte)
-      if((getByteWidth() % 2) == 1) {
-        bodyChunk->add(0);
-      }
+      planes[plane_index]=video.address(plane_index*planeSize+y*lineBytes);
     }
+    ChunkyToPlanar::convertLine(mappedLine(y, mappedLineBuffer), _width, numConvertedBitPlanes, planes);
   }
-  freeIntermediateBitplanes(bitplanes, numBitPlanes);
-  return bodyChunk;
 }
 
 IffILBMChunk* PngLoader::createILBMChunk(Options& options) {
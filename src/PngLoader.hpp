@@ -19,14 +19,20 @@
 #ifndef PNG_FILE_READER_HPP
 #define PNG_FILE_READER_HPP
 
+#include <array>
 #include <map>
+#include <memory>
 #include <png.h>
 #include <string>
 #include <vector>
 
 #include "AGAConvException.hpp"
+#include "ByteSequence.hpp"
 #include "FrameLoader.hpp"
+#include "FrameScaler.hpp"
 #include "IffILBMChunk.hpp"
+#include "ImageBuffer.hpp"
+#include "NearestColorIndex.hpp"
 #include "RGBColor.hpp"
 #include "Stage.hpp"
 
@@ -52,15 +58,41 @@ class PngLoader : public FrameLoader {
     supported.  Therefore the only information that needs to be set
     is Hires or SuperHires.  This info is either guessed from the
     size (>320, >640) or enforced according to a command line
-    provided resolution. 
+    provided resolution. HAM and EHB are set for images encoded with
+    encodeHamImage and encodeEhbImage.
   */
   IffCMAPChunk* createIffCMAPChunk();
   IffCAMGChunk* createIffCAMGChunk(IffBMHDChunk* bmhdChunk, Options& options);
   IffBMHDChunk* createIffBMHDChunk();
   IffBODYChunk* createIffBODYChunk();
+  //! Sets video to the video data of a CDXL frame, created directly from
+  //! the chunky image: planes 0 .. n one after another, each line word aligned.
+  void createBitPlanarVideo(ByteSequence& video);
 
   void optimizePngPalette(Options& options);
+  //! True if the image has no palette (RGB or gray PNG, read as 4 bytes per pixel).
+  bool isTruecolorImage();
+  //! Reduces a truecolor image to a paletted image with the native quantizer and dithering (with ditherThreads threads).
+  void quantizeTruecolorImage(Options& options, unsigned ditherThreads=1);
+  //! Reduces a truecolor image to a paletted image with the given palette (e.g. the palette of a scene) and dithering.
+  void remapTruecolorImage(Options& options, const NearestColorIndex& paletteIndex, unsigned ditherThreads=1);
+  //! Scales a truecolor image to the output size of the scaler (the scaler's input size must match the image).
+  void scaleTruecolorImage(const FrameScaler& scaler, unsigned threads=1);
+  //! Converts a truecolor image with the native encoder of the color mode (HAM or quantizer) using the given number of threads.
+  void convertTruecolorImage(Options& options, unsigned threads=1);
+  //! Replaces a truecolor image by HAM codes (one byte per pixel) and the HAM base palette.
+  void encodeHamImage(Options& options, unsigned threads=1);
+  //! True if the image data consists of HAM codes (the palette must not be optimized).
+  bool isHamImage();
+  //! Replaces a truecolor image by indexes of the 32 EHB base colors and their half-bright colors (6 planes).
+  void encodeEhbImage(Options& options, unsigned ditherThreads=1);
+  //! True if the image data refers to half-bright colors (the palette must not be optimized).
+  bool isEhbImage();
   UBYTE getOptimizedBitDepth();
+  int getWidth();
+  int getHeight();
+  //! Rows of pixel data (truecolor images: 4 bytes per pixel, paletted images: one palette index per pixel)
+  png_bytep* getImageData();
   std::string colorTypeToString();
 
 protected:
@@ -68,20 +100,36 @@ protected:
   //! If paletted, each byte contains an index value, which refers to the respective color in the palette.
   void readPngFile(char *filename);
   void freePngImageData();
+  //! Replaces the image data (the previous buffer is returned to the pool)
+  void setImageBuffer(std::unique_ptr<ImageBuffer> imageBuffer);
   int _width=0, _height=0;
   png_byte _colorType;
   png_byte _bitDepth=0;
-  png_bytep* _pngImageData = 0;
+  png_bytep* _pngImageData = 0; // Rows of _imageBuffer
+  std::unique_ptr<ImageBuffer> _imageBuffer;
   png_colorp _palette=0;
   int _numPaletteEntries=0;
   //int _optimizedNumPaletteEntries=-1;
   //int _optimizedBitDepth=-1;
   std::vector<RGBColor> rgbPalette;
+  UBYTE _hamPlanes=0; // Number of planes of HAM codes (0: no HAM image)
+  bool _halfBrite=false; // Indexes 32-63 refer to the half-bright colors of the 32 palette colors
 
  private:
   int getByteWidth();
-  void allocateIntermediateBitplanes(char**& bitplanes, int num);
-  void freeIntermediateBitplanes(char** bitplanes, int num);
+  void countColorNrs(uint32_t colorNrCount[256]);
+  void mergeDuplicate12BitColors(Options& options, uint32_t colorNrCount[256], UBYTE colorNrNewIndex[256]);
+  void verifyColorNrs(uint64_t numPixels);
+  //! Palette indexes of optimizePngPalette that are not yet applied to the image data
+  std::array<UBYTE,256> _indexMap;
+  bool _indexMapPending=false;
+  //! Applies the pending index map to the image data
+  void applyIndexMap();
+  //! Line y with the pending index map applied (lineBuffer is used if the index map is pending)
+  const UBYTE* mappedLine(int y, std::vector<UBYTE>& lineBuffer);
+  std::unique_ptr<ImageBuffer> allocateIndexData();
+  //! Replaces the image data with palette indexes (one byte per pixel) referring to rgbPalette
+  void setIndexData(std::unique_ptr<ImageBuffer> indexData);
   
 };
 
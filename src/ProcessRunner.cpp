@@ -0,0 +1,278 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "ProcessRunner.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "AGAConvException.hpp"
+#include "FFmpegProgress.hpp"
+
+extern char** environ;
+
+using namespace std;
+
+namespace AGAConv {
+
+ProcessRunner::ProcessRunner(const string& tool, const vector<string>& arguments):_tool(tool),_arguments(arguments) {
+}
+
+ProcessRunner::~ProcessRunner() {
+  if(isRunning()) {
+    terminate();
+    wait();
+  }
+  if(_stderrReader.joinable())
+    _stderrReader.join();
+  if(_progressReader.joinable())
+    _progressReader.join();
+  if(_stdoutStream)
+    fclose(_stdoutStream);
+}
+
+void ProcessRunner::setStdoutMode(OutputMode mode) {
+  _stdoutMode=mode;
+}
+
+void ProcessRunner::setEchoStderr(bool echo) {
+  _echoStderr=echo;
+}
+
+bool ProcessRunner::getEchoStderr() const {
+  return _echoStderr;
+}
+
+const string& ProcessRunner::getTool() const {
+  return _tool;
+}
+
+void ProcessRunner::setProgress(FFmpegProgress* progress, size_t progressId) {
+  _progress=progress;
+  _progressId=progressId;
+}
+
+void ProcessRunner::closeFd(int& fd) {
+  if(fd>=0) {
+    close(fd);
+    fd=-1;
+  }
+}
+
+void ProcessRunner::createPipe(int fds[2]) {
+  int tmpFds[2];
+#ifdef __linux__
+  int res=pipe2(tmpFds, O_CLOEXEC);
+#else
+  int res=pipe(tmpFds);
+#endif
+  if(res!=0) {
+    throw AGAConvException(210, string("could not create pipe for external tool: ")+strerror(errno));
+  }
+  // Move both ends above the file descriptors set up for the child and make sure that they are not
+  // inherited by any child (otherwise the end of a pipe would not be detected while another child is running).
+  for(int i=0;i<2;i++) {
+    fds[i]=fcntl(tmpFds[i], F_DUPFD_CLOEXEC, progressFileDescriptor+1);
+    close(tmpFds[i]);
+  }
+  if(fds[0]<0 || fds[1]<0) {
+    closeFd(fds[0]);
+    closeFd(fds[1]);
+    throw AGAConvException(210, string("could not create pipe for external tool: ")+strerror(errno));
+  }
+}
+
+void ProcessRunner::start() {
+  if(_pid>0) {
+    throw AGAConvException(313, "external tool "+_tool+" already started.");
+  }
+  int stdoutPipe[2]={-1,-1};
+  int stderrPipe[2]={-1,-1};
+  int progressPipe[2]={-1,-1};
+  try {
+    if(_stdoutMode==OUTPUT_PIPE)
+      createPipe(stdoutPipe);
+    createPipe(stderrPipe);
+    if(_progress)
+      createPipe(progressPipe);
+  } catch(...) {
+    for(int* fd : {&stdoutPipe[0],&stdoutPipe[1],&stderrPipe[0],&stderrPipe[1],&progressPipe[0],&progressPipe[1]})
+      closeFd(*fd);
+    throw;
+  }
+
+  posix_spawn_file_actions_t fileActions;
+  posix_spawn_file_actions_init(&fileActions);
+  // Children do not share the terminal input (tools run concurrently)
+  posix_spawn_file_actions_addopen(&fileActions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  if(_stdoutMode==OUTPUT_DISCARD)
+    posix_spawn_file_actions_addopen(&fileActions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  else if(_stdoutMode==OUTPUT_PIPE)
+    posix_spawn_file_actions_adddup2(&fileActions, stdoutPipe[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&fileActions, stderrPipe[1], STDERR_FILENO);
+  if(_progress)
+    posix_spawn_file_actions_adddup2(&fileActions, progressPipe[1], progressFileDescriptor);
+
+  vector<char*> argv;
+  argv.push_back(const_cast<char*>(_tool.c_str()));
+  for(auto& argument : _arguments)
+    argv.push_back(const_cast<char*>(argument.c_str()));
+  argv.push_back(nullptr);
+
+  int res=posix_spawnp(&_pid, _tool.c_str(), &fileActions, nullptr, argv.data(), environ);
+  posix_spawn_file_actions_destroy(&fileActions);
+  // The write ends are only used by the child
+  closeFd(stdoutPipe[1]);
+  closeFd(stderrPipe[1]);
+  closeFd(progressPipe[1]);
+  if(res!=0) {
+    _pid=-1;
+    closeFd(stdoutPipe[0]);
+    closeFd(stderrPipe[0]);
+    closeFd(progressPipe[0]);
+    throw AGAConvException(211, "could not start "+_tool+": "+strerror(res));
+  }
+  if(_stdoutMode==OUTPUT_PIPE)
+    _stdoutStream=fdopen(stdoutPipe[0], "r");
+  _stderrReader=std::thread(&ProcessRunner::readStderr, this, stderrPipe[0]);
+  if(_progress)
+    _progressReader=std::thread(&ProcessRunner::readProgress, this, progressPipe[0]);
+}
+
+FILE* ProcessRunner::getStdoutStream() {
+  if(!_stdoutStream) {
+    throw AGAConvException(314, "standard output of "+_tool+" is not available.");
+  }
+  return _stdoutStream;
+}
+
+void ProcessRunner::readStderr(int fd) {
+  char buffer[4096];
+  ssize_t numRead;
+  while((numRead=read(fd, buffer, sizeof(buffer)))!=0) {
+    if(numRead<0) {
+      if(errno==EINTR)
+        continue;
+      break;
+    }
+    if(_echoStderr) {
+      cerr.write(buffer, numRead);
+      cerr.flush();
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stderrTail.append(buffer, numRead);
+    if(_stderrTail.size()>maxStderrTailLength)
+      _stderrTail.erase(0, _stderrTail.size()-maxStderrTailLength);
+  }
+  close(fd);
+}
+
+void ProcessRunner::readProgress(int fd) {
+  FILE* progressStream=fdopen(fd, "r");
+  if(!progressStream) {
+    close(fd);
+    return;
+  }
+  char buffer[256];
+  string line;
+  while(fgets(buffer, sizeof(buffer), progressStream)) {
+    line+=buffer;
+    if(line.back()=='\n') {
+      line.pop_back();
+      _progress->processProgressLine(_progressId, line);
+      line.clear();
+    }
+  }
+  fclose(progressStream);
+}
+
+int ProcessRunner::wait() {
+  if(_pid<0) {
+    throw AGAConvException(315, "external tool "+_tool+" waited for, but not started.");
+  }
+  if(!_exited) {
+    // A child blocked on writing its output terminates when the read end is closed
+    if(_stdoutStream) {
+      fclose(_stdoutStream);
+      _stdoutStream=nullptr;
+    }
+    // Waits without reaping the child, such that terminate cannot signal a reused pid
+    siginfo_t info;
+    int waitRes;
+    do {
+      waitRes=waitid(P_PID, (id_t)_pid, &info, WEXITED | WNOWAIT);
+    } while(waitRes<0 && errno==EINTR);
+    int status=0;
+    pid_t res;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _exited=true;
+      do {
+        res=waitpid(_pid, &status, 0);
+      } while(res<0 && errno==EINTR);
+    }
+    if(res<0)
+      _exitCode=127;
+    else if(WIFEXITED(status))
+      _exitCode=WEXITSTATUS(status);
+    else if(WIFSIGNALED(status))
+      _exitCode=128+WTERMSIG(status);
+    else
+      _exitCode=127;
+    if(_stderrReader.joinable())
+      _stderrReader.join();
+    if(_progressReader.joinable())
+      _progressReader.join();
+  }
+  return _exitCode;
+}
+
+void ProcessRunner::terminate() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if(_pid>0 && !_exited)
+    kill(_pid, SIGTERM);
+}
+
+bool ProcessRunner::isRunning() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _pid>0 && !_exited;
+}
+
+string ProcessRunner::getStderrTail() {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stderrTail;
+}
+
+string ProcessRunner::commandLineToString() const {
+  string commandLine=_tool;
+  for(auto& argument : _arguments) {
+    if(argument.find_first_of(" \t\"'$;|&<>()[]*?")!=string::npos || argument.empty())
+      commandLine+=" \""+argument+"\"";
+    else
+      commandLine+=" "+argument;
+  }
+  return commandLine;
+}
+
+} // namespace AGAConv
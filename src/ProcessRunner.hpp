@@ -0,0 +1,96 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef PROCESS_RUNNER_HPP
+#define PROCESS_RUNNER_HPP
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace AGAConv {
+
+class FFmpegProgress;
+
+/* Runs an external tool as child process (posix_spawn, no shell). The
+   arguments are passed as vector, therefore no quoting is
+   required. The standard error output of the child is always read
+   through a pipe. It is either echoed or only kept for reporting it
+   when the tool fails. The standard output can be inherited,
+   discarded, or read by the caller through a pipe. Optionally, a
+   progress pipe is passed to the child as file descriptor 3 (ffmpeg
+   option '-progress pipe:3') and parsed by an FFmpegProgress object.
+   The standard input of the child is /dev/null.
+   A child that is still running when the ProcessRunner object is
+   destroyed (e.g. on an exception) is terminated.
+ */
+class ProcessRunner {
+
+ public:
+  enum OutputMode { OUTPUT_INHERIT, OUTPUT_DISCARD, OUTPUT_PIPE };
+  ProcessRunner(const std::string& tool, const std::vector<std::string>& arguments);
+  ~ProcessRunner();
+  ProcessRunner(const ProcessRunner&)=delete;
+  ProcessRunner& operator=(const ProcessRunner&)=delete;
+  void setStdoutMode(OutputMode mode);
+  void setEchoStderr(bool echo);
+  bool getEchoStderr() const;
+  const std::string& getTool() const;
+  // Progress lines are passed to progress with the id of this process
+  void setProgress(FFmpegProgress* progress, size_t progressId);
+  void start();
+  // Stream of the child's standard output (requires OUTPUT_PIPE)
+  std::FILE* getStdoutStream();
+  // Waits for the child to exit and returns its exit code (128+N if terminated by signal N)
+  int wait();
+  // Sends SIGTERM to a running child. The child must still be waited for.
+  void terminate();
+  bool isRunning();
+  // Last lines of the standard error output of the child
+  std::string getStderrTail();
+  std::string commandLineToString() const;
+  static const int progressFileDescriptor=3;
+
+ private:
+  static void createPipe(int fds[2]);
+  static void closeFd(int& fd);
+  void readStderr(int fd);
+  void readProgress(int fd);
+  std::string _tool;
+  std::vector<std::string> _arguments;
+  OutputMode _stdoutMode=OUTPUT_INHERIT;
+  bool _echoStderr=true;
+  FFmpegProgress* _progress=nullptr;
+  size_t _progressId=0;
+  pid_t _pid=-1;
+  bool _exited=false; // set (under _mutex) before the child is reaped, the pid must not be used anymore
+  int _exitCode=-1;
+  std::FILE* _stdoutStream=nullptr;
+  std::thread _stderrReader;
+  std::thread _progressReader;
+  std::mutex _mutex;
+  std::string _stderrTail;
+  static const size_t maxStderrTailLength=2048;
+};
+
+} // namespace AGAConv
+
+#endif
@@ -0,0 +1,113 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "RawFrameLoader.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <vector>
+
+#include "AGAConvException.hpp"
+
+using namespace std;
+
+namespace AGAConv {
+
+RawFrameLoader::RawFrameLoader(int width, int height, bool truecolor):_truecolor(truecolor) {
+  _width=width;
+  _height=height;
+}
+
+void RawFrameLoader::readFile(string fileName) {
+  throw AGAConvException(312, "Internal: raw frames cannot be read from file "+fileName+".");
+}
+
+bool RawFrameLoader::readFrame(FILE* stream) {
+  assert(stream);
+  assert(_pngImageData==0);
+  if(_truecolor)
+    return readTruecolorFrame(stream);
+  _colorType=PNG_COLOR_TYPE_PALETTE;
+  _bitDepth=8;
+  setImageBuffer(ImageBuffer::acquire(_width, _height));
+  for(int y = 0; y < _height; y++) {
+    size_t numRead=fread(_pngImageData[y], 1, _width, stream);
+    if(numRead!=(size_t)_width) {
+      if(y==0 && numRead==0 && feof(stream)) {
+        // Regular end of stream
+        return false;
+      }
+      throw AGAConvException(134, "incomplete frame in frame stream (line "+std::to_string(y)+" of "+std::to_string(_height)+").");
+    }
+  }
+  UBYTE paletteData[paletteEntries*paletteEntryBytes];
+  if(fread(paletteData, 1, sizeof(paletteData), stream)!=sizeof(paletteData)) {
+    throw AGAConvException(135, "incomplete palette in frame stream.");
+  }
+  // Palette entries are 32 bit ARGB values stored in little endian byte order
+  assert(rgbPalette.size()==0);
+  for(int i=0;i<paletteEntries;i++) {
+    UBYTE* entry=paletteData+i*paletteEntryBytes;
+    rgbPalette.push_back(RGBColor(entry[2],entry[1],entry[0]));
+  }
+  _numPaletteEntries=paletteEntries;
+  return true;
+}
+
+bool RawFrameLoader::readTruecolorFrame(FILE* stream) {
+  allocateTruecolorFrame();
+  std::vector<UBYTE> line(_width*3);
+  for(int y = 0; y < _height; y++) {
+    size_t numRead=fread(line.data(), 1, line.size(), stream);
+    if(numRead!=line.size()) {
+      if(y==0 && numRead==0 && feof(stream)) {
+        // Regular end of stream
+        return false;
+      }
+      throw AGAConvException(134, "incomplete frame in frame stream (line "+std::to_string(y)+" of "+std::to_string(_height)+").");
+    }
+    setTruecolorLine(y, line.data());
+  }
+  return true;
+}
+
+void RawFrameLoader::setTruecolorFrame(const UBYTE* rgbData, int lineSize) {
+  assert(_truecolor && _pngImageData==0);
+  allocateTruecolorFrame();
+  for(int y = 0; y < _height; y++) {
+    setTruecolorLine(y, rgbData+(size_t)y*lineSize);
+  }
+}
+
+void RawFrameLoader::allocateTruecolorFrame() {
+  _colorType=PNG_COLOR_TYPE_RGB;
+  _bitDepth=8;
+  setImageBuffer(ImageBuffer::acquire(_width*4, _height));
+}
+
+void RawFrameLoader::setTruecolorLine(int y, const UBYTE* rgbLine) {
+  // Same layout as truecolor PNG data (RGB and filler byte)
+  for(int x = 0; x < _width; x++) {
+    _pngImageData[y][x*4]=rgbLine[x*3];
+    _pngImageData[y][x*4+1]=rgbLine[x*3+1];
+    _pngImageData[y][x*4+2]=rgbLine[x*3+2];
+    _pngImageData[y][x*4+3]=0xFF;
+  }
+}
+
+} // namespace AGAConv
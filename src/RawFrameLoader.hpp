@@ -0,0 +1,60 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RAW_FRAME_LOADER_HPP
+#define RAW_FRAME_LOADER_HPP
+
+#include <cstdio>
+#include <string>
+
+#include "PngLoader.hpp"
+
+namespace AGAConv {
+
+/* Reads paletted raw frames as emitted by ffmpeg with '-f rawvideo
+   -pix_fmt pal8'. Each frame consists of width*height palette indexes
+   followed by the frame's palette of 256 entries (4 bytes each, BGRA
+   order). The chunky data is the same as that of a paletted PNG,
+   therefore palette optimization and ILBM generation are inherited
+   from PngLoader. Truecolor frames ('-pix_fmt rgb24', 3 bytes per
+   pixel, no palette) are stored like truecolor PNGs (4 bytes per
+   pixel) and must be quantized before ILBM generation.
+ */
+class RawFrameLoader : public PngLoader {
+
+ public:
+  RawFrameLoader(int width, int height, bool truecolor=false);
+  //! Reads the next frame from stream. Returns false if the stream ended before the frame.
+  bool readFrame(std::FILE* stream);
+  //! Raw frames carry no dimensions, they can only be read from a stream.
+  void readFile(std::string fileName) override;
+  //! Sets the truecolor frame from decoded RGB data (3 bytes per pixel, lineSize bytes per line).
+  void setTruecolorFrame(const UBYTE* rgbData, int lineSize);
+
+  static const int paletteEntries=256;
+  static const int paletteEntryBytes=4;
+ private:
+  bool readTruecolorFrame(std::FILE* stream);
+  void allocateTruecolorFrame();
+  void setTruecolorLine(int y, const UBYTE* rgbLine);
+  bool _truecolor;
+};
+
+} // namespace AGAConv
+
+#endif
@@ -0,0 +1,57 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "SceneCutDetector.hpp"
+
+#include <cassert>
+#include <cstdlib>
+
+using namespace std;
+
+namespace AGAConv {
+
+SceneCutDetector::SceneCutDetector(uint32_t thresholdPercent):
+  _thresholdPercent(thresholdPercent) {
+  assert(thresholdPercent<=100);
+}
+
+bool SceneCutDetector::isSceneCut(UBYTE** rows, int width, int height, int bytesPerPixel) {
+  assert(bytesPerPixel==3 || bytesPerPixel==4);
+  vector<uint32_t> histogram(histogramBins, 0);
+  for(int y=0;y<height;y++) {
+    UBYTE* pixel=rows[y];
+    for(int x=0;x<width;x++) {
+      histogram[((pixel[0]>>5)<<6)|((pixel[1]>>5)<<3)|(pixel[2]>>5)]++;
+      pixel+=bytesPerPixel;
+    }
+  }
+  uint64_t numPixels=(uint64_t)width*height;
+  bool sceneCut=true;
+  if(_previousNumPixels>0 && numPixels>0) {
+    // Fraction of pixels in different bins: half of the L1 distance of the normalized histograms
+    double difference=0.0;
+    for(int i=0;i<histogramBins;i++) {
+      difference+=std::abs((double)histogram[i]/numPixels-(double)_previousHistogram[i]/_previousNumPixels);
+    }
+    sceneCut=difference/2.0*100.0>_thresholdPercent;
+  }
+  _previousHistogram.swap(histogram);
+  _previousNumPixels=numPixels;
+  return sceneCut;
+}
+
+} // namespace AGAConv
@@ -0,0 +1,51 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCENE_CUT_DETECTOR_HPP
+#define SCENE_CUT_DETECTOR_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "AmigaTypeDefs.hpp"
+
+namespace AGAConv {
+
+/* Detects scene cuts in a sequence of truecolor frames by comparing
+   the color histograms (3 bits per color channel) of consecutive
+   frames. A cut is detected if the histograms differ in more than
+   thresholdPercent percent of the pixels.
+ */
+class SceneCutDetector {
+
+ public:
+  SceneCutDetector(uint32_t thresholdPercent);
+  // Pixel data is given as rows of bytesPerPixel bytes per pixel (RGB, followed by an ignored byte if bytesPerPixel is 4).
+  // Returns true if the frame starts a new scene (always true for the first frame).
+  bool isSceneCut(UBYTE** rows, int width, int height, int bytesPerPixel);
+
+ private:
+  static const int histogramBins=512;
+  uint32_t _thresholdPercent;
+  std::vector<uint32_t> _previousHistogram;
+  uint64_t _previousNumPixels=0;
+};
+
+} // namespace AGAConv
+
+#endif
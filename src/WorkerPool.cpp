@@ -0,0 +1,59 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace AGAConv {
+
+WorkerPool::WorkerPool(unsigned numWorkers) {
+  for(unsigned i=0;i<std::max(1u,numWorkers);i++) {
+    _workers.emplace_back(&WorkerPool::runTasks, this);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    lock_guard<mutex> lock(_mutex);
+    _stop=true;
+    _tasks.clear();
+  }
+  _taskAvailable.notify_all();
+  for(auto& worker : _workers) {
+    worker.join();
+  }
+}
+
+void WorkerPool::runTasks() {
+  while(true) {
+    function<void()> task;
+    {
+      unique_lock<mutex> lock(_mutex);
+      _taskAvailable.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+      if(_stop)
+        return;
+      task=std::move(_tasks.front());
+      _tasks.pop_front();
+    }
+    task();
+  }
+}
+
+} // namespace AGAConv
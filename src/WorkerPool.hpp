@@ -0,0 +1,67 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace AGAConv {
+
+/* Fixed number of worker threads that run submitted tasks in the
+   order of submission. The destructor discards tasks that have not
+   been started yet (their futures report a broken promise) and waits
+   for the running tasks, such that no task outlives the pool.
+ */
+class WorkerPool {
+
+ public:
+  explicit WorkerPool(unsigned numWorkers);
+  ~WorkerPool();
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+  // Runs task in one of the workers, the future provides its result (or exception)
+  template<typename Task> auto submit(Task task) -> std::future<decltype(task())> {
+    auto packagedTask=std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+    auto result=packagedTask->get_future();
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _tasks.push_back([packagedTask]() { (*packagedTask)(); });
+    }
+    _taskAvailable.notify_one();
+    return result;
+  }
+
+ private:
+  void runTasks();
+  std::mutex _mutex;
+  std::condition_variable _taskAvailable;
+  std::deque<std::function<void()>> _tasks;
+  bool _stop=false;
+  std::vector<std::thread> _workers;
+};
+
+} // namespace AGAConv
+
+#endif
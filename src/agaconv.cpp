@@ -61,18 +61,28 @@ int main(int argc, char **argv) {
     if(options.writeCdxl && options.cdxlEncode && !options.cdxlInfo && !options.cdxlDecode &&!options.ilbmInfo) {
       // Extraction of png files
       ExternalToolDriver etd;
-      etd.checkCommandProcessor();
       if(options.verbose>=1)
         cout<<"Conversion started."<<endl;
       etd.prepareTmpDir(options);
       if(options.verbose>=1)
         cout<<"Converting video file "<<options.inFileName<<endl;
-      etd.runFFMPEGExtraction(options);
 
       // Conversion
-      if(options.conversionTool=="ffmpeg") {
+      if(options.variants.size()>0) {
+        etd.runFFMPEGVariantsConversion(options);
+#ifdef AGACONV_LIBAV
+      } else if(options.libavDecoder()) {
+        etd.runLibavConversion(options);
+#endif
+      } else if(options.pipeFrames) {
+        etd.runFFMPEGPipedConversion(options);
+      } else if(options.overlapEncoding) {
+        etd.runFFMPEGOverlappedConversion(options);
+      } else if(options.conversionTool=="ffmpeg" || options.conversionTool=="native") {
+        etd.runFFMPEGExtraction(options);
         runCDXLEncode(options);
       } else if(options.conversionTool=="ham_convert") {
+        etd.runFFMPEGExtraction(options);
         etd.runHamConvert(options);
       } else {
         throw AGAConvException(1,"unknown conversion tool "+options.conversionTool);
@@ -0,0 +1,105 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Microbenchmark of the chunky-to-planar conversion of a superhires
+// frame with the scalar reference, portable, SSE2 and AVX2 versions
+// (as supported by the CPU). Also verifies that all versions give
+// identical bitplanes.
+// Build and run with 'make benchmark' in the src directory.
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ChunkyToPlanar.hpp"
+
+using namespace std;
+using namespace AGAConv;
+
+static const int frameWidth=1280;
+static const int frameHeight=512;
+static const int repetitions=10;
+
+// Converts the frame repetitions times, returns the time of one conversion
+static double measure(ChunkyToPlanar::Implementation implementation, const vector<UBYTE>& frame, int numPlanes, vector<UBYTE>& bitplanes) {
+  int byteWidth=frameWidth/8;
+  auto start=std::chrono::steady_clock::now();
+  for(int r=0;r<repetitions;r++) {
+    for(int y=0;y<frameHeight;y++) {
+      UBYTE* planes[8];
+      for(int p=0;p<numPlanes;p++) {
+        planes[p]=&bitplanes[((size_t)y*numPlanes+p)*byteWidth];
+      }
+      ChunkyToPlanar::convertLine(implementation, &frame[(size_t)y*frameWidth], frameWidth, numPlanes, planes);
+    }
+  }
+  std::chrono::duration<double, std::milli> duration=std::chrono::steady_clock::now()-start;
+  return duration.count()/repetitions;
+}
+
+int main() {
+  std::mt19937 random(1);
+  bool identical=true;
+  vector<ChunkyToPlanar::Implementation> implementations;
+  for(auto implementation : {ChunkyToPlanar::C2P_SCALAR, ChunkyToPlanar::C2P_PORTABLE, ChunkyToPlanar::C2P_SSE2, ChunkyToPlanar::C2P_AVX2}) {
+    if(ChunkyToPlanar::isSupported(implementation)) {
+      implementations.push_back(implementation);
+    }
+  }
+  cout<<"Chunky-to-planar conversion, "<<frameWidth<<"x"<<frameHeight<<" pixels (times in ms, selected: "
+      <<ChunkyToPlanar::implementationName(ChunkyToPlanar::selectedImplementation())<<")"<<endl;
+  cout<<std::left<<setw(10)<<"planes";
+  for(auto implementation : implementations) {
+    cout<<setw(12)<<ChunkyToPlanar::implementationName(implementation);
+  }
+  cout<<"speedup"<<endl;
+  for(int numPlanes : {5, 6, 7, 8}) {
+    vector<UBYTE> frame((size_t)frameWidth*frameHeight);
+    for(auto& pixel : frame) {
+      pixel=(UBYTE)(random()&((1<<numPlanes)-1));
+    }
+    size_t planesSize=(size_t)frameWidth/8*frameHeight*numPlanes;
+    vector<UBYTE> reference(planesSize);
+    double scalarTime=0, bestTime=0;
+    cout<<std::left<<setw(10)<<numPlanes<<std::fixed<<std::setprecision(2);
+    for(auto implementation : implementations) {
+      vector<UBYTE> bitplanes(planesSize);
+      double time=measure(implementation, frame, numPlanes, bitplanes);
+      if(implementation==ChunkyToPlanar::C2P_SCALAR) {
+        reference=bitplanes;
+        scalarTime=time;
+      } else {
+        identical=identical && bitplanes==reference;
+      }
+      if(implementation==ChunkyToPlanar::selectedImplementation()) {
+        bestTime=time;
+      }
+      cout<<setw(12)<<time;
+    }
+    cout<<scalarTime/bestTime<<"x"<<endl;
+  }
+  if(!identical) {
+    cout<<"Error: results of chunky-to-planar conversions differ."<<endl;
+    return 1;
+  }
+  cout<<"Results of all chunky-to-planar conversions are identical."<<endl;
+  return 0;
+}
@@ -0,0 +1,100 @@
+/*
+    AGAConv - CDXL video converter for Commodore-Amiga computers
+    Copyright (C) 2019-2024 Markus Schordan
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Microbenchmark of the nearest palette color lookup: exhaustive
+// search versus NearestColorIndex (including the lazy construction of
+// the index cells) for a superhires frame. Also verifies that both
+// searches give identical results.
+// Build and run with 'make benchmark' in the src directory.
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "NearestColorIndex.hpp"
+
+using namespace std;
+using namespace AGAConv;
+
+static const int frameWidth=1280;
+static const int frameHeight=512;
+
+// Frame as RGB triples, either noise or a smooth gradient (typical for video frames)
+static vector<UBYTE> createFrame(bool noise, std::mt19937& random) {
+  vector<UBYTE> frame;
+  for(int y=0;y<frameHeight;y++) {
+    for(int x=0;x<frameWidth;x++) {
+      if(noise) {
+        frame.push_back((UBYTE)random());
+        frame.push_back((UBYTE)random());
+        frame.push_back((UBYTE)random());
+      } else {
+        frame.push_back((UBYTE)(x*255/frameWidth));
+        frame.push_back((UBYTE)(y*255/frameHeight));
+        frame.push_back((UBYTE)((x+y)*255/(frameWidth+frameHeight)));
+      }
+    }
+  }
+  return frame;
+}
+
+template<typename Lookup> static double measure(const vector<UBYTE>& frame, vector<UBYTE>& indexes, Lookup lookup) {
+  auto start=std::chrono::steady_clock::now();
+  for(size_t i=0;i<indexes.size();i++) {
+    indexes[i]=(UBYTE)lookup(frame[i*3], frame[i*3+1], frame[i*3+2]);
+  }
+  std::chrono::duration<double, std::milli> duration=std::chrono::steady_clock::now()-start;
+  return duration.count();
+}
+
+int main() {
+  std::mt19937 random(1);
+  bool identical=true;
+  cout<<"Nearest palette color lookup, "<<frameWidth<<"x"<<frameHeight<<" pixels (times in ms)"<<endl;
+  cout<<std::left<<setw(10)<<"colors"<<setw(10)<<"frame"<<setw(14)<<"exhaustive"<<setw(14)<<"index(cold)"<<setw(14)<<"index(warm)"<<"speedup(cold)"<<endl;
+  for(int numColors : {16, 32, 64, 256}) {
+    vector<RGBColor> palette;
+    for(int i=0;i<numColors;i++) {
+      palette.push_back(RGBColor((UBYTE)random(), (UBYTE)random(), (UBYTE)random()));
+    }
+    for(bool noise : {false, true}) {
+      vector<UBYTE> frame=createFrame(noise, random);
+      vector<UBYTE> exhaustiveIndexes(frameWidth*frameHeight), indexIndexes(frameWidth*frameHeight);
+      NearestColorIndex paletteIndex(palette);
+      double exhaustiveTime=measure(frame, exhaustiveIndexes, [&paletteIndex](int r, int g, int b) { return paletteIndex.nearestColorIndexExhaustive(r, g, b); });
+      double coldTime=measure(frame, indexIndexes, [&paletteIndex](int r, int g, int b) { return paletteIndex.nearestColorIndex(r, g, b); });
+      identical=identical && indexIndexes==exhaustiveIndexes;
+      double warmTime=measure(frame, indexIndexes, [&paletteIndex](int r, int g, int b) { return paletteIndex.nearestColorIndex(r, g, b); });
+      identical=identical && indexIndexes==exhaustiveIndexes;
+      cout<<std::left<<setw(10)<<numColors<<setw(10)<<(noise?"noise":"gradient")
+          <<std::fixed<<std::setprecision(2)
+          <<setw(14)<<exhaustiveTime<<setw(14)<<coldTime<<setw(14)<<warmTime
+          <<exhaustiveTime/coldTime<<"x"<<endl;
+    }
+  }
+  if(!identical) {
+    cout<<"Error: results of index and exhaustive search differ."<<endl;
+    return 1;
+  }
+  cout<<"Results of index and exhaustive search are identical."<<endl;
+  return 0;
+}